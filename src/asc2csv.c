@@ -3,12 +3,78 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include "ascreader.h"
+#include "blockwriter.h"
+
+#define ROWS_PER_THREAD 32
+
+// One round of rows, parsed and waiting to be formatted; each row is a block
+typedef struct {
+    const AscGrid *grid;
+    const float *values;
+    const char *x_text;
+    const size_t *x_start;
+    int first_row;
+    int decimals;
+} CsvRound;
+
+void format_row(void *ctx, int block, TextBuffer *out) {
+    const CsvRound *round = (const CsvRound *)ctx;
+    const AscGrid *grid = round->grid;
+    const float *row_values = round->values + (size_t)block * grid->ncols;
+
+    char y_text[NUMFORMAT_SIZE];
+    double top_y = grid->yllcorner + (grid->nrows * grid->cellsize);
+    double current_y = top_y - (round->first_row + block) * grid->cellsize;
+    size_t y_length = (size_t)format_fixed(y_text, current_y, round->decimals);
+
+    for (int col = 0; col < grid->ncols; col++) {
+        if (asc_is_nodata(grid, row_values[col])) continue;
+
+        size_t x_length = round->x_start[col + 1] - round->x_start[col];
+        char *p = text_reserve(out, x_length + y_length + NUMFORMAT_SIZE + 3);
+        if (!p) return;
+        memcpy(p, round->x_text + round->x_start[col], x_length);
+        p += x_length;
+        *p++ = ',';
+        memcpy(p, y_text, y_length);
+        p += y_length;
+        *p++ = ',';
+        p += format_fixed(p, row_values[col], round->decimals);
+        *p++ = '\n';
+        out->used = (size_t)(p - out->data);
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input.asc>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input.asc> [-decimals N] [-threads N]\n", argv[0]);
         return 1;
     }
 
+    int decimals = 6;
+    int thread_count = 1;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-decimals") == 0 && i + 1 < argc) {
+            char *end;
+            long value = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || value < 0 || value > NUMFORMAT_MAX_DECIMALS) {
+                fprintf(stderr, "Invalid number of decimals. It must be between 0 and %d.\n", NUMFORMAT_MAX_DECIMALS);
+                return 1;
+            }
+            decimals = (int)value;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s <input.asc> [-decimals N] [-threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+
     char *input_file = argv[1];
     char output_file[256];
 
@@ -18,63 +84,86 @@ int main(int argc, char *argv[]) {
     if (dot) *dot = '\0';
     strcat(output_file, ".csv");
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
+    AscGrid grid;
+    int status = asc_open(input_file, &grid);
+    if (status != ASC_OK) {
+        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, asc_error_message(status));
         return 1;
     }
 
-    char line[255];
-    int nrows_value = 0, ncols_value = 0, nodata_value = 0;
-    float xllcorner_value = 0.0, yllcorner_value = 0.0, cellsize_value = 0.0;
-
-    for (int i = 0; i < 6; i++) {
-        fgets(line, sizeof(line), fp);
-        if (strstr(line, "nrows")) sscanf(line, "%*s %d", &nrows_value);
-        else if (strstr(line, "ncols")) sscanf(line, "%*s %d", &ncols_value);
-        else if (strstr(line, "xllcorner")) sscanf(line, "%*s %f", &xllcorner_value);
-        else if (strstr(line, "yllcorner")) sscanf(line, "%*s %f", &yllcorner_value);
-        else if (strstr(line, "cellsize")) sscanf(line, "%*s %f", &cellsize_value);
-        else if (strstr(line, "nodata_value")) sscanf(line, "%*s %d", &nodata_value);
-    }
-
     printf("Header processed, generating '%s'\n", output_file);
 
     FILE *csv_file = fopen(output_file, "w");
     if (csv_file == NULL) {
         fprintf(stderr, "Error creating output file '%s': %s\n", output_file, strerror(errno));
-        fclose(fp);
+        asc_close(&grid);
         return 1;
     }
 
-    fprintf(csv_file, "X,Y,Z\n");
-
-    float current_x = xllcorner_value;
-    float current_y = yllcorner_value + (nrows_value * cellsize_value);
-
-    for (int row = 0; row < nrows_value; row++) {
-        current_x = xllcorner_value;
-        for (int col = 0; col < ncols_value; col++) {
-            float z_value;
-            if (fscanf(fp, "%f", &z_value) == 1) {
-                if ((int)z_value != nodata_value) {
-                    fprintf(csv_file, "%f,%f,%f\n", current_x, current_y, z_value);
-                }
-            } else {
-                fprintf(stderr, "Error reading data at row %d, col %d\n", row, col);
-                fclose(fp);
-                fclose(csv_file);
-                return 1;
-            }
-            current_x += cellsize_value;
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    int round_rows = ROWS_PER_THREAD * pool_size(pool);
+    if (round_rows > grid.nrows) round_rows = grid.nrows;
+
+    // X only depends on the column, so its text is formatted once up front
+    float *values = malloc((size_t)round_rows * grid.ncols * sizeof(float));
+    size_t *x_start = malloc(((size_t)grid.ncols + 1) * sizeof(size_t));
+    char *x_text = malloc((size_t)grid.ncols * NUMFORMAT_SIZE);
+    if (!values || !x_start || !x_text) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(values);
+        free(x_start);
+        free(x_text);
+        pool_destroy(pool);
+        asc_close(&grid);
+        fclose(csv_file);
+        return 1;
+    }
+
+    x_start[0] = 0;
+    for (int col = 0; col < grid.ncols; col++) {
+        double current_x = grid.xllcorner + col * grid.cellsize;
+        x_start[col + 1] = x_start[col] + (size_t)format_fixed(x_text + x_start[col], current_x, decimals);
+    }
+
+    fputs("X,Y,Z\n", csv_file);
+
+    BlockWriter writer;
+    block_writer_init(&writer, csv_file, pool);
+    CsvRound round = { &grid, values, x_text, x_start, 0, decimals };
+
+    for (int row = 0; row < grid.nrows; row += round_rows) {
+        int rows = grid.nrows - row < round_rows ? grid.nrows - row : round_rows;
+        size_t wanted = (size_t)rows * grid.ncols;
+        size_t read = asc_read_cells(&grid, values, wanted, pool);
+        if (read != wanted) {
+            fprintf(stderr, "Error reading data at row %d, col %d\n",
+                    row + (int)(read / grid.ncols), (int)(read % grid.ncols));
+            block_writer_free(&writer);
+            free(values);
+            free(x_start);
+            free(x_text);
+            pool_destroy(pool);
+            asc_close(&grid);
+            fclose(csv_file);
+            return 1;
         }
-        current_y -= cellsize_value;
+
+        round.first_row = row;
+        if (block_writer_run(&writer, rows, format_row, &round) != 0) break;
     }
+    int write_failed = writer.failed;
 
-    printf("Conversion completed successfully. Output saved to '%s'\n", output_file);
+    block_writer_free(&writer);
+    free(values);
+    free(x_start);
+    free(x_text);
+    pool_destroy(pool);
+    asc_close(&grid);
+    if (fclose(csv_file) != 0 || write_failed) {
+        fprintf(stderr, "Error writing output file '%s'\n", output_file);
+        return 1;
+    }
 
-    fclose(fp);
-    fclose(csv_file);
+    printf("Conversion completed successfully. Output saved to '%s'\n", output_file);
     return 0;
 }
-
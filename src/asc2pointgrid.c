@@ -3,23 +3,89 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include "ascreader.h"
+#include "dxfwriter.h"
+
+#define ROWS_PER_THREAD 16
+
+// One round of sampled rows; each row is a block of INSERT and TEXT pairs
+typedef struct {
+    const AscGrid *grid;
+    const float *values;
+    int samples;
+    int step;
+    int first_row;
+    float nodata;
+    const DxfWriter *file;
+} GridRound;
+
+void format_row(void *ctx, int block, TextBuffer *out) {
+    const GridRound *round = (const GridRound *)ctx;
+    const AscGrid *grid = round->grid;
+    const float *row_values = round->values + (size_t)block * round->samples;
+    int row = round->first_row + block * round->step;
+
+    DxfWriter dxf_file;
+    dxf_writer_attach(&dxf_file, out, round->file);
+
+    double current_y = grid->yllcorner + (double)(grid->nrows - row) * grid->cellsize;
+    for (int col = 0, sample = 0; col < grid->ncols; col += round->step, sample++) {
+        float z_value = row_values[sample];
+        if (z_value == round->nodata) continue;
+
+        double current_x = grid->xllcorner + (double)col * grid->cellsize;
+        dxf_string(&dxf_file, 0, "INSERT");
+        dxf_string(&dxf_file, 8, "0");
+        dxf_string(&dxf_file, 2, "CrossBlock");
+        dxf_real(&dxf_file, 10, current_x, 6);
+        dxf_real(&dxf_file, 20, current_y, 6);
+        dxf_real(&dxf_file, 30, z_value, 6);
+
+        char label[NUMFORMAT_SIZE + 1];
+        label[format_fixed(label, z_value, 2)] = '\0';
+        dxf_string(&dxf_file, 0, "TEXT");
+        dxf_string(&dxf_file, 8, "0");
+        dxf_real(&dxf_file, 10, current_x + 0.25, 6);
+        dxf_real(&dxf_file, 20, current_y + 0.25, 6);
+        dxf_real(&dxf_file, 30, z_value, 6);
+        dxf_string(&dxf_file, 1, label);
+        dxf_real(&dxf_file, 40, 0.2, 1);
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s <input.asc> -spacing <spacing_value>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <input.asc> -spacing <spacing_value> [-binary] [-threads N]\n", argv[0]);
         return 1;
     }
 
     char *input_file = argv[1];
     float spacing_value = 0.0;
-
-    if (argc == 4 && strcmp(argv[2], "-spacing") == 0) {
-        spacing_value = atof(argv[3]);
-        if (spacing_value <= 0) {
-            fprintf(stderr, "Invalid spacing value. It must be greater than 0.\n");
+    int binary = 0;
+    int thread_count = 1;
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-spacing") == 0 && i + 1 < argc) {
+            spacing_value = atof(argv[++i]);
+            if (spacing_value <= 0) {
+                fprintf(stderr, "Invalid spacing value. It must be greater than 0.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-binary") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s <input.asc> -spacing <spacing_value> [-binary] [-threads N]\n", argv[0]);
             return 1;
         }
-    } else {
-        fprintf(stderr, "Usage: %s <input.asc> -spacing <spacing_value>\n", argv[0]);
+    }
+    if (spacing_value <= 0) {
+        fprintf(stderr, "Usage: %s <input.asc> -spacing <spacing_value> [-binary] [-threads N]\n", argv[0]);
         return 1;
     }
 
@@ -30,85 +96,109 @@ int main(int argc, char *argv[]) {
     if (dot) *dot = '\0';
     strcat(output_file, ".dxf");
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
+    AscGrid grid;
+    int status = asc_open(input_file, &grid);
+    if (status != ASC_OK) {
+        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, asc_error_message(status));
         return 1;
     }
 
-    char line[255];
-    int nrows_value = 0, ncols_value = 0, nodata_int_value = -9999;
-    float xllcorner_value = 0.0, yllcorner_value = 0.0, cellsize_value = 0.0, nodata_float_value = -9999.0;
-
-    for (int i = 0; i < 6; i++) {
-        fgets(line, sizeof(line), fp);
-        if (strstr(line, "nrows")) sscanf(line, "%*s %d", &nrows_value);
-        else if (strstr(line, "ncols")) sscanf(line, "%*s %d", &ncols_value);
-        else if (strstr(line, "xllcorner")) sscanf(line, "%*s %f", &xllcorner_value);
-        else if (strstr(line, "yllcorner")) sscanf(line, "%*s %f", &yllcorner_value);
-        else if (strstr(line, "cellsize")) sscanf(line, "%*s %f", &cellsize_value);
-        else if (strstr(line, "nodata_value")) sscanf(line, "%*s %d", &nodata_int_value);
-    }
-
-    nodata_float_value = (float)nodata_int_value;
+    int nrows_value = grid.nrows, ncols_value = grid.ncols;
+    float cellsize_value = grid.cellsize;
+    float nodata_float_value = grid.has_nodata ? (float)grid.nodata_value : -9999.0f;
 
     printf("Header processed, generating '%s'\n", output_file);
 
-    FILE *dxf_file = fopen(output_file, "w");
-    if (dxf_file == NULL) {
+    DxfWriter dxf_file;
+    if (dxf_writer_open(&dxf_file, output_file, binary, 0) != 0) {
         fprintf(stderr, "Error creating output file '%s': %s\n", output_file, strerror(errno));
-        fclose(fp);
+        asc_close(&grid);
+        return 1;
+    }
+
+    // Cells are kept on every step-th column and on every step-th row counted
+    // up from the bottom edge, so only those rows and cells are ever parsed.
+    int step = (int)(spacing_value / cellsize_value);
+    if (step < 1) step = 1;
+    int samples = (ncols_value + step - 1) / step;
+
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    int round_rows = ROWS_PER_THREAD * pool_size(pool);
+    float *row_values = malloc((size_t)round_rows * samples * sizeof(float));
+    if (!row_values) {
+        fprintf(stderr, "Memory allocation failed\n");
+        pool_destroy(pool);
+        asc_close(&grid);
+        dxf_writer_close(&dxf_file);
         return 1;
     }
 
-    fprintf(dxf_file, "0\nSECTION\n2\nHEADER\n0\nENDSEC\n");
-    fprintf(dxf_file, "0\nSECTION\n2\nTABLES\n0\nENDSEC\n");
-    fprintf(dxf_file, "0\nSECTION\n2\nBLOCKS\n");
-    fprintf(dxf_file, "0\nBLOCK\n8\n0\n2\nCrossBlock\n70\n0\n");
-    fprintf(dxf_file, "10\n0.0\n20\n0.0\n30\n0.0\n");
-    fprintf(dxf_file, "0\nLINE\n8\n0\n10\n-0.5\n20\n0.0\n30\n0.0\n11\n0.5\n21\n0.0\n31\n0.0\n");
-    fprintf(dxf_file, "0\nLINE\n8\n0\n10\n0.0\n20\n-0.5\n30\n0.0\n11\n0.0\n21\n0.5\n31\n0.0\n");
-    fprintf(dxf_file, "0\nENDBLK\n");
-    fprintf(dxf_file, "0\nENDSEC\n");
-
-    fprintf(dxf_file, "0\nSECTION\n2\nENTITIES\n");
-
-    float current_x = xllcorner_value;
-    float current_y = yllcorner_value + (nrows_value * cellsize_value);
-
-    float scale_factor = 0.8 * (cellsize_value / 1.0);
-
-    for (int row = 0; row < nrows_value; row++) {
-        current_x = xllcorner_value;
-        for (int col = 0; col < ncols_value; col++) {
-            float z_value;
-            if (fscanf(fp, "%f", &z_value) == 1) {
-                if (z_value != nodata_float_value) {
-                    if (((int)((current_x - xllcorner_value) / cellsize_value) % (int)(spacing_value / cellsize_value) == 0) && 
-                        ((int)((current_y - yllcorner_value) / cellsize_value) % (int)(spacing_value / cellsize_value) == 0)) {
-                        fprintf(dxf_file, "0\nINSERT\n8\n0\n2\nCrossBlock\n10\n%f\n20\n%f\n30\n%f\n", 
-                                current_x, current_y, z_value);
-                        
-                        fprintf(dxf_file, "0\nTEXT\n8\n0\n10\n%f\n20\n%f\n30\n%f\n1\n%.2f\n40\n0.2\n", 
-                                current_x + 0.25, current_y + 0.25, z_value, z_value);
-                    }
-
-                }
-            } else {
-                fprintf(stderr, "Error reading data at row %d, col %d\n", row, col);
-                fclose(fp);
-                fclose(dxf_file);
+    dxf_write_header(&dxf_file);
+    dxf_string(&dxf_file, 0, "SECTION");
+    dxf_string(&dxf_file, 2, "TABLES");
+    dxf_string(&dxf_file, 0, "ENDSEC");
+    dxf_string(&dxf_file, 0, "SECTION");
+    dxf_string(&dxf_file, 2, "BLOCKS");
+    dxf_string(&dxf_file, 0, "BLOCK");
+    dxf_string(&dxf_file, 8, "0");
+    dxf_string(&dxf_file, 2, "CrossBlock");
+    dxf_int(&dxf_file, 70, 0);
+    dxf_real(&dxf_file, 10, 0.0, 1);
+    dxf_real(&dxf_file, 20, 0.0, 1);
+    dxf_real(&dxf_file, 30, 0.0, 1);
+    // The cross is two unit lines through the insertion point
+    for (int line = 0; line < 2; ++line) {
+        dxf_string(&dxf_file, 0, "LINE");
+        dxf_string(&dxf_file, 8, "0");
+        dxf_real(&dxf_file, 10, line == 0 ? -0.5 : 0.0, 1);
+        dxf_real(&dxf_file, 20, line == 0 ? 0.0 : -0.5, 1);
+        dxf_real(&dxf_file, 30, 0.0, 1);
+        dxf_real(&dxf_file, 11, line == 0 ? 0.5 : 0.0, 1);
+        dxf_real(&dxf_file, 21, line == 0 ? 0.0 : 0.5, 1);
+        dxf_real(&dxf_file, 31, 0.0, 1);
+    }
+    dxf_string(&dxf_file, 0, "ENDBLK");
+    dxf_string(&dxf_file, 0, "ENDSEC");
+
+    dxf_string(&dxf_file, 0, "SECTION");
+    dxf_string(&dxf_file, 2, "ENTITIES");
+
+    BlockWriter blocks;
+    block_writer_init(&blocks, NULL, pool);
+    GridRound round = { &grid, row_values, samples, step, 0, nodata_float_value, &dxf_file };
+    int row = 0;
+
+    for (int wanted = nrows_value % step; wanted < nrows_value; ) {
+        round.first_row = wanted;
+        int rows = 0;
+        for (; rows < round_rows && wanted < nrows_value; rows++, wanted += step) {
+            int skipped = asc_skip_rows(&grid, wanted - row);
+            int read = (skipped == wanted - row)
+                ? asc_read_row_stride(&grid, row_values + (size_t)rows * samples, step) : 0;
+            if (read != ncols_value) {
+                fprintf(stderr, "Error reading data at row %d, col %d\n", row + skipped, read);
+                block_writer_free(&blocks);
+                free(row_values);
+                pool_destroy(pool);
+                asc_close(&grid);
+                dxf_writer_close(&dxf_file);
                 return 1;
             }
-            current_x += cellsize_value;
+            row = wanted + 1;
         }
-        current_y -= cellsize_value;
+        if (dxf_write_blocks(&dxf_file, &blocks, rows, format_row, &round) != 0) break;
+    }
+    block_writer_free(&blocks);
+    pool_destroy(pool);
+
+    dxf_string(&dxf_file, 0, "ENDSEC");
+    dxf_string(&dxf_file, 0, "EOF");
+    free(row_values);
+    asc_close(&grid);
+    if (dxf_writer_close(&dxf_file) != 0) {
+        fprintf(stderr, "Error writing output file '%s'\n", output_file);
+        return 1;
     }
-
-    fprintf(dxf_file, "0\nENDSEC\n");
-    fprintf(dxf_file, "0\nEOF\n");
-    fclose(fp);
-    fclose(dxf_file);
 
     printf("Conversion completed successfully. Output saved to '%s'\n", output_file);
 
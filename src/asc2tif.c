@@ -4,203 +4,959 @@
 #include <errno.h>
 #include <stdint.h>
 
-void write_geotiff(const char *filename, int ncols, int nrows, float xllcorner, float yllcorner, float cellsize, float *data, int epsg_code) {
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        perror("Cannot open GeoTIFF file");
-        return;
+#include "ascreader.h"
+#include "deflate.h"
+#include "lzw.h"
+
+// Strips are kept around this size so the writer only ever holds a bounded
+// band of rows, however large the grid is.
+#define STRIP_TARGET_BYTES (1 << 20)
+#define BATCH_TARGET_BYTES (16 << 20)
+#define DEFAULT_TILE_SIZE 256
+#define DEFLATE_LEVEL 6
+
+#define TIFF_ASCII 2
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_DOUBLE 12
+#define TIFF_LONG8 16
+
+#define COMPRESSION_NONE 1
+#define COMPRESSION_LZW 5
+#define COMPRESSION_DEFLATE 8
+#define PREDICTOR_NONE 1
+#define PREDICTOR_FLOATING_POINT 3
+
+// Classic TIFF stores every offset in 32 bits. Anything that could end past
+// this point is written as BigTIFF (version 43, 64-bit offsets) instead.
+#define CLASSIC_TIFF_LIMIT ((uint64_t)UINT32_MAX)
+
+#define MAX_TIFF_ENTRIES 20
+#define MAX_COG_LEVELS 32
+
+#define RESAMPLING_MEAN 0
+#define RESAMPLING_NEAREST 1
+
+typedef struct {
+    uint16_t tag_id;
+    uint16_t data_type;
+    uint64_t count;
+    const void *values;
+} TiffEntry;
+
+typedef struct {
+    TiffEntry entries[MAX_TIFF_ENTRIES];
+    int entry_count;
+} TiffIfd;
+
+// Storage for the tag values an IFD points at
+typedef struct {
+    uint32_t subfile_type;
+    uint32_t image_width;
+    uint32_t image_length;
+    uint16_t bits_per_sample;
+    uint16_t compression;
+    uint16_t photometric;
+    uint32_t block_width;
+    uint32_t block_height;
+    uint16_t predictor;
+    uint16_t sample_format;
+    double pixel_scale[3];
+    double tiepoint[6];
+    uint16_t geo_key_dir[16];
+    char nodata_text[32];
+} TiffTagValues;
+
+typedef struct {
+    int tiled;
+    int tile_size;
+    int compression;
+    int force_bigtiff;
+    int cog;
+    int resampling;
+} GeoTiffOptions;
+
+// Pixel data is written as blocks: full-width strips, or square tiles when
+// tiling is on. Blocks are numbered row-major, which is also the order their
+// offsets appear in StripOffsets/TileOffsets.
+typedef struct {
+    FILE *file;
+    int ncols;
+    int nrows;
+    int tiled;
+    int block_width;
+    int block_height;
+    int blocks_across;
+    int blocks_down;
+    int block_count;
+    int blocks_written;
+    uint64_t *block_offsets;
+    uint64_t *block_byte_counts;
+    uint64_t file_offset;
+    int bigtiff;
+    int compression;
+    int predictor;
+    float fill_value;
+} GeoTiffWriter;
+
+// Per-worker scratch for encoding one block
+typedef struct {
+    uint8_t *pixels;
+    uint8_t *row_scratch;
+    uint8_t *encoded;
+    size_t encoded_capacity;
+    const uint8_t *output;
+    size_t output_size;
+} BlockSlot;
+
+typedef struct {
+    GeoTiffWriter *tif;
+    const float *band;
+    int band_first_row;
+    int first_block;
+    BlockSlot *slots;
+} BlockJob;
+
+static int tiff_type_size(uint16_t data_type) {
+    switch (data_type) {
+        case TIFF_ASCII: return 1;
+        case TIFF_SHORT: return 2;
+        case TIFF_LONG: return 4;
+        case TIFF_DOUBLE: return 8;
+        case TIFF_LONG8: return 8;
+        default: return 1;
     }
+}
 
-    // Step 1: Write TIFF header
-    uint16_t byte_order = 0x4949;
-    uint16_t version = 42;
-    uint32_t ifd_offset = 8;
+static void tiff_add_entry(TiffIfd *ifd, uint16_t tag_id, uint16_t data_type, uint64_t count, const void *values) {
+    // Entries must be sorted by tag, keep the list ordered as they are added
+    int i = ifd->entry_count++;
+    while (i > 0 && ifd->entries[i - 1].tag_id > tag_id) {
+        ifd->entries[i] = ifd->entries[i - 1];
+        i--;
+    }
+    ifd->entries[i].tag_id = tag_id;
+    ifd->entries[i].data_type = data_type;
+    ifd->entries[i].count = count;
+    ifd->entries[i].values = values;
+}
+
+// Size of an IFD plus its out-of-line tag values, as tiff_write_ifd lays it
+// out. Always even, so IFDs written back to back stay word aligned.
+static uint64_t tiff_ifd_size(int bigtiff, const TiffIfd *ifd) {
+    int value_size = bigtiff ? 8 : 4;
+    int entry_size = bigtiff ? 20 : 12;
+    int count_size = bigtiff ? 8 : 2;
+
+    uint64_t size = count_size + (uint64_t)ifd->entry_count * entry_size + value_size;
+    for (int i = 0; i < ifd->entry_count; i++) {
+        uint64_t value_bytes = ifd->entries[i].count * tiff_type_size(ifd->entries[i].data_type);
+        if (value_bytes > (uint64_t)value_size) size += value_bytes + (value_bytes & 1);
+    }
+    return size;
+}
+
+// Writes the IFD at *file_offset, followed by any tag values that do not fit
+// in the entry's value field (4 bytes classic, 8 bytes BigTIFF), and advances
+// *file_offset past them. Returns the IFD offset.
+static uint64_t tiff_write_ifd(FILE *file, int bigtiff, uint64_t *file_offset, TiffIfd *ifd, uint64_t next_ifd_offset) {
+    if (*file_offset & 1) {
+        fputc(0, file);
+        (*file_offset)++;
+    }
+
+    int value_size = bigtiff ? 8 : 4;
+    int entry_size = bigtiff ? 20 : 12;
+    int count_size = bigtiff ? 8 : 2;
 
+    uint64_t ifd_offset = *file_offset;
+    uint64_t overflow_offset = ifd_offset + count_size + (uint64_t)ifd->entry_count * entry_size + value_size;
+
+    uint64_t num_entries = (uint64_t)ifd->entry_count;
+    fwrite(&num_entries, count_size, 1, file);
+
+    for (int i = 0; i < ifd->entry_count; i++) {
+        TiffEntry *entry = &ifd->entries[i];
+        uint64_t size = entry->count * tiff_type_size(entry->data_type);
+        uint8_t value_field[8] = {0};
+
+        if (size <= (uint64_t)value_size) {
+            memcpy(value_field, entry->values, size);
+        } else {
+            memcpy(value_field, &overflow_offset, value_size);
+            overflow_offset += size + (size & 1);
+        }
+
+        fwrite(&entry->tag_id, sizeof(uint16_t), 1, file);
+        fwrite(&entry->data_type, sizeof(uint16_t), 1, file);
+        fwrite(&entry->count, bigtiff ? 8 : 4, 1, file);
+        fwrite(value_field, 1, value_size, file);
+    }
+
+    fwrite(&next_ifd_offset, value_size, 1, file);
+
+    for (int i = 0; i < ifd->entry_count; i++) {
+        TiffEntry *entry = &ifd->entries[i];
+        uint64_t size = entry->count * tiff_type_size(entry->data_type);
+        if (size <= (uint64_t)value_size) continue;
+        fwrite(entry->values, 1, size, file);
+        if (size & 1) fputc(0, file);
+    }
+
+    *file_offset = overflow_offset;
+    return ifd_offset;
+}
+
+// Writes the 8 byte (classic) or 16 byte (BigTIFF) header and returns its size
+static uint64_t tiff_write_header(FILE *file, int bigtiff, uint64_t first_ifd_offset) {
+    uint16_t byte_order = 0x4949;
+    uint16_t version = bigtiff ? 43 : 42;
     fwrite(&byte_order, sizeof(byte_order), 1, file);
     fwrite(&version, sizeof(version), 1, file);
+
+    if (bigtiff) {
+        uint16_t offset_size = 8;
+        uint16_t reserved = 0;
+        fwrite(&offset_size, sizeof(offset_size), 1, file);
+        fwrite(&reserved, sizeof(reserved), 1, file);
+        fwrite(&first_ifd_offset, sizeof(first_ifd_offset), 1, file);
+        return 16;
+    }
+    uint32_t ifd_offset = (uint32_t)first_ifd_offset;
     fwrite(&ifd_offset, sizeof(ifd_offset), 1, file);
+    return 8;
+}
 
-    uint16_t num_entries = 11;
-    fwrite(&num_entries, sizeof(num_entries), 1, file);
-
-    struct TiffTag {
-        uint16_t tag_id;
-        uint16_t data_type;
-        uint32_t count;
-        uint32_t value_offset;
-    } tag;
-
-    // ImageWidth
-    tag.tag_id = 256;
-    tag.data_type = 4;
-    tag.count = 1;
-    tag.value_offset = ncols;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // ImageLength
-    tag.tag_id = 257;
-    tag.data_type = 4;
-    tag.count = 1;
-    tag.value_offset = nrows;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // BitsPerSample
-    tag.tag_id = 258;
-    tag.data_type = 3;
-    tag.count = 1;
-    tag.value_offset = 32;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // SampleFormat (Floating Point)
-    tag.tag_id = 339;
-    tag.data_type = 3;
-    tag.count = 1;
-    tag.value_offset = 3;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // Compression
-    tag.tag_id = 259;
-    tag.data_type = 3;
-    tag.count = 1;
-    tag.value_offset = 1;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // PhotometricInterpretation
-    tag.tag_id = 262;
-    tag.data_type = 3;
-    tag.count = 1;
-    tag.value_offset = 1;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // StripOffsets
-    uint32_t strip_offset = ftell(file) + 2 + num_entries * sizeof(tag) + 4;
-    tag.tag_id = 273;
-    tag.data_type = 4;
-    tag.count = 1;
-    tag.value_offset = strip_offset;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // RowsPerStrip
-    tag.tag_id = 278;
-    tag.data_type = 4;
-    tag.count = 1;
-    tag.value_offset = nrows;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // StripByteCounts
-    uint32_t strip_byte_count = ncols * nrows * sizeof(float);
-    tag.tag_id = 279;
-    tag.data_type = 4;
-    tag.count = 1;
-    tag.value_offset = strip_byte_count;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // ModelPixelScaleTag
-    uint32_t model_pixel_scale_offset = strip_offset + strip_byte_count;
-    tag.tag_id = 33550;
-    tag.data_type = 12;
-    tag.count = 3;
-    tag.value_offset = model_pixel_scale_offset;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // ModelTiepointTag
-    uint32_t model_tiepoint_offset = model_pixel_scale_offset + 3 * sizeof(double);
-    tag.tag_id = 33922;
-    tag.data_type = 12;
-    tag.count = 6;
-    tag.value_offset = model_tiepoint_offset;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // GeoKeyDirectoryTag
-    uint32_t geo_key_dir_offset = model_tiepoint_offset + 6 * sizeof(double);
-    tag.tag_id = 34735;
-    tag.data_type = 3;
-    tag.count = 4;
-    tag.value_offset = geo_key_dir_offset;
-    fwrite(&tag, sizeof(tag), 1, file);
-
-    // Step 3: Write raster data
-    fseek(file, strip_offset, SEEK_SET);
-    for (int i = 0; i < ncols * nrows; i++) {
-        float value = data[i];
-        fwrite(&value, sizeof(float), 1, file);
-    }
-
-    // Step 4: Write geospatial metadata
-    double pixel_scale[3] = {cellsize, cellsize, 0.0};
-    fwrite(pixel_scale, sizeof(double), 3, file);
-
-    double tiepoint[6] = {0.0, 0.0, 0.0, xllcorner, yllcorner + (nrows * cellsize), 0.0};
-    fwrite(tiepoint, sizeof(double), 6, file);
-
-    uint16_t geo_key_dir[4] = {1, 1, 0, (uint16_t)epsg_code};
-    fwrite(geo_key_dir, sizeof(uint16_t), 4, file);
-
-    fclose(file);
-    printf("GeoTIFF file created: %s\n", filename);
+static size_t block_encoded_bound(const GeoTiffWriter *tif, size_t raw_bytes) {
+    if (tif->compression == COMPRESSION_DEFLATE) return deflate_bound(raw_bytes);
+    if (tif->compression == COMPRESSION_LZW) return lzw_bound(raw_bytes);
+    return raw_bytes;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input.asc> <epsg_code>\n", argv[0]);
+// Works out the block layout for an ncols x nrows image and allocates the
+// offset tables. No file is opened here.
+static int geotiff_layout(GeoTiffWriter *tif, int ncols, int nrows, const GeoTiffOptions *options, float fill_value) {
+    memset(tif, 0, sizeof(*tif));
+    tif->ncols = ncols;
+    tif->nrows = nrows;
+    tif->tiled = options->tiled;
+    tif->compression = options->compression;
+    tif->predictor = (options->compression == COMPRESSION_NONE) ? PREDICTOR_NONE : PREDICTOR_FLOATING_POINT;
+    tif->fill_value = fill_value;
+
+    if (tif->tiled) {
+        tif->block_width = options->tile_size;
+        tif->block_height = options->tile_size;
+    } else {
+        size_t row_bytes = (size_t)ncols * sizeof(float);
+        size_t rows_per_strip = STRIP_TARGET_BYTES / row_bytes;
+        if (rows_per_strip < 1) rows_per_strip = 1;
+        if (rows_per_strip > (size_t)nrows) rows_per_strip = nrows;
+        tif->block_width = ncols;
+        tif->block_height = (int)rows_per_strip;
+    }
+    tif->blocks_across = (ncols + tif->block_width - 1) / tif->block_width;
+    tif->blocks_down = (nrows + tif->block_height - 1) / tif->block_height;
+    tif->block_count = tif->blocks_across * tif->blocks_down;
+
+    tif->block_offsets = malloc(tif->block_count * sizeof(uint64_t));
+    tif->block_byte_counts = malloc(tif->block_count * sizeof(uint64_t));
+    if (!tif->block_offsets || !tif->block_byte_counts) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(tif->block_offsets);
+        free(tif->block_byte_counts);
         return 1;
     }
+    return 0;
+}
 
-    char *input_file = argv[1];
-    int epsg_code = atoi(argv[2]);
+static int geotiff_begin(GeoTiffWriter *tif, const char *filename, int ncols, int nrows,
+                         const GeoTiffOptions *options, float fill_value) {
+    if (geotiff_layout(tif, ncols, nrows, options, fill_value) != 0) return 1;
 
-    char output_file[256];
-    strncpy(output_file, input_file, sizeof(output_file) - 5);
-    output_file[sizeof(output_file) - 5] = '\0';
-    char *dot = strrchr(output_file, '.');
-    if (dot) *dot = '\0';
-    strcat(output_file, ".tif");
+    // Everything after the pixel data is the IFD, the two offset arrays and a
+    // few hundred bytes of tag values. With compression the block sizes are
+    // not known yet, so the worst-case encoded size decides instead.
+    size_t block_bytes = (size_t)tif->block_width * tif->block_height * sizeof(float);
+    uint64_t expected_size = 16 + (uint64_t)block_encoded_bound(tif, block_bytes) * tif->block_count
+                           + (uint64_t)tif->block_count * 16 + 4096;
+    tif->bigtiff = options->force_bigtiff || expected_size > CLASSIC_TIFF_LIMIT;
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
+    tif->file = fopen(filename, "wb");
+    if (!tif->file) {
+        perror("Cannot open GeoTIFF file");
+        free(tif->block_offsets);
+        free(tif->block_byte_counts);
         return 1;
     }
 
-    char line[255];
-    int nrows_value = 0, ncols_value = 0, nodata_value = 0;
-    float xllcorner_value = 0.0, yllcorner_value = 0.0, cellsize_value = 0.0;
+    // Step 1: Write TIFF header, the IFD offset is patched in once the
+    // blocks are written and the IFD can follow them
+    tif->file_offset = tiff_write_header(tif->file, tif->bigtiff, 0);
+    return 0;
+}
 
-    for (int i = 0; i < 6; i++) {
-        fgets(line, sizeof(line), fp);
-        if (strstr(line, "nrows")) sscanf(line, "%*s %d", &nrows_value);
-        else if (strstr(line, "ncols")) sscanf(line, "%*s %d", &ncols_value);
-        else if (strstr(line, "xllcorner")) sscanf(line, "%*s %f", &xllcorner_value);
-        else if (strstr(line, "yllcorner")) sscanf(line, "%*s %f", &yllcorner_value);
-        else if (strstr(line, "cellsize")) sscanf(line, "%*s %f", &cellsize_value);
-        else if (strstr(line, "nodata_value")) sscanf(line, "%*s %d", &nodata_value);
+// Floating point predictor (Predictor = 3): each row's floats are split into
+// byte planes, most significant first, and then differenced byte by byte.
+// Neighbouring elevations share their high bytes, so the planes turn into
+// long runs of small values that DEFLATE and LZW handle well.
+static void apply_float_predictor(uint8_t *row, uint8_t *scratch, int width) {
+    for (int i = 0; i < width; i++) {
+        uint32_t bits;
+        memcpy(&bits, row + (size_t)i * 4, 4);
+        scratch[i] = (uint8_t)(bits >> 24);
+        scratch[width + i] = (uint8_t)(bits >> 16);
+        scratch[2 * width + i] = (uint8_t)(bits >> 8);
+        scratch[3 * width + i] = (uint8_t)bits;
     }
+    for (int i = 4 * width - 1; i > 0; i--) {
+        scratch[i] = (uint8_t)(scratch[i] - scratch[i - 1]);
+    }
+    memcpy(row, scratch, (size_t)width * 4);
+}
 
-    float *data = malloc(nrows_value * ncols_value * sizeof(float));
-    if (!data) {
-        fprintf(stderr, "Memory allocation failed\n");
-        fclose(fp);
+// Copies one block out of the current band (padding edge tiles with the fill
+// value), applies the predictor and compresses it into the slot.
+static void encode_block_task(void *ctx, int index) {
+    BlockJob *job = (BlockJob *)ctx;
+    GeoTiffWriter *tif = job->tif;
+    BlockSlot *slot = &job->slots[index];
+
+    int block = job->first_block + index;
+    int block_row = block / tif->blocks_across;
+    int block_col = block % tif->blocks_across;
+    int first_row = block_row * tif->block_height;
+    int first_col = block_col * tif->block_width;
+
+    int valid_rows = tif->nrows - first_row;
+    if (valid_rows > tif->block_height) valid_rows = tif->block_height;
+    int valid_cols = tif->ncols - first_col;
+    if (valid_cols > tif->block_width) valid_cols = tif->block_width;
+
+    // Tiles are always full size, the last strip is just shorter
+    int rows = tif->tiled ? tif->block_height : valid_rows;
+    int width = tif->block_width;
+    float *pixels = (float *)slot->pixels;
+
+    for (int r = 0; r < rows; r++) {
+        float *dest = pixels + (size_t)r * width;
+        if (r < valid_rows) {
+            const float *src = job->band + (size_t)(first_row - job->band_first_row + r) * tif->ncols + first_col;
+            memcpy(dest, src, (size_t)valid_cols * sizeof(float));
+            for (int c = valid_cols; c < width; c++) dest[c] = tif->fill_value;
+        } else {
+            for (int c = 0; c < width; c++) dest[c] = tif->fill_value;
+        }
+    }
+
+    size_t raw_bytes = (size_t)rows * width * sizeof(float);
+    if (tif->predictor == PREDICTOR_FLOATING_POINT) {
+        for (int r = 0; r < rows; r++) {
+            apply_float_predictor(slot->pixels + (size_t)r * width * 4, slot->row_scratch, width);
+        }
+    }
+
+    if (tif->compression == COMPRESSION_DEFLATE) {
+        slot->output_size = deflate_compress(slot->pixels, raw_bytes, slot->encoded, slot->encoded_capacity, DEFLATE_LEVEL);
+        slot->output = slot->encoded;
+    } else if (tif->compression == COMPRESSION_LZW) {
+        slot->output_size = lzw_compress(slot->pixels, raw_bytes, slot->encoded, slot->encoded_capacity);
+        slot->output = slot->encoded;
+    } else {
+        slot->output_size = raw_bytes;
+        slot->output = slot->pixels;
+    }
+}
+
+static int geotiff_write_block(GeoTiffWriter *tif, const uint8_t *data, size_t byte_count) {
+    if (fwrite(data, 1, byte_count, tif->file) != byte_count) {
+        perror("Error writing GeoTIFF block");
         return 1;
     }
 
-    for (int row = 0; row < nrows_value; row++) {
-        for (int col = 0; col < ncols_value; col++) {
-            float z_value;
-            if (fscanf(fp, "%f", &z_value) == 1) {
-                data[row * ncols_value + col] = z_value;
-            } else {
-                fprintf(stderr, "Error reading data at row %d, col %d\n", row, col);
-                free(data);
-                fclose(fp);
+    tif->block_offsets[tif->blocks_written] = tif->file_offset;
+    tif->block_byte_counts[tif->blocks_written] = byte_count;
+    tif->blocks_written++;
+    tif->file_offset += byte_count;
+    return 0;
+}
+
+// Classic TIFF offset arrays are LONG, narrow the 64-bit offsets in place
+static void geotiff_narrow_offsets(GeoTiffWriter *tif) {
+    if (tif->bigtiff) return;
+    uint32_t *offsets = (uint32_t *)tif->block_offsets;
+    uint32_t *byte_counts = (uint32_t *)tif->block_byte_counts;
+    for (int i = 0; i < tif->block_count; i++) {
+        offsets[i] = (uint32_t)tif->block_offsets[i];
+        byte_counts[i] = (uint32_t)tif->block_byte_counts[i];
+    }
+}
+
+// Fills in the IFD for one image. Overviews are flagged as reduced resolution
+// and carry no georeferencing of their own, readers take it from the full
+// resolution image. The IFD points into values, which must outlive it.
+static void geotiff_build_ifd(const GeoTiffWriter *tif, const AscGrid *grid, int epsg_code, int overview,
+                              TiffTagValues *values, TiffIfd *ifd) {
+    memset(ifd, 0, sizeof(*ifd));
+    values->subfile_type = 1;
+    values->image_width = tif->ncols;
+    values->image_length = tif->nrows;
+    values->bits_per_sample = 32;
+    values->compression = (uint16_t)tif->compression;
+    values->photometric = 1;
+    values->block_width = tif->block_width;
+    values->block_height = tif->block_height;
+    values->predictor = (uint16_t)tif->predictor;
+    values->sample_format = 3;
+
+    // Step 2: Geospatial metadata
+    values->pixel_scale[0] = grid->cellsize;
+    values->pixel_scale[1] = grid->cellsize;
+    values->pixel_scale[2] = 0.0;
+    double tiepoint[6] = {0.0, 0.0, 0.0, grid->xllcorner, grid->yllcorner + (grid->nrows * grid->cellsize), 0.0};
+    memcpy(values->tiepoint, tiepoint, sizeof(tiepoint));
+
+    // EPSG codes in the 4000s are geographic, everything else is treated as projected
+    int geographic = (epsg_code >= 4000 && epsg_code < 5000);
+    uint16_t geo_key_dir[16] = {
+        1, 1, 0, 3,
+        1024, 0, 1, (uint16_t)(geographic ? 2 : 1),
+        1025, 0, 1, 1,
+        (uint16_t)(geographic ? 2048 : 3072), 0, 1, (uint16_t)epsg_code
+    };
+    memcpy(values->geo_key_dir, geo_key_dir, sizeof(geo_key_dir));
+
+    snprintf(values->nodata_text, sizeof(values->nodata_text), "%.10g", grid->nodata_value);
+
+    uint16_t offset_type = tif->bigtiff ? TIFF_LONG8 : TIFF_LONG;
+
+    if (overview) {
+        tiff_add_entry(ifd, 254, TIFF_LONG, 1, &values->subfile_type);             // NewSubfileType (reduced resolution)
+    }
+    tiff_add_entry(ifd, 256, TIFF_LONG, 1, &values->image_width);                   // ImageWidth
+    tiff_add_entry(ifd, 257, TIFF_LONG, 1, &values->image_length);                  // ImageLength
+    tiff_add_entry(ifd, 258, TIFF_SHORT, 1, &values->bits_per_sample);              // BitsPerSample
+    tiff_add_entry(ifd, 259, TIFF_SHORT, 1, &values->compression);                  // Compression
+    tiff_add_entry(ifd, 262, TIFF_SHORT, 1, &values->photometric);                  // PhotometricInterpretation
+    if (tif->tiled) {
+        tiff_add_entry(ifd, 322, TIFF_LONG, 1, &values->block_width);               // TileWidth
+        tiff_add_entry(ifd, 323, TIFF_LONG, 1, &values->block_height);              // TileLength
+        tiff_add_entry(ifd, 324, offset_type, tif->block_count, tif->block_offsets);     // TileOffsets
+        tiff_add_entry(ifd, 325, offset_type, tif->block_count, tif->block_byte_counts); // TileByteCounts
+    } else {
+        tiff_add_entry(ifd, 273, offset_type, tif->block_count, tif->block_offsets);     // StripOffsets
+        tiff_add_entry(ifd, 278, TIFF_LONG, 1, &values->block_height);              // RowsPerStrip
+        tiff_add_entry(ifd, 279, offset_type, tif->block_count, tif->block_byte_counts); // StripByteCounts
+    }
+    if (tif->predictor != PREDICTOR_NONE) {
+        tiff_add_entry(ifd, 317, TIFF_SHORT, 1, &values->predictor);                // Predictor
+    }
+    tiff_add_entry(ifd, 339, TIFF_SHORT, 1, &values->sample_format);                // SampleFormat (Floating Point)
+    if (!overview) {
+        tiff_add_entry(ifd, 33550, TIFF_DOUBLE, 3, values->pixel_scale);            // ModelPixelScaleTag
+        tiff_add_entry(ifd, 33922, TIFF_DOUBLE, 6, values->tiepoint);               // ModelTiepointTag
+        tiff_add_entry(ifd, 34735, TIFF_SHORT, 16, values->geo_key_dir);            // GeoKeyDirectoryTag
+    }
+    if (grid->has_nodata) {
+        tiff_add_entry(ifd, 42113, TIFF_ASCII, strlen(values->nodata_text) + 1, values->nodata_text); // GDAL_NODATA
+    }
+}
+
+static int geotiff_finish(GeoTiffWriter *tif, const AscGrid *grid, int epsg_code) {
+    TiffTagValues values;
+    TiffIfd ifd;
+    geotiff_narrow_offsets(tif);
+    geotiff_build_ifd(tif, grid, epsg_code, 0, &values, &ifd);
+
+    uint64_t ifd_offset = tiff_write_ifd(tif->file, tif->bigtiff, &tif->file_offset, &ifd, 0);
+
+    fseek(tif->file, tif->bigtiff ? 8 : 4, SEEK_SET);
+    fwrite(&ifd_offset, tif->bigtiff ? 8 : 4, 1, tif->file);
+
+    int failed = ferror(tif->file);
+    if (fclose(tif->file) != 0) failed = 1;
+    free(tif->block_offsets);
+    free(tif->block_byte_counts);
+
+    if (failed) {
+        perror("Error writing GeoTIFF file");
+        return 1;
+    }
+    return 0;
+}
+
+static void geotiff_abort(GeoTiffWriter *tif) {
+    fclose(tif->file);
+    free(tif->block_offsets);
+    free(tif->block_byte_counts);
+}
+
+static void free_slots(BlockSlot *slots, int slot_count) {
+    if (!slots) return;
+    for (int i = 0; i < slot_count; i++) {
+        free(slots[i].pixels);
+        free(slots[i].row_scratch);
+        free(slots[i].encoded);
+    }
+    free(slots);
+}
+
+static BlockSlot *alloc_slots(const GeoTiffWriter *tif, int slot_count) {
+    BlockSlot *slots = calloc((size_t)slot_count, sizeof(BlockSlot));
+    if (!slots) return NULL;
+
+    size_t raw_bytes = (size_t)tif->block_width * tif->block_height * sizeof(float);
+    for (int i = 0; i < slot_count; i++) {
+        slots[i].pixels = malloc(raw_bytes);
+        slots[i].row_scratch = malloc((size_t)tif->block_width * sizeof(float));
+        if (tif->compression != COMPRESSION_NONE) {
+            slots[i].encoded_capacity = block_encoded_bound(tif, raw_bytes);
+            slots[i].encoded = malloc(slots[i].encoded_capacity);
+        }
+        if (!slots[i].pixels || !slots[i].row_scratch || (tif->compression != COMPRESSION_NONE && !slots[i].encoded)) {
+            free_slots(slots, slot_count);
+            return NULL;
+        }
+    }
+    return slots;
+}
+
+// Encodes the blocks covering rows [band_first_row, band_first_row + rows) on
+// the worker pool, slot_count at a time, and writes them out in order.
+static int geotiff_write_band(GeoTiffWriter *tif, const float *band, int band_first_row, int rows,
+                              BlockSlot *slots, int slot_count, ThreadPool *pool) {
+    int first_block = (band_first_row / tif->block_height) * tif->blocks_across;
+    int band_blocks = ((rows + tif->block_height - 1) / tif->block_height) * tif->blocks_across;
+
+    for (int done = 0; done < band_blocks; done += slot_count) {
+        int group = band_blocks - done;
+        if (group > slot_count) group = slot_count;
+
+        BlockJob job = { tif, band, band_first_row, first_block + done, slots };
+        pool_run(pool, group, encode_block_task, &job);
+
+        for (int i = 0; i < group; i++) {
+            if (slots[i].output_size == 0) {
+                fprintf(stderr, "Error compressing GeoTIFF block\n");
                 return 1;
             }
+            if (geotiff_write_block(tif, slots[i].output, slots[i].output_size) != 0) return 1;
+        }
+    }
+    return 0;
+}
+
+// Streams the grid into the GeoTIFF a band at a time: rows are parsed into a
+// fixed-size band buffer, cut into strips or tiles, encoded on the worker
+// pool and written out in order before the next band is read, so memory use
+// does not depend on the number of rows.
+int write_geotiff(const char *filename, AscGrid *grid, int epsg_code, ThreadPool *pool, const GeoTiffOptions *options) {
+    float fill_value = grid->has_nodata ? (float)grid->nodata_value : 0.0f;
+    GeoTiffWriter tif;
+    if (geotiff_begin(&tif, filename, grid->ncols, grid->nrows, options, fill_value) != 0) return 1;
+
+    // Tiled output works one row of tiles at a time, strips are batched so
+    // each band still gives the workers plenty of blocks
+    int band_block_rows = 1;
+    if (!tif.tiled) {
+        size_t strip_bytes = (size_t)tif.block_height * tif.ncols * sizeof(float);
+        band_block_rows = (int)(BATCH_TARGET_BYTES / strip_bytes);
+        if (band_block_rows < 1) band_block_rows = 1;
+    }
+    int band_height = band_block_rows * tif.block_height;
+    if (band_height > grid->nrows) band_height = grid->nrows;
+
+    int slot_count = pool_size(pool) * 2;
+    float *band = malloc((size_t)band_height * grid->ncols * sizeof(float));
+    BlockSlot *slots = alloc_slots(&tif, slot_count);
+    if (!band || !slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(band);
+        free_slots(slots, slot_count);
+        geotiff_abort(&tif);
+        return 1;
+    }
+
+    int row = 0;
+    int result = 0;
+    while (row < grid->nrows && result == 0) {
+        int rows = band_height;
+        if (rows > grid->nrows - row) rows = grid->nrows - row;
+
+        size_t wanted = (size_t)rows * grid->ncols;
+        size_t read = asc_read_cells(grid, band, wanted, pool);
+        if (read != wanted) {
+            fprintf(stderr, "Error reading data at row %zu, col %zu\n",
+                    row + read / grid->ncols, read % grid->ncols);
+            result = 1;
+            break;
+        }
+
+        result = geotiff_write_band(&tif, band, row, rows, slots, slot_count, pool);
+        row += rows;
+    }
+
+    free(band);
+    free_slots(slots, slot_count);
+    if (result != 0) {
+        geotiff_abort(&tif);
+        return 1;
+    }
+    if (geotiff_finish(&tif, grid, epsg_code) != 0) return 1;
+
+    printf("%s file created: %s\n", tif.bigtiff ? "BigTIFF" : "GeoTIFF", filename);
+    return 0;
+}
+
+// Cloud optimized GeoTIFF output. The full resolution image and every
+// overview level are written tile by tile into their own spill file while
+// the grid is read once: each pair of rows completed at one level is
+// decimated into a row of the next level, and a level's band is encoded as
+// soon as it holds a full row of tiles. Once the input is exhausted the
+// final file is assembled with all IFDs up front, followed by the tile data
+// from the smallest overview to full resolution, so a reader can fetch the
+// IFDs with one range request and any zoom level with a few more.
+typedef struct {
+    GeoTiffWriter tif;
+    char spill_path[300];
+    float *band;
+    int band_first_row;
+    int band_rows;
+} CogLevel;
+
+typedef struct {
+    CogLevel levels[MAX_COG_LEVELS];
+    int level_count;
+    int resampling;
+    int has_nodata;
+    float nodata;
+    BlockSlot *slots;
+    int slot_count;
+    ThreadPool *pool;
+} CogWriter;
+
+static void cog_free(CogWriter *cog) {
+    for (int i = 0; i < cog->level_count; i++) {
+        CogLevel *level = &cog->levels[i];
+        if (level->tif.file) {
+            fclose(level->tif.file);
+            remove(level->spill_path);
+        }
+        free(level->tif.block_offsets);
+        free(level->tif.block_byte_counts);
+        free(level->band);
+    }
+    free_slots(cog->slots, cog->slot_count);
+}
+
+static int cog_begin(CogWriter *cog, const char *filename, const AscGrid *grid,
+                     const GeoTiffOptions *options, ThreadPool *pool) {
+    memset(cog, 0, sizeof(*cog));
+    cog->resampling = options->resampling;
+    cog->has_nodata = grid->has_nodata;
+    cog->nodata = (float)grid->nodata_value;
+    cog->pool = pool;
+
+    // Halve until the whole level fits in a single tile
+    int width = grid->ncols;
+    int height = grid->nrows;
+    for (;;) {
+        CogLevel *level = &cog->levels[cog->level_count];
+        if (geotiff_layout(&level->tif, width, height, options, cog->has_nodata ? cog->nodata : 0.0f) != 0) {
+            cog_free(cog);
+            return 1;
+        }
+        cog->level_count++;
+
+        snprintf(level->spill_path, sizeof(level->spill_path), "%s.%d.tmp", filename, cog->level_count - 1);
+        level->tif.file = fopen(level->spill_path, "w+b");
+        level->band = malloc((size_t)options->tile_size * width * sizeof(float));
+        if (!level->tif.file || !level->band) {
+            if (!level->tif.file) perror("Cannot open temporary tile file");
+            else fprintf(stderr, "Memory allocation failed\n");
+            cog_free(cog);
+            return 1;
+        }
+
+        if ((width <= options->tile_size && height <= options->tile_size) || cog->level_count == MAX_COG_LEVELS) break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    cog->slot_count = pool_size(pool) * 2;
+    cog->slots = alloc_slots(&cog->levels[0].tif, cog->slot_count);
+    if (!cog->slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        cog_free(cog);
+        return 1;
+    }
+    return 0;
+}
+
+// Reduces two rows (or one, repeated, at an odd edge) of width cells to
+// (width + 1) / 2 cells. Mean skips nodata cells and only gives nodata when
+// all of the 2x2 block is nodata; nearest keeps the top-left cell.
+static void cog_downsample_row(const CogWriter *cog, const float *row_a, const float *row_b, int width, float *dest) {
+    int out_width = (width + 1) / 2;
+    for (int c = 0; c < out_width; c++) {
+        int c0 = 2 * c;
+        if (cog->resampling == RESAMPLING_NEAREST) {
+            dest[c] = row_a[c0];
+            continue;
         }
+
+        int c1 = (c0 + 1 < width) ? c0 + 1 : c0;
+        float cells[4] = { row_a[c0], row_a[c1], row_b[c0], row_b[c1] };
+        double sum = 0.0;
+        int valid = 0;
+        for (int k = 0; k < 4; k++) {
+            if (cog->has_nodata && cells[k] == cog->nodata) continue;
+            sum += cells[k];
+            valid++;
+        }
+        dest[c] = valid ? (float)(sum / valid) : cog->nodata;
     }
+}
 
-    fclose(fp);
+static int cog_flush_level(CogWriter *cog, int index) {
+    CogLevel *level = &cog->levels[index];
+    if (level->band_rows == 0) return 0;
+    int result = geotiff_write_band(&level->tif, level->band, level->band_first_row, level->band_rows,
+                                    cog->slots, cog->slot_count, cog->pool);
+    level->band_first_row += level->band_rows;
+    level->band_rows = 0;
+    return result;
+}
+
+static int cog_rows_added(CogWriter *cog, int index, int count);
+
+static int cog_push_overview_row(CogWriter *cog, int index, int row_a, int row_b) {
+    CogLevel *level = &cog->levels[index];
+    CogLevel *next = &cog->levels[index + 1];
+    const float *a = level->band + (size_t)row_a * level->tif.ncols;
+    const float *b = level->band + (size_t)row_b * level->tif.ncols;
+    float *dest = next->band + (size_t)next->band_rows * next->tif.ncols;
+    cog_downsample_row(cog, a, b, level->tif.ncols, dest);
+    return cog_rows_added(cog, index + 1, 1);
+}
+
+// Called once count new rows have been placed at the end of a level's band.
+// Tile sizes are even, so row pairs never straddle two bands.
+static int cog_rows_added(CogWriter *cog, int index, int count) {
+    CogLevel *level = &cog->levels[index];
+    int start = level->band_rows;
+    level->band_rows += count;
+
+    if (index + 1 < cog->level_count) {
+        for (int r = start & ~1; r + 1 < level->band_rows; r += 2) {
+            if (cog_push_overview_row(cog, index, r, r + 1) != 0) return 1;
+        }
+    }
+    if (level->band_rows == level->tif.block_height) return cog_flush_level(cog, index);
+    return 0;
+}
 
-    write_geotiff(output_file, ncols_value, nrows_value, xllcorner_value, yllcorner_value, cellsize_value, data, epsg_code);
+// Flushes the partial bands left at the bottom of each level, top level first
+// so its last odd row still reaches the level below
+static int cog_flush_all(CogWriter *cog) {
+    for (int i = 0; i < cog->level_count; i++) {
+        CogLevel *level = &cog->levels[i];
+        if ((level->band_rows & 1) && i + 1 < cog->level_count) {
+            if (cog_push_overview_row(cog, i, level->band_rows - 1, level->band_rows - 1) != 0) return 1;
+        }
+        if (cog_flush_level(cog, i) != 0) return 1;
+    }
+    return 0;
+}
 
-    free(data);
+static int cog_copy_spill(CogLevel *level, FILE *out) {
+    static char buffer[1 << 20];
+    fflush(level->tif.file);
+    if (fseek(level->tif.file, 0, SEEK_SET) != 0) return 1;
+
+    uint64_t remaining = level->tif.file_offset;
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+        if (fread(buffer, 1, chunk, level->tif.file) != chunk) return 1;
+        if (fwrite(buffer, 1, chunk, out) != chunk) return 1;
+        remaining -= chunk;
+    }
     return 0;
 }
+
+static int cog_finish(CogWriter *cog, const char *filename, const AscGrid *grid, int epsg_code, int force_bigtiff) {
+    // All block sizes are known now, so BigTIFF is only used when needed
+    uint64_t expected_size = 4096;
+    for (int i = 0; i < cog->level_count; i++) {
+        expected_size += cog->levels[i].tif.file_offset + (uint64_t)cog->levels[i].tif.block_count * 16 + 1024;
+    }
+    int bigtiff = force_bigtiff || expected_size > CLASSIC_TIFF_LIMIT;
+
+    // GDAL's structural metadata ghost area, so GDAL recognises the layout
+    char ghost[128];
+    const char *layout = "LAYOUT=IFDS_BEFORE_DATA\nBLOCK_ORDER=ROW_MAJOR\nKNOWN_INCOMPATIBLE_EDITION=NO\n ";
+    int ghost_size = snprintf(ghost, sizeof(ghost), "GDAL_STRUCTURAL_METADATA_SIZE=%06d bytes\n%s",
+                              (int)strlen(layout), layout);
+
+    TiffTagValues values[MAX_COG_LEVELS];
+    TiffIfd ifds[MAX_COG_LEVELS];
+    uint64_t ifd_offsets[MAX_COG_LEVELS];
+    uint64_t offset = (bigtiff ? 16 : 8) + ghost_size;
+    for (int i = 0; i < cog->level_count; i++) {
+        cog->levels[i].tif.bigtiff = bigtiff;
+        geotiff_build_ifd(&cog->levels[i].tif, grid, epsg_code, i > 0, &values[i], &ifds[i]);
+        ifd_offsets[i] = offset;
+        offset += tiff_ifd_size(bigtiff, &ifds[i]);
+    }
+
+    // Tile data goes smallest overview first, full resolution last
+    for (int i = cog->level_count - 1; i >= 0; i--) {
+        GeoTiffWriter *tif = &cog->levels[i].tif;
+        for (int b = 0; b < tif->block_count; b++) tif->block_offsets[b] += offset;
+        offset += tif->file_offset;
+        geotiff_narrow_offsets(tif);
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        perror("Cannot open GeoTIFF file");
+        return 1;
+    }
+
+    uint64_t file_offset = tiff_write_header(file, bigtiff, ifd_offsets[0]);
+    fwrite(ghost, 1, ghost_size, file);
+    file_offset += ghost_size;
+    for (int i = 0; i < cog->level_count; i++) {
+        uint64_t next = (i + 1 < cog->level_count) ? ifd_offsets[i + 1] : 0;
+        tiff_write_ifd(file, bigtiff, &file_offset, &ifds[i], next);
+    }
+
+    int failed = 0;
+    for (int i = cog->level_count - 1; i >= 0 && !failed; i--) {
+        failed = cog_copy_spill(&cog->levels[i], file);
+    }
+    if (ferror(file)) failed = 1;
+    if (fclose(file) != 0) failed = 1;
+
+    if (failed) {
+        perror("Error writing GeoTIFF file");
+        return 1;
+    }
+    return 0;
+}
+
+int write_cog(const char *filename, AscGrid *grid, int epsg_code, ThreadPool *pool, const GeoTiffOptions *options) {
+    CogWriter cog;
+    if (cog_begin(&cog, filename, grid, options, pool) != 0) return 1;
+
+    CogLevel *full = &cog.levels[0];
+    int row = 0;
+    int result = 0;
+    while (row < grid->nrows && result == 0) {
+        int rows = full->tif.block_height;
+        if (rows > grid->nrows - row) rows = grid->nrows - row;
+
+        size_t wanted = (size_t)rows * grid->ncols;
+        size_t read = asc_read_cells(grid, full->band, wanted, pool);
+        if (read != wanted) {
+            fprintf(stderr, "Error reading data at row %zu, col %zu\n",
+                    row + read / grid->ncols, read % grid->ncols);
+            result = 1;
+            break;
+        }
+
+        result = cog_rows_added(&cog, 0, rows);
+        row += rows;
+    }
+
+    if (result == 0) result = cog_flush_all(&cog);
+    if (result == 0) result = cog_finish(&cog, filename, grid, epsg_code, options->force_bigtiff);
+    int overviews = cog.level_count - 1;
+    cog_free(&cog);
+    if (result != 0) return 1;
+
+    printf("Cloud optimized GeoTIFF file created: %s (%d overview%s)\n", filename, overviews, overviews == 1 ? "" : "s");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *usage = "Usage: %s <input.asc> <epsg_code> [-threads N] [-bigtiff] [-tiled] [-tilesize N] "
+                        "[-compress deflate|lzw] [-cog] [-resampling mean|nearest]\n";
+    if (argc < 3) {
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+
+    char *input_file = argv[1];
+    int epsg_code = atoi(argv[2]);
+    int thread_count = 1;
+    GeoTiffOptions options = { 0, DEFAULT_TILE_SIZE, COMPRESSION_NONE, 0, 0, RESAMPLING_MEAN };
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-bigtiff") == 0) {
+            options.force_bigtiff = 1;
+        } else if (strcmp(argv[i], "-tiled") == 0) {
+            options.tiled = 1;
+        } else if (strcmp(argv[i], "-tilesize") == 0 && i + 1 < argc) {
+            options.tiled = 1;
+            options.tile_size = atoi(argv[++i]);
+            if (options.tile_size < 16 || options.tile_size % 16 != 0) {
+                fprintf(stderr, "Invalid tile size. It must be a positive multiple of 16.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-compress") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "deflate") == 0) options.compression = COMPRESSION_DEFLATE;
+            else if (strcmp(argv[i], "lzw") == 0) options.compression = COMPRESSION_LZW;
+            else if (strcmp(argv[i], "none") == 0) options.compression = COMPRESSION_NONE;
+            else {
+                fprintf(stderr, "Unknown compression '%s'. Use deflate, lzw or none.\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-cog") == 0) {
+            options.cog = 1;
+            options.tiled = 1;
+        } else if (strcmp(argv[i], "-resampling") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "mean") == 0) options.resampling = RESAMPLING_MEAN;
+            else if (strcmp(argv[i], "nearest") == 0) options.resampling = RESAMPLING_NEAREST;
+            else {
+                fprintf(stderr, "Unknown resampling '%s'. Use mean or nearest.\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+
+    char output_file[256];
+    strncpy(output_file, input_file, sizeof(output_file) - 5);
+    output_file[sizeof(output_file) - 5] = '\0';
+    char *dot = strrchr(output_file, '.');
+    if (dot) *dot = '\0';
+    strcat(output_file, ".tif");
+
+    AscGrid grid;
+    int status = asc_open(input_file, &grid);
+    if (status != ASC_OK) {
+        fprintf(stderr, "Error opening input file '%s': %s\n", input_file, asc_error_message(status));
+        return 1;
+    }
+
+    ThreadPool *pool = (thread_count > 1) ? pool_create(thread_count) : NULL;
+
+    int result;
+    if (options.cog) result = write_cog(output_file, &grid, epsg_code, pool, &options);
+    else result = write_geotiff(output_file, &grid, epsg_code, pool, &options);
+
+    pool_destroy(pool);
+    asc_close(&grid);
+    return result;
+}
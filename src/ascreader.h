@@ -0,0 +1,356 @@
+#ifndef ASCREADER_H
+#define ASCREADER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+#include "mapfile.h"
+#include "numscan.h"
+#include "parallel.h"
+
+// Shared ESRI ASCII grid reader for the asc* tools. The file is mapped once,
+// the header is parsed from the mapped bytes and the cell values are scanned
+// straight out of the mapping with scan_double, replacing the per-tool
+// fgets/sscanf header loops and per-cell fscanf calls.
+
+#define ASC_OK 0
+#define ASC_ERR_OPEN -1
+#define ASC_ERR_HEADER -2
+
+typedef struct {
+    MappedFile file;
+    int ncols;
+    int nrows;
+    double xllcorner;
+    double yllcorner;
+    double cellsize;
+    double nodata_value;
+    int has_nodata;
+    const char *body;
+    const char *cursor;
+    const char *end;
+    int row_lines;
+} AscGrid;
+
+static inline const char *asc_skip_space(const char *p, const char *end) {
+    while (p < end && numscan_is_space(*p)) p++;
+    return p;
+}
+
+// Scans the next whitespace separated cell value. Returns the position after
+// it, or NULL at the end of the data or on a token that is not a number.
+static inline const char *asc_next_value(const char *p, const char *end, float *out) {
+    p = asc_skip_space(p, end);
+    if (p >= end) return NULL;
+
+    double value;
+    const char *next = scan_double(p, end, &value);
+    if (next == NULL || (next < end && !numscan_is_space(*next))) return NULL;
+    *out = (float)value;
+    return next;
+}
+
+static inline int asc_open(const char *path, AscGrid *grid) {
+    memset(grid, 0, sizeof(*grid));
+    if (map_file(path, &grid->file) != 0) return ASC_ERR_OPEN;
+
+    const char *p = grid->file.data;
+    const char *end = p + grid->file.size;
+    int have_ncols = 0, have_nrows = 0, have_cellsize = 0;
+    int x_is_center = 0, y_is_center = 0;
+
+    // Header lines are "<keyword> <value>"; the first line that starts with a
+    // number is the first row of cells.
+    for (;;) {
+        p = asc_skip_space(p, end);
+        if (p >= end || !((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) break;
+
+        const char *key = p;
+        while (p < end && !numscan_is_space(*p)) p++;
+        size_t key_len = (size_t)(p - key);
+        p = asc_skip_space(p, end);
+
+        double value;
+        const char *next = (p < end) ? scan_double(p, end, &value) : NULL;
+        if (next == NULL) {
+            unmap_file(&grid->file);
+            return ASC_ERR_HEADER;
+        }
+        p = next;
+
+        if (key_len == 5 && strncasecmp(key, "ncols", 5) == 0) {
+            grid->ncols = (int)value;
+            have_ncols = 1;
+        } else if (key_len == 5 && strncasecmp(key, "nrows", 5) == 0) {
+            grid->nrows = (int)value;
+            have_nrows = 1;
+        } else if (key_len == 9 && strncasecmp(key, "xllcorner", 9) == 0) {
+            grid->xllcorner = value;
+        } else if (key_len == 9 && strncasecmp(key, "yllcorner", 9) == 0) {
+            grid->yllcorner = value;
+        } else if (key_len == 9 && strncasecmp(key, "xllcenter", 9) == 0) {
+            grid->xllcorner = value;
+            x_is_center = 1;
+        } else if (key_len == 9 && strncasecmp(key, "yllcenter", 9) == 0) {
+            grid->yllcorner = value;
+            y_is_center = 1;
+        } else if (key_len == 8 && strncasecmp(key, "cellsize", 8) == 0) {
+            grid->cellsize = value;
+            have_cellsize = 1;
+        } else if (key_len == 12 && strncasecmp(key, "nodata_value", 12) == 0) {
+            grid->nodata_value = value;
+            grid->has_nodata = 1;
+        }
+
+        while (p < end && *p != '\n') p++;
+    }
+
+    if (!have_ncols || !have_nrows || !have_cellsize || grid->ncols <= 0 || grid->nrows <= 0) {
+        unmap_file(&grid->file);
+        return ASC_ERR_HEADER;
+    }
+
+    if (x_is_center) grid->xllcorner -= grid->cellsize / 2.0;
+    if (y_is_center) grid->yllcorner -= grid->cellsize / 2.0;
+
+    grid->body = p;
+    grid->cursor = p;
+    grid->end = end;
+    return ASC_OK;
+}
+
+// Parallel ingest works on newline-aligned windows of the body. Each window is
+// cut into chunks that also start after a newline, so no value straddles two
+// chunks. A first pass counts the values in every chunk, a prefix sum over the
+// counts gives each chunk's first cell index, and a second pass converts the
+// chunks straight into their slots in the destination buffer.
+
+#define ASC_CHUNKS_PER_THREAD 4
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    size_t tokens;
+    size_t first;
+    size_t parsed;
+    const char *stop;
+    int failed;
+} AscChunk;
+
+typedef struct {
+    AscChunk *chunks;
+    float *dest;
+    size_t limit;
+} AscParseJob;
+
+static inline const char *asc_next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', (size_t)(end - p));
+    return newline ? newline + 1 : end;
+}
+
+static inline void asc_count_task(void *ctx, int index) {
+    AscChunk *chunk = &((AscParseJob *)ctx)->chunks[index];
+    size_t count = 0;
+    int in_token = 0;
+    for (const char *p = chunk->begin; p < chunk->end; p++) {
+        int space = numscan_is_space(*p);
+        count += (!space && !in_token);
+        in_token = !space;
+    }
+    chunk->tokens = count;
+}
+
+static inline void asc_parse_task(void *ctx, int index) {
+    AscParseJob *job = (AscParseJob *)ctx;
+    AscChunk *chunk = &job->chunks[index];
+    chunk->parsed = 0;
+    chunk->failed = 0;
+    chunk->stop = chunk->begin;
+    if (chunk->first >= job->limit) return;
+
+    size_t wanted = chunk->tokens;
+    if (chunk->first + wanted > job->limit) wanted = job->limit - chunk->first;
+
+    const char *p = chunk->begin;
+    float *out = job->dest + chunk->first;
+    size_t i = 0;
+    for (; i < wanted; i++) {
+        const char *next = asc_next_value(p, chunk->end, &out[i]);
+        if (next == NULL) {
+            chunk->failed = 1;
+            break;
+        }
+        p = next;
+    }
+    chunk->parsed = i;
+    chunk->stop = p;
+}
+
+// Reads the next count cell values into dest, splitting the work across the
+// pool when one is given. Returns how many values were read; a short count is
+// the index of the first missing or malformed cell.
+static inline size_t asc_read_cells(AscGrid *grid, float *dest, size_t count, ThreadPool *pool) {
+    const char *end = grid->end;
+    size_t done = 0;
+
+    if (pool_size(pool) == 1) {
+        const char *p = grid->cursor;
+        for (; done < count; done++) {
+            const char *next = asc_next_value(p, end, &dest[done]);
+            if (next == NULL) break;
+            p = next;
+        }
+        grid->cursor = p;
+        return done;
+    }
+
+    int nchunks = pool_size(pool) * ASC_CHUNKS_PER_THREAD;
+    AscChunk *chunks = malloc((size_t)nchunks * sizeof(AscChunk));
+    if (!chunks) {
+        fprintf(stderr, "Memory allocation failed for parse chunks\n");
+        return 0;
+    }
+
+    size_t total_cells = (size_t)grid->nrows * grid->ncols;
+    double bytes_per_cell = (double)(end - grid->body) / (double)total_cells;
+
+    while (done < count && grid->cursor < end) {
+        size_t wanted = count - done;
+        const char *start = grid->cursor;
+        size_t available = (size_t)(end - start);
+        size_t span = (size_t)(wanted * bytes_per_cell * 1.05) + 4096;
+        const char *window_end = (span >= available) ? end : asc_next_line(start + span, end);
+
+        size_t window_size = (size_t)(window_end - start);
+        const char *chunk_begin = start;
+        for (int i = 0; i < nchunks; i++) {
+            const char *chunk_end = (i == nchunks - 1) ? window_end
+                : asc_next_line(start + window_size * (size_t)(i + 1) / (size_t)nchunks, window_end);
+            if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+            chunks[i].begin = chunk_begin;
+            chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+
+        AscParseJob job = { chunks, dest + done, wanted };
+        pool_run(pool, nchunks, asc_count_task, &job);
+
+        size_t first = 0;
+        for (int i = 0; i < nchunks; i++) {
+            chunks[i].first = first;
+            first += chunks[i].tokens;
+        }
+
+        pool_run(pool, nchunks, asc_parse_task, &job);
+
+        int finished = 0;
+        for (int i = 0; i < nchunks; i++) {
+            AscChunk *chunk = &chunks[i];
+            if (chunk->first >= wanted) break;
+            if (chunk->failed || chunk->first + chunk->tokens >= wanted) {
+                grid->cursor = chunk->stop;
+                done += chunk->first + chunk->parsed;
+                finished = 1;
+                break;
+            }
+        }
+        if (finished) break;
+
+        grid->cursor = window_end;
+        done += first;
+        if (first == 0 && window_end == end) break;
+    }
+
+    free(chunks);
+    return done;
+}
+
+// Reads the next ncols values into row. Returns how many were read, so a
+// short count gives the column of the offending cell.
+static inline int asc_read_row(AscGrid *grid, float *row) {
+    return (int)asc_read_cells(grid, row, (size_t)grid->ncols, NULL);
+}
+
+// Sampling readers. Skipped cells are stepped over as tokens without being
+// converted. While the rows read so far each fill exactly one line
+// (row_lines > 0), whole rows are skipped with memchr; a row that wraps or
+// ends mid-line switches the grid to token counting for good (row_lines < 0).
+
+static inline const char *asc_skip_token(const char *p, const char *end) {
+    p = asc_skip_space(p, end);
+    if (p >= end) return NULL;
+    while (p < end && !numscan_is_space(*p)) p++;
+    return p;
+}
+
+static inline void asc_note_row_end(AscGrid *grid, const char *row_start) {
+    if (grid->row_lines < 0) return;
+    const char *p = grid->cursor;
+    while (p < grid->end && *p != '\n' && numscan_is_space(*p)) p++;
+    int one_line = (p >= grid->end || *p == '\n') &&
+                   memchr(row_start, '\n', (size_t)(grid->cursor - row_start)) == NULL;
+    grid->row_lines = one_line ? 1 : -1;
+}
+
+// Skips count rows. Returns how many were skipped.
+static inline int asc_skip_rows(AscGrid *grid, int count) {
+    const char *end = grid->end;
+    for (int r = 0; r < count; r++) {
+        const char *p = grid->cursor;
+        if (grid->row_lines > 0) {
+            p = asc_skip_space(p, end);
+            if (p >= end) return r;
+            p = memchr(p, '\n', (size_t)(end - p));
+            grid->cursor = p ? p : end;
+            continue;
+        }
+        const char *row_start = p = asc_skip_space(p, end);
+        for (int col = 0; col < grid->ncols; col++) {
+            p = asc_skip_token(p, end);
+            if (p == NULL) return r;
+        }
+        grid->cursor = p;
+        asc_note_row_end(grid, row_start);
+    }
+    return count;
+}
+
+// Reads columns 0, step, 2 * step, ... of the next row into values and skips
+// the rest. Returns ncols, or the column of the first missing or malformed
+// cell that had to be read.
+static inline int asc_read_row_stride(AscGrid *grid, float *values, int step) {
+    const char *end = grid->end;
+    const char *row_start = asc_skip_space(grid->cursor, end);
+    const char *p = row_start;
+    int until_next = 0;
+    for (int col = 0; col < grid->ncols; col++) {
+        if (until_next == 0) {
+            p = asc_next_value(p, end, values++);
+            until_next = step;
+        } else {
+            p = asc_skip_token(p, end);
+        }
+        if (p == NULL) return col;
+        until_next--;
+    }
+    grid->cursor = p;
+    asc_note_row_end(grid, row_start);
+    return grid->ncols;
+}
+
+static inline int asc_is_nodata(const AscGrid *grid, float z_value) {
+    return grid->has_nodata && z_value == (float)grid->nodata_value;
+}
+
+static inline const char *asc_error_message(int status) {
+    if (status == ASC_ERR_HEADER) return "missing or malformed ASC header";
+    return strerror(errno);
+}
+
+static inline void asc_close(AscGrid *grid) {
+    unmap_file(&grid->file);
+}
+
+#endif
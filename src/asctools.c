@@ -4,20 +4,38 @@
 void print_help() {
     printf("| Command         | Usage                                                                                             |\n");
     printf("|-----------------|---------------------------------------------------------------------------------------------------|\n");
-    printf("| `asc2csv`       | `Usage: asc2csv <input.asc>`                                                                      |\n");
-    printf("| `asc2las`       | `Usage: asc2las <input.asc> [-elev_rgb]` (Optional generation of rgb values based on elevation)   |\n");
-    printf("| `asc2tif`       | `Usage: asc2tif <input.asc> <epsg_code>`                                                          |\n");
-    printf("| `asc2pointgrid` | `Usage: asc2pointgrid <input.asc> [-spacing {x}]`                                                 |\n");
+    printf("| `asc2csv`       | `Usage: asc2csv <input.asc> [-decimals N] [-threads N]` (Decimal places for X, Y and Z, 0 to 9, default 6) |\n");
+    printf("| `asc2las`       | `Usage: asc2las <input.asc> [-elev_rgb] [-las14] [-compress] [-threads N]` (Optional generation of rgb values based on elevation) |\n");
+    printf("|                 | `-compress` writes a chunked compressed `.lasz` file, chunks are compressed on N threads          |\n");
+    printf("|                 | `-las14` writes LAS 1.4 (point format 6, or 7 with colour) with 64-bit point counts               |\n");
+    printf("| `asc2tif`       | `Usage: asc2tif <input.asc> <epsg_code> [-threads N] [-bigtiff] [-tiled] [-tilesize N] [-compress deflate/lzw] [-cog] [-resampling mean/nearest]` |\n");
+    printf("|                 | `-threads` parses the grid on N worker threads                                                    |\n");
+    printf("|                 | `-bigtiff` forces BigTIFF output (chosen automatically past 4 GB)                                 |\n");
+    printf("|                 | `-tiled` writes 256x256 tiles instead of strips, `-tilesize` picks another multiple of 16         |\n");
+    printf("|                 | `-compress` DEFLATE or LZW with the floating point predictor                                      |\n");
+    printf("|                 | `-cog` writes a cloud optimized GeoTIFF with overviews, `-resampling` picks how they are built    |\n");
+    printf("| `asc2pointgrid` | `Usage: asc2pointgrid <input.asc> [-spacing {x}] [-binary] [-threads N]`                          |\n");
     printf("|                 |   Outputs a dxf file with spot levels plotted as a grid. Optional spacing arg                     |\n");
-    printf("| `lssinfo`       | `Usage: lssinfo <input.00{x}>`                                                                    |\n");
-    printf("| `lss2csv`       | `Usage: lss2csv <input.00{x}>`                                                                    |\n");
-    printf("| `lss2boundary`  | `Usage: lss2boundary <input.00{x}>`                                                               |\n");
-    printf("| `lss2json`      | `Usage: lss2json <input.00{x}>`                                                                   |\n");
-    printf("| `lss2dxflines`  | `Usage: lss2dxflines <input.00{x}> [--one-code {x}] [--list-codes {x},{y}{z}]`                    |\n");
+    printf("|                 | (-binary writes AutoCAD Binary DXF, which is smaller and faster to load)                          |\n");
+    printf("| `lssinfo`       | `Usage: lssinfo <input.00{x}> [-threads N] [-json]`                                               |\n");
+    printf("|                 | Per feature code counts and Z ranges, a Z histogram and point density; `-json` prints them as JSON |\n");
+    printf("| `lss2csv`       | `Usage: lss2csv <input.00{x}> [-threads N] [-bbox minx,miny,maxx,maxy] [-clip polygon.geojson]`   |\n");
+    printf("|                 | (Only keeps points inside the box and/or the GeoJSON polygons, as a union; holes are honoured)    |\n");
+    printf("| `lss2boundary`  | `Usage: lss2boundary <input.00{x}> [-threads N] [-concave alpha] [-holes]`                        |\n");
+    printf("|                 | `-concave` traces an alpha shape: triangles wider than alpha (circumradius, metres) are left out  |\n");
+    printf("|                 | `-holes` also writes the gaps inside the concave boundary as polygon holes                        |\n");
+    printf("| `lss2json`      | `Usage: lss2json <input.00{x}> [-threads N]`                                                      |\n");
+    printf("| `lss2dxflines`  | `Usage: lss2dxflines <input.00{x}> [--one-code {x}] [--list-codes {x},{y},{z}] [-threads N] [-bbox minx,miny,maxx,maxy] [-clip polygon.geojson] [-lwpolyline] [-binary]` |\n");
     printf("|                 | [--one-code] generates a dxf output with only that feature code present.                          |\n");
     printf("|                 | [--list-codes] generates a dxf output from a comma delimited list of feature codes.               |\n");
-    printf("| `lss2las`       | `Usage: lss2las <input.00{x}> [-elev_rgb]` (Optional generation of rgb values based on elevation) |\n");
-    printf("| `lss2web`       |  `Usage: lss2web <input.00{x}> [-ge] [-points]`                                                   |\n");
+    printf("|                 | (Lines are cut where they cross the area edge, with interpolated elevations)                      |\n");
+    printf("|                 | (-lwpolyline writes compact 2D LWPOLYLINE entities in an AutoCAD 2000 file; elevation is kept only for flat lines; other output is R12) |\n");
+    printf("| `lss2las`       | `Usage: lss2las <input.00{x}> [-elev_rgb] [-las14] [-compress] [-threads N] [-bbox minx,miny,maxx,maxy] [-clip polygon.geojson]` (Optional generation of rgb values based on elevation) |\n");
+    printf("|                 | `-compress` writes a chunked compressed `.lasz` file, chunks are compressed on N threads          |\n");
+    printf("|                 | `-las14` writes LAS 1.4 (point format 6, or 7 with colour) with 64-bit point counts               |\n");
+    printf("|                 | `-threads` on the lss tools parses the survey on N worker threads, keeping record order           |\n");
+    printf("|                 | asc2csv, asc2pointgrid, lss2csv, lss2json and lss2dxflines also format their output on the N threads; the file is identical to a single-threaded run |\n");
+    printf("| `lss2web`       | `Usage: lss2web <input.00{x}> [-ge] [-points] [-threads N]`                                       |\n");
     printf("|                 |  `Enable Google Earth basemap tiles and include all points from survey on map`                    |\n");
 }
 
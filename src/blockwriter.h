@@ -0,0 +1,130 @@
+#ifndef BLOCKWRITER_H
+#define BLOCKWRITER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "parallel.h"
+#include "numformat.h"
+
+// Ordered parallel output for the text converters. A tool cuts each round of
+// its output into numbered blocks and supplies a callback that formats one
+// block into a private TextBuffer. block_writer_run formats the blocks across
+// the pool, then writes the buffers in block order, so the file is byte for
+// byte what a serial run writes. Buffers are kept from round to round, so
+// steady-state output does not allocate.
+//
+// Callbacks run concurrently: they may only read shared state and write to
+// their own buffer.
+
+#define TEXT_BUFFER_INITIAL (64 * 1024)
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+    int failed;
+} TextBuffer;
+
+// Returns room for size more bytes at the end of the buffer, or NULL (and
+// marks the buffer failed) when it cannot grow
+static inline char *text_reserve(TextBuffer *b, size_t size) {
+    if (b->used + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : TEXT_BUFFER_INITIAL;
+        while (capacity < b->used + size) capacity *= 2;
+        char *grown = realloc(b->data, capacity);
+        if (!grown) {
+            b->failed = 1;
+            return NULL;
+        }
+        b->data = grown;
+        b->capacity = capacity;
+    }
+    return b->data + b->used;
+}
+
+static inline void text_append(TextBuffer *b, const char *text, size_t length) {
+    char *p = text_reserve(b, length);
+    if (!p) return;
+    memcpy(p, text, length);
+    b->used += length;
+}
+
+static inline void text_char(TextBuffer *b, char c) {
+    char *p = text_reserve(b, 1);
+    if (!p) return;
+    *p = c;
+    b->used++;
+}
+
+static inline void text_fixed(TextBuffer *b, double value, int decimals) {
+    char *p = text_reserve(b, NUMFORMAT_SIZE);
+    if (!p) return;
+    b->used += (size_t)format_fixed(p, value, decimals);
+}
+
+static inline void text_buffer_free(TextBuffer *b) {
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+typedef void (*BlockFormat)(void *ctx, int block, TextBuffer *out);
+
+typedef struct {
+    FILE *file;
+    ThreadPool *pool;
+    TextBuffer *blocks;
+    int block_capacity;
+    BlockFormat format;
+    void *ctx;
+    int failed;
+} BlockWriter;
+
+static inline void block_writer_init(BlockWriter *w, FILE *file, ThreadPool *pool) {
+    memset(w, 0, sizeof(*w));
+    w->file = file;
+    w->pool = pool;
+}
+
+static inline void block_format_task(void *ctx, int index) {
+    BlockWriter *w = (BlockWriter *)ctx;
+    TextBuffer *out = &w->blocks[index];
+    out->used = 0;
+    w->format(w->ctx, index, out);
+}
+
+// Formats blocks 0..count-1 and appends them to the file in order. Returns -1
+// once any block has failed to allocate or any write has failed.
+static inline int block_writer_run(BlockWriter *w, int count, BlockFormat format, void *ctx) {
+    if (w->failed) return -1;
+    if (count > w->block_capacity) {
+        TextBuffer *blocks = realloc(w->blocks, (size_t)count * sizeof(TextBuffer));
+        if (!blocks) {
+            w->failed = 1;
+            return -1;
+        }
+        memset(blocks + w->block_capacity, 0, (size_t)(count - w->block_capacity) * sizeof(TextBuffer));
+        w->blocks = blocks;
+        w->block_capacity = count;
+    }
+
+    w->format = format;
+    w->ctx = ctx;
+    pool_run(w->pool, count, block_format_task, w);
+
+    for (int i = 0; i < count && !w->failed; i++) {
+        TextBuffer *out = &w->blocks[i];
+        if (out->failed || fwrite(out->data, 1, out->used, w->file) != out->used) w->failed = 1;
+    }
+    return w->failed ? -1 : 0;
+}
+
+static inline void block_writer_free(BlockWriter *w) {
+    for (int i = 0; i < w->block_capacity; i++) text_buffer_free(&w->blocks[i]);
+    free(w->blocks);
+    w->blocks = NULL;
+    w->block_capacity = 0;
+}
+
+#endif
@@ -0,0 +1,543 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "grow.h"
+#include "mapfile.h"
+#include "numscan.h"
+
+// Area clipping for the lss converters: -bbox minx,miny,maxx,maxy and
+// -clip polygon.geojson, alone or together (a point must pass both).
+//
+// Every record is first tested against the clip's bounding box. Polygons are
+// then tested with an edge grid built once up front: cells that no polygon
+// edge touches are marked inside or outside, so most points cost one lookup,
+// and points in the remaining cells only cast a ray against the edges of
+// their own row band. Only Polygon and MultiPolygon geometries are read.
+// Rings use the even-odd rule within each polygon, so holes need no special
+// handling, and a point is kept when it is inside any of the polygons, so
+// overlapping features do not cancel out.
+//
+// Line segments are cut where they cross the box or a polygon edge; each
+// piece between two crossings is kept when its midpoint is inside.
+
+#define CLIP_OUTSIDE 0
+#define CLIP_INSIDE 1
+#define CLIP_BOUNDARY 2
+#define CLIP_MAX_GRID 1024
+#define CLIP_MAX_DEPTH 16
+
+typedef struct {
+    double x0, y0, x1, y1;
+    size_t polygon;
+} ClipEdge;
+
+typedef struct {
+    int active;
+    int has_box;
+    double box_min_x, box_min_y, box_max_x, box_max_y;
+
+    // Polygon edges in polygon order, and the grid over their bounds
+    ClipEdge *edges;
+    size_t edge_count, edge_capacity;
+    size_t polygon_count;
+    double min_x, min_y, max_x, max_y;
+    int grid;
+    double cell_width, cell_height;
+    unsigned char *cells;
+    size_t *row_start;
+    size_t *row_edges;
+
+    // Positions of the ring being read from GeoJSON
+    double *ring;
+    size_t ring_count, ring_capacity;
+
+    // Scratch for clip_segment
+    double *crossings;
+    size_t crossing_capacity;
+    double *intervals;
+    size_t interval_capacity;
+} Clip;
+
+// Parses "minx,miny,maxx,maxy". Returns -1 if it is not four numbers
+// describing a box with some area.
+static inline int clip_set_box(Clip *clip, const char *text) {
+    double v[4];
+    const char *p = text, *end = text + strlen(text);
+    for (int i = 0; i < 4; i++) {
+        while (p < end && numscan_is_space(*p)) p++;
+        const char *next = scan_double(p, end, &v[i]);
+        if (next == NULL) return -1;
+        p = next;
+        while (p < end && numscan_is_space(*p)) p++;
+        if (i < 3) {
+            if (p >= end || *p != ',') return -1;
+            p++;
+        }
+    }
+    if (p != end || !(v[0] < v[2]) || !(v[1] < v[3])) return -1;
+
+    clip->has_box = 1;
+    clip->active = 1;
+    clip->box_min_x = v[0];
+    clip->box_min_y = v[1];
+    clip->box_max_x = v[2];
+    clip->box_max_y = v[3];
+    return 0;
+}
+
+static inline const char *clip_skip_space(const char *p, const char *end) {
+    while (p < end && numscan_is_space(*p)) p++;
+    return p;
+}
+
+static inline int clip_add_edge(Clip *clip, double x0, double y0, double x1, double y1) {
+    if (x0 == x1 && y0 == y1) return 0;
+    if (grow_array((void **)&clip->edges, &clip->edge_capacity, clip->edge_count + 1, sizeof(ClipEdge)) != 0) return -1;
+    ClipEdge edge = { x0, y0, x1, y1, clip->polygon_count };
+    clip->edges[clip->edge_count++] = edge;
+    return 0;
+}
+
+// Parses one GeoJSON coordinate array at p. Arrays of positions one level
+// below polygon_depth are rings and become edges (closing them if the file
+// did not); each array at polygon_depth is one polygon. Returns the position
+// after the array, or NULL on a syntax error.
+static inline const char *clip_parse_coordinates(Clip *clip, const char *p, const char *end, int depth,
+                                                 int polygon_depth, int *failed) {
+    p = clip_skip_space(p, end);
+    if (p >= end || *p != '[' || depth > CLIP_MAX_DEPTH) return NULL;
+    p = clip_skip_space(p + 1, end);
+
+    // A position: [x, y] or [x, y, z]
+    if (p < end && *p != '[') {
+        double v[2] = { 0.0, 0.0 };
+        int count = 0;
+        while (p < end && *p != ']') {
+            double value;
+            const char *next = scan_double(p, end, &value);
+            if (next == NULL) return NULL;
+            if (count < 2) v[count] = value;
+            count++;
+            p = clip_skip_space(next, end);
+            if (p < end && *p == ',') p = clip_skip_space(p + 1, end);
+        }
+        if (p >= end || count < 2) return NULL;
+        if (grow_array((void **)&clip->ring, &clip->ring_capacity, 2 * (clip->ring_count + 1), sizeof(double)) != 0) {
+            *failed = 1;
+        } else {
+            clip->ring[2 * clip->ring_count] = v[0];
+            clip->ring[2 * clip->ring_count + 1] = v[1];
+            clip->ring_count++;
+        }
+        return p + 1;
+    }
+
+    // An array of positions (a ring) or of deeper arrays
+    size_t ring_start = clip->ring_count;
+    int is_ring = 0;
+    while (p < end && *p != ']') {
+        const char *q = clip_skip_space(p + 1, end);
+        if (*p == '[' && q < end && *q != '[') is_ring = 1;
+        p = clip_parse_coordinates(clip, p, end, depth + 1, polygon_depth, failed);
+        if (p == NULL) return NULL;
+        p = clip_skip_space(p, end);
+        if (p < end && *p == ',') p = clip_skip_space(p + 1, end);
+    }
+    if (p >= end) return NULL;
+
+    if (is_ring && depth == polygon_depth + 1) {
+        size_t count = clip->ring_count - ring_start;
+        const double *v = clip->ring + 2 * ring_start;
+        if (count >= 3) {
+            for (size_t i = 0; i < count; i++) {
+                size_t j = (i + 1) % count;
+                if (clip_add_edge(clip, v[2 * i], v[2 * i + 1], v[2 * j], v[2 * j + 1]) != 0) *failed = 1;
+            }
+        }
+    }
+    if (is_ring) clip->ring_count = ring_start;
+    if (depth == polygon_depth) clip->polygon_count++;
+    return p + 1;
+}
+
+static inline const char *clip_skip_string(const char *p, const char *end) {
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\') p++;
+    }
+    return p < end ? p + 1 : NULL;
+}
+
+static inline int clip_string_is(const char *string, const char *end, const char *text) {
+    size_t len = strlen(text);
+    return (size_t)(end - string) == len + 2 && memcmp(string + 1, text, len) == 0;
+}
+
+// Walks one JSON value at p and reads the coordinates of every Polygon and
+// MultiPolygon object in it, whichever order their keys come in; other
+// geometry types are skipped. Returns the position after the value, or NULL
+// on a syntax error.
+static inline const char *clip_parse_value(Clip *clip, const char *p, const char *end, int depth, int *failed) {
+    p = clip_skip_space(p, end);
+    if (p >= end || depth > CLIP_MAX_DEPTH) return NULL;
+
+    if (*p == '"') return clip_skip_string(p, end);
+    if (*p == '[') {
+        p = clip_skip_space(p + 1, end);
+        while (p < end && *p != ']') {
+            p = clip_parse_value(clip, p, end, depth + 1, failed);
+            if (p == NULL) return NULL;
+            p = clip_skip_space(p, end);
+            if (p < end && *p == ',') p = clip_skip_space(p + 1, end);
+        }
+        return p < end ? p + 1 : NULL;
+    }
+    if (*p != '{') {
+        // A number, true, false or null
+        const char *start = p;
+        while (p < end && *p != ',' && *p != ']' && *p != '}' && !numscan_is_space(*p)) p++;
+        return p > start ? p : NULL;
+    }
+
+    int polygon_depth = -1;
+    const char *coordinates = NULL;
+    p = clip_skip_space(p + 1, end);
+    while (p < end && *p != '}') {
+        if (*p != '"') return NULL;
+        const char *key = p;
+        p = clip_skip_string(p, end);
+        if (p == NULL) return NULL;
+        const char *key_end = p;
+        p = clip_skip_space(p, end);
+        if (p >= end || *p != ':') return NULL;
+        p = clip_skip_space(p + 1, end);
+
+        const char *value = p;
+        p = clip_parse_value(clip, p, end, depth + 1, failed);
+        if (p == NULL) return NULL;
+        if (clip_string_is(key, key_end, "type") && *value == '"') {
+            if (clip_string_is(value, p, "Polygon")) polygon_depth = 0;
+            else if (clip_string_is(value, p, "MultiPolygon")) polygon_depth = 1;
+        } else if (clip_string_is(key, key_end, "coordinates")) {
+            coordinates = value;
+        }
+        p = clip_skip_space(p, end);
+        if (p < end && *p == ',') p = clip_skip_space(p + 1, end);
+    }
+    if (p >= end) return NULL;
+
+    if (polygon_depth >= 0 && coordinates != NULL) {
+        clip->ring_count = 0;
+        if (clip_parse_coordinates(clip, coordinates, end, 0, polygon_depth, failed) == NULL) return NULL;
+    }
+    return p + 1;
+}
+
+// Reads the Polygon and MultiPolygon rings of a GeoJSON file (a bare
+// geometry, a Feature or a FeatureCollection). Returns 0, or -1 with a
+// message on stderr.
+static inline int clip_load_polygon(Clip *clip, const char *path) {
+    MappedFile file;
+    if (map_file(path, &file) != 0) {
+        fprintf(stderr, "Error opening clip polygon '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int failed = 0;
+    const char *p = clip_parse_value(clip, file.data, file.data + file.size, 0, &failed);
+    unmap_file(&file);
+    if (p == NULL) {
+        fprintf(stderr, "Malformed GeoJSON in clip polygon '%s'\n", path);
+        return -1;
+    }
+
+    if (failed) {
+        fprintf(stderr, "Memory allocation failed for clip polygon '%s'\n", path);
+        return -1;
+    }
+    if (clip->edge_count == 0) {
+        fprintf(stderr, "No polygon found in clip polygon '%s'\n", path);
+        return -1;
+    }
+    clip->active = 1;
+    return 0;
+}
+
+// Ray cast towards +x against the edges of the point's row band, even-odd
+// within each polygon. A band lists its edges in edge order, so each
+// polygon's edges are contiguous and its parity is settled when the next
+// polygon starts.
+static inline int clip_ray_inside(const Clip *clip, double x, double y) {
+    int row = (int)((y - clip->min_y) / clip->cell_height);
+    if (row < 0) row = 0;
+    if (row >= clip->grid) row = clip->grid - 1;
+
+    int inside = 0;
+    size_t polygon = 0;
+    for (size_t k = clip->row_start[row]; k < clip->row_start[row + 1]; k++) {
+        const ClipEdge *e = &clip->edges[clip->row_edges[k]];
+        if (e->polygon != polygon) {
+            if (inside) return 1;
+            polygon = e->polygon;
+        }
+        if ((e->y0 > y) != (e->y1 > y) && x < (e->x1 - e->x0) * (y - e->y0) / (e->y1 - e->y0) + e->x0) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+// Liang-Barsky test of whether an edge passes through a rectangle.
+static inline int clip_edge_meets_rect(const ClipEdge *e, double min_x, double min_y, double max_x, double max_y) {
+    double dx = e->x1 - e->x0, dy = e->y1 - e->y0;
+    double t0 = 0.0, t1 = 1.0;
+    double p[4] = { -dx, dx, -dy, dy };
+    double q[4] = { e->x0 - min_x, max_x - e->x0, e->y0 - min_y, max_y - e->y0 };
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0) {
+            if (q[i] < 0.0) return 0;
+            continue;
+        }
+        double t = q[i] / p[i];
+        if (p[i] < 0.0) {
+            if (t > t1) return 0;
+            if (t > t0) t0 = t;
+        } else {
+            if (t < t0) return 0;
+            if (t < t1) t1 = t;
+        }
+    }
+    return 1;
+}
+
+// Builds the edge grid. Call once after the options are read. Returns -1 on
+// allocation failure.
+static inline int clip_prepare(Clip *clip) {
+    if (clip->edge_count == 0) return 0;
+
+    clip->min_x = clip->max_x = clip->edges[0].x0;
+    clip->min_y = clip->max_y = clip->edges[0].y0;
+    for (size_t i = 0; i < clip->edge_count; i++) {
+        const ClipEdge *e = &clip->edges[i];
+        double xs[2] = { e->x0, e->x1 }, ys[2] = { e->y0, e->y1 };
+        for (int k = 0; k < 2; k++) {
+            if (xs[k] < clip->min_x) clip->min_x = xs[k];
+            if (xs[k] > clip->max_x) clip->max_x = xs[k];
+            if (ys[k] < clip->min_y) clip->min_y = ys[k];
+            if (ys[k] > clip->max_y) clip->max_y = ys[k];
+        }
+    }
+
+    int grid = (int)sqrt((double)clip->edge_count) * 2 + 16;
+    if (grid > CLIP_MAX_GRID) grid = CLIP_MAX_GRID;
+    clip->grid = grid;
+    clip->cell_width = (clip->max_x - clip->min_x) / grid;
+    clip->cell_height = (clip->max_y - clip->min_y) / grid;
+    if (clip->cell_width <= 0.0) clip->cell_width = 1.0;
+    if (clip->cell_height <= 0.0) clip->cell_height = 1.0;
+
+    // Row bands: every edge whose y range meets the band, as one flat list
+    clip->row_start = calloc((size_t)grid + 1, sizeof(size_t));
+    clip->cells = calloc((size_t)grid * grid, 1);
+    if (!clip->row_start || !clip->cells) return -1;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < clip->edge_count; i++) {
+            const ClipEdge *e = &clip->edges[i];
+            double low = e->y0 < e->y1 ? e->y0 : e->y1, high = e->y0 < e->y1 ? e->y1 : e->y0;
+            int first = (int)((low - clip->min_y) / clip->cell_height);
+            int last = (int)((high - clip->min_y) / clip->cell_height);
+            // Edges on the top bound fall one past the last band
+            if (first < 0) first = 0;
+            if (first >= grid) first = grid - 1;
+            if (last >= grid) last = grid - 1;
+            for (int row = first; row <= last; row++) {
+                if (pass == 0) clip->row_start[row + 1]++;
+                else clip->row_edges[clip->row_start[row]++] = i;
+            }
+        }
+        if (pass == 0) {
+            for (int row = 0; row < grid; row++) clip->row_start[row + 1] += clip->row_start[row];
+            clip->row_edges = malloc((clip->row_start[grid] ? clip->row_start[grid] : 1) * sizeof(size_t));
+            if (!clip->row_edges) return -1;
+        } else {
+            for (int row = grid; row > 0; row--) clip->row_start[row] = clip->row_start[row - 1];
+            clip->row_start[0] = 0;
+        }
+    }
+
+    // Cells an edge passes through need the ray cast; the rest are settled now
+    for (size_t i = 0; i < clip->edge_count; i++) {
+        const ClipEdge *e = &clip->edges[i];
+        int c0 = (int)(((e->x0 < e->x1 ? e->x0 : e->x1) - clip->min_x) / clip->cell_width);
+        int c1 = (int)(((e->x0 < e->x1 ? e->x1 : e->x0) - clip->min_x) / clip->cell_width);
+        int r0 = (int)(((e->y0 < e->y1 ? e->y0 : e->y1) - clip->min_y) / clip->cell_height);
+        int r1 = (int)(((e->y0 < e->y1 ? e->y1 : e->y0) - clip->min_y) / clip->cell_height);
+        if (c0 < 0) c0 = 0;
+        if (r0 < 0) r0 = 0;
+        if (c0 >= grid) c0 = grid - 1;
+        if (r0 >= grid) r0 = grid - 1;
+        if (c1 >= grid) c1 = grid - 1;
+        if (r1 >= grid) r1 = grid - 1;
+        for (int row = r0; row <= r1; row++) {
+            for (int column = c0; column <= c1; column++) {
+                double cx = clip->min_x + column * clip->cell_width, cy = clip->min_y + row * clip->cell_height;
+                if (clip_edge_meets_rect(e, cx, cy, cx + clip->cell_width, cy + clip->cell_height)) {
+                    clip->cells[(size_t)row * grid + column] = CLIP_BOUNDARY;
+                }
+            }
+        }
+    }
+    for (int row = 0; row < grid; row++) {
+        for (int column = 0; column < grid; column++) {
+            unsigned char *cell = &clip->cells[(size_t)row * grid + column];
+            if (*cell == CLIP_BOUNDARY) continue;
+            double cx = clip->min_x + (column + 0.5) * clip->cell_width;
+            double cy = clip->min_y + (row + 0.5) * clip->cell_height;
+            *cell = clip_ray_inside(clip, cx, cy) ? CLIP_INSIDE : CLIP_OUTSIDE;
+        }
+    }
+    return 0;
+}
+
+static inline int clip_polygon_contains(const Clip *clip, double x, double y) {
+    if (x < clip->min_x || x > clip->max_x || y < clip->min_y || y > clip->max_y) return 0;
+    int column = (int)((x - clip->min_x) / clip->cell_width);
+    int row = (int)((y - clip->min_y) / clip->cell_height);
+    if (column >= clip->grid) column = clip->grid - 1;
+    if (row >= clip->grid) row = clip->grid - 1;
+    unsigned char cell = clip->cells[(size_t)row * clip->grid + column];
+    if (cell != CLIP_BOUNDARY) return cell == CLIP_INSIDE;
+    return clip_ray_inside(clip, x, y);
+}
+
+// Returns 1 when (x, y) is kept. Always 1 when no clip was given.
+static inline int clip_contains(const Clip *clip, double x, double y) {
+    if (!clip->active) return 1;
+    if (clip->has_box && (x < clip->box_min_x || x > clip->box_max_x || y < clip->box_min_y || y > clip->box_max_y))
+        return 0;
+    return clip->edge_count == 0 || clip_polygon_contains(clip, x, y);
+}
+
+// Bounds of everything a clip can keep: the box, the polygons' bounds or the
+// overlap of the two. Call after clip_prepare on an active clip.
+static inline void clip_bounds(const Clip *clip, double *min_x, double *min_y, double *max_x, double *max_y) {
+    if (clip->edge_count > 0) {
+        *min_x = clip->min_x;
+        *min_y = clip->min_y;
+        *max_x = clip->max_x;
+        *max_y = clip->max_y;
+        if (!clip->has_box) return;
+        if (clip->box_min_x > *min_x) *min_x = clip->box_min_x;
+        if (clip->box_min_y > *min_y) *min_y = clip->box_min_y;
+        if (clip->box_max_x < *max_x) *max_x = clip->box_max_x;
+        if (clip->box_max_y < *max_y) *max_y = clip->box_max_y;
+        return;
+    }
+    *min_x = clip->box_min_x;
+    *min_y = clip->box_min_y;
+    *max_x = clip->box_max_x;
+    *max_y = clip->box_max_y;
+}
+
+static inline int clip_add_crossing(Clip *clip, size_t *count, double ax, double ay, double dx, double dy,
+                                    const ClipEdge *e) {
+    double ex = e->x1 - e->x0, ey = e->y1 - e->y0;
+    double denom = dx * ey - dy * ex;
+    if (denom == 0.0) return 0;
+    double wx = e->x0 - ax, wy = e->y0 - ay;
+    double t = (wx * ey - wy * ex) / denom;
+    double u = (wx * dy - wy * dx) / denom;
+    if (t <= 0.0 || t >= 1.0 || u < 0.0 || u > 1.0) return 0;
+    if (grow_array((void **)&clip->crossings, &clip->crossing_capacity, *count + 1, sizeof(double)) != 0) return -1;
+    clip->crossings[(*count)++] = t;
+    return 0;
+}
+
+static inline int clip_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Cuts the segment (x0, y0)-(x1, y1) to the clip. Returns the number of kept
+// pieces, each a pair of parameters t0 < t1 in [0, 1] along the segment,
+// in clip->intervals; or -1 on allocation failure.
+static inline int clip_segment(Clip *clip, double x0, double y0, double x1, double y1) {
+    if (grow_array((void **)&clip->intervals, &clip->interval_capacity, 2, sizeof(double)) != 0) return -1;
+    if (!clip->active) {
+        clip->intervals[0] = 0.0;
+        clip->intervals[1] = 1.0;
+        return 1;
+    }
+
+    double dx = x1 - x0, dy = y1 - y0;
+    size_t count = 0;
+    if (clip->has_box) {
+        ClipEdge sides[4] = {
+            { clip->box_min_x, clip->box_min_y, clip->box_max_x, clip->box_min_y, 0 },
+            { clip->box_max_x, clip->box_min_y, clip->box_max_x, clip->box_max_y, 0 },
+            { clip->box_max_x, clip->box_max_y, clip->box_min_x, clip->box_max_y, 0 },
+            { clip->box_min_x, clip->box_max_y, clip->box_min_x, clip->box_min_y, 0 },
+        };
+        for (int i = 0; i < 4; i++) {
+            if (clip_add_crossing(clip, &count, x0, y0, dx, dy, &sides[i]) != 0) return -1;
+        }
+    }
+    if (clip->edge_count > 0) {
+        double low = y0 < y1 ? y0 : y1, high = y0 < y1 ? y1 : y0;
+        if (high >= clip->min_y && low <= clip->max_y) {
+            int first = (int)((low - clip->min_y) / clip->cell_height);
+            int last = (int)((high - clip->min_y) / clip->cell_height);
+            if (first < 0) first = 0;
+            if (first >= clip->grid) first = clip->grid - 1;
+            if (last >= clip->grid) last = clip->grid - 1;
+            for (int row = first; row <= last; row++) {
+                for (size_t k = clip->row_start[row]; k < clip->row_start[row + 1]; k++) {
+                    if (clip_add_crossing(clip, &count, x0, y0, dx, dy, &clip->edges[clip->row_edges[k]]) != 0)
+                        return -1;
+                }
+            }
+        }
+    }
+    qsort(clip->crossings, count, sizeof(double), clip_compare_double);
+
+    // Keep each piece between crossings whose midpoint is inside, merging
+    // neighbours (an edge listed in several bands gives repeated crossings)
+    int pieces = 0;
+    double start = 0.0;
+    for (size_t i = 0; i <= count; i++) {
+        double stop = i < count ? clip->crossings[i] : 1.0;
+        if (stop <= start) continue;
+        double mid = (start + stop) / 2.0;
+        if (clip_contains(clip, x0 + mid * dx, y0 + mid * dy)) {
+            if (pieces > 0 && clip->intervals[2 * pieces - 1] == start) {
+                clip->intervals[2 * pieces - 1] = stop;
+            } else {
+                if (grow_array((void **)&clip->intervals, &clip->interval_capacity, 2 * (size_t)pieces + 2,
+                              sizeof(double)) != 0)
+                    return -1;
+                clip->intervals[2 * pieces] = start;
+                clip->intervals[2 * pieces + 1] = stop;
+                pieces++;
+            }
+        }
+        start = stop;
+    }
+    return pieces;
+}
+
+static inline void clip_free(Clip *clip) {
+    free(clip->edges);
+    free(clip->cells);
+    free(clip->row_start);
+    free(clip->row_edges);
+    free(clip->ring);
+    free(clip->crossings);
+    free(clip->intervals);
+    memset(clip, 0, sizeof(*clip));
+}
+
+#endif
@@ -0,0 +1,495 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Self-contained zlib-format (RFC 1950/1951) encoder so the tools can write
+// compressed output without linking zlib. Input is compressed in one call
+// from memory: LZ77 matching over hash chains with one step of lazy
+// evaluation, then dynamic Huffman blocks. If the result would be larger than
+// the input the data is sent as stored blocks instead.
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_BLOCK_SYMBOLS 16384
+#define DEFLATE_MAX_BITS 15
+
+static const uint16_t deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Hash chain depth and "good enough" match length per compression level
+static const uint16_t deflate_max_chain[10] = { 0, 4, 8, 16, 32, 48, 64, 128, 256, 1024 };
+static const uint16_t deflate_nice_length[10] = { 0, 8, 16, 32, 32, 64, 128, 128, 258, 258 };
+
+static const uint8_t deflate_clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef struct {
+    uint8_t *out;
+    size_t capacity;
+    size_t pos;
+    uint64_t bits;
+    int bit_count;
+    int overflow;
+} DeflateBits;
+
+// One LZ77 symbol: a literal (dist == 0) or a length/distance pair
+typedef struct {
+    uint16_t litlen;
+    uint16_t dist;
+} DeflateSymbol;
+
+static inline void deflate_put_bits(DeflateBits *bw, uint32_t value, int count) {
+    bw->bits |= (uint64_t)value << bw->bit_count;
+    bw->bit_count += count;
+    while (bw->bit_count >= 8) {
+        if (bw->pos < bw->capacity) bw->out[bw->pos++] = (uint8_t)bw->bits;
+        else bw->overflow = 1;
+        bw->bits >>= 8;
+        bw->bit_count -= 8;
+    }
+}
+
+static inline void deflate_align(DeflateBits *bw) {
+    if (bw->bit_count > 0) deflate_put_bits(bw, 0, 8 - bw->bit_count);
+}
+
+static inline void deflate_put_byte(DeflateBits *bw, uint8_t value) {
+    if (bw->pos < bw->capacity) bw->out[bw->pos++] = value;
+    else bw->overflow = 1;
+}
+
+static inline uint32_t deflate_reverse(uint32_t code, int length) {
+    uint32_t result = 0;
+    for (int i = 0; i < length; i++) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+static inline int deflate_length_code(int length) {
+    int code = 0;
+    while (code < 28 && deflate_length_base[code + 1] <= length) code++;
+    return code;
+}
+
+static inline int deflate_dist_code(int dist) {
+    int code = 0;
+    while (code < 29 && deflate_dist_base[code + 1] <= dist) code++;
+    return code;
+}
+
+// Builds Huffman code lengths no longer than max_bits. Lengths come from a
+// plain Huffman tree; over-long codes are then pulled up with the same
+// bit-count adjustment libjpeg uses, which keeps the code complete.
+static inline void deflate_build_lengths(const uint32_t *freq, int n, int max_bits, uint8_t *lengths) {
+    int symbols[288];
+    uint32_t weight[2 * 288];
+    int parent[2 * 288];
+    int used = 0;
+
+    memset(lengths, 0, (size_t)n);
+    for (int i = 0; i < n; i++) {
+        if (freq[i]) symbols[used++] = i;
+    }
+    if (used == 0) return;
+    if (used == 1) {
+        lengths[symbols[0]] = 1;
+        return;
+    }
+
+    // Sort used symbols by ascending frequency
+    for (int i = 1; i < used; i++) {
+        int s = symbols[i], j = i;
+        while (j > 0 && freq[symbols[j - 1]] > freq[s]) {
+            symbols[j] = symbols[j - 1];
+            j--;
+        }
+        symbols[j] = s;
+    }
+
+    // Two-queue Huffman construction: leaves are 0..used-1, internal nodes follow
+    for (int i = 0; i < used; i++) weight[i] = freq[symbols[i]];
+    int leaf = 0, node = used, next_node = used;
+    for (int k = 0; k < used - 1; k++) {
+        int pick[2];
+        for (int t = 0; t < 2; t++) {
+            if (leaf < used && (node >= next_node || weight[leaf] <= weight[node])) pick[t] = leaf++;
+            else pick[t] = node++;
+        }
+        weight[next_node] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = next_node;
+        parent[pick[1]] = next_node;
+        next_node++;
+    }
+
+    int depth[2 * 288];
+    int root = next_node - 1;
+    depth[root] = 0;
+    for (int i = root - 1; i >= 0; i--) depth[i] = depth[parent[i]] + 1;
+
+    int bl_count[2 * 288] = {0};
+    int longest = 0;
+    for (int i = 0; i < used; i++) {
+        bl_count[depth[i]]++;
+        if (depth[i] > longest) longest = depth[i];
+    }
+
+    for (int i = longest; i > max_bits; i--) {
+        while (bl_count[i] > 0) {
+            int j = i - 2;
+            while (bl_count[j] == 0) j--;
+            bl_count[i] -= 2;
+            bl_count[i - 1]++;
+            bl_count[j + 1] += 2;
+            bl_count[j]--;
+        }
+    }
+
+    // Most frequent symbols (end of the sorted list) get the shortest codes
+    int index = used - 1;
+    for (int len = 1; len <= max_bits; len++) {
+        for (int c = 0; c < bl_count[len]; c++) lengths[symbols[index--]] = (uint8_t)len;
+    }
+}
+
+static inline void deflate_build_codes(const uint8_t *lengths, int n, uint16_t *codes) {
+    int bl_count[DEFLATE_MAX_BITS + 1] = {0};
+    int next_code[DEFLATE_MAX_BITS + 1];
+    for (int i = 0; i < n; i++) bl_count[lengths[i]]++;
+    bl_count[0] = 0;
+
+    int code = 0;
+    for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) codes[i] = (uint16_t)deflate_reverse((uint32_t)next_code[lengths[i]]++, lengths[i]);
+        else codes[i] = 0;
+    }
+}
+
+static inline void deflate_write_block(DeflateBits *bw, const DeflateSymbol *symbols, int count, int final) {
+    uint32_t lit_freq[286] = {0};
+    uint32_t dist_freq[30] = {0};
+
+    for (int i = 0; i < count; i++) {
+        if (symbols[i].dist == 0) {
+            lit_freq[symbols[i].litlen]++;
+        } else {
+            lit_freq[257 + deflate_length_code(symbols[i].litlen)]++;
+            dist_freq[deflate_dist_code(symbols[i].dist)]++;
+        }
+    }
+    lit_freq[256] = 1;
+
+    // Keep at least two codes in each tree so every decoder accepts them
+    if (lit_freq[0] == 0) lit_freq[0] = 1;
+    int dist_used = 0;
+    for (int i = 0; i < 30; i++) dist_used += dist_freq[i] != 0;
+    if (dist_used < 2) {
+        if (dist_freq[0] == 0) dist_freq[0] = 1;
+        else dist_freq[1] = 1;
+    }
+
+    uint8_t lit_len[286], dist_len[30];
+    uint16_t lit_code[286], dist_code[30];
+    deflate_build_lengths(lit_freq, 286, DEFLATE_MAX_BITS, lit_len);
+    deflate_build_lengths(dist_freq, 30, DEFLATE_MAX_BITS, dist_len);
+    deflate_build_codes(lit_len, 286, lit_code);
+    deflate_build_codes(dist_len, 30, dist_code);
+
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && lit_len[hlit - 1] == 0) hlit--;
+    while (hdist > 1 && dist_len[hdist - 1] == 0) hdist--;
+
+    // Run-length encode the concatenated code lengths with symbols 16/17/18
+    uint8_t all_len[286 + 30];
+    memcpy(all_len, lit_len, (size_t)hlit);
+    memcpy(all_len + hlit, dist_len, (size_t)hdist);
+    int total = hlit + hdist;
+
+    uint8_t rle_sym[286 + 30];
+    uint8_t rle_extra[286 + 30];
+    int rle_count = 0;
+    uint32_t clen_freq[19] = {0};
+
+    for (int i = 0; i < total;) {
+        int value = all_len[i];
+        int run = 1;
+        while (i + run < total && all_len[i + run] == value) run++;
+
+        if (value == 0 && run >= 3) {
+            int take = run > 138 ? 138 : run;
+            if (take >= 11) {
+                rle_sym[rle_count] = 18;
+                rle_extra[rle_count++] = (uint8_t)(take - 11);
+            } else {
+                rle_sym[rle_count] = 17;
+                rle_extra[rle_count++] = (uint8_t)(take - 3);
+            }
+            clen_freq[rle_sym[rle_count - 1]]++;
+            i += take;
+        } else if (value != 0 && run >= 4) {
+            rle_sym[rle_count] = (uint8_t)value;
+            rle_extra[rle_count++] = 0;
+            clen_freq[value]++;
+            int repeat = run - 1;
+            while (repeat >= 3) {
+                int take = repeat > 6 ? 6 : repeat;
+                rle_sym[rle_count] = 16;
+                rle_extra[rle_count++] = (uint8_t)(take - 3);
+                clen_freq[16]++;
+                repeat -= take;
+            }
+            i += run - repeat;
+        } else {
+            rle_sym[rle_count] = (uint8_t)value;
+            rle_extra[rle_count++] = 0;
+            clen_freq[value]++;
+            i++;
+        }
+    }
+
+    uint8_t clen_len[19];
+    uint16_t clen_code[19];
+    deflate_build_lengths(clen_freq, 19, 7, clen_len);
+    deflate_build_codes(clen_len, 19, clen_code);
+
+    int hclen = 19;
+    while (hclen > 4 && clen_len[deflate_clen_order[hclen - 1]] == 0) hclen--;
+
+    deflate_put_bits(bw, final ? 1 : 0, 1);
+    deflate_put_bits(bw, 2, 2);
+    deflate_put_bits(bw, (uint32_t)(hlit - 257), 5);
+    deflate_put_bits(bw, (uint32_t)(hdist - 1), 5);
+    deflate_put_bits(bw, (uint32_t)(hclen - 4), 4);
+    for (int i = 0; i < hclen; i++) deflate_put_bits(bw, clen_len[deflate_clen_order[i]], 3);
+
+    for (int i = 0; i < rle_count; i++) {
+        int sym = rle_sym[i];
+        deflate_put_bits(bw, clen_code[sym], clen_len[sym]);
+        if (sym == 16) deflate_put_bits(bw, rle_extra[i], 2);
+        else if (sym == 17) deflate_put_bits(bw, rle_extra[i], 3);
+        else if (sym == 18) deflate_put_bits(bw, rle_extra[i], 7);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (symbols[i].dist == 0) {
+            int lit = symbols[i].litlen;
+            deflate_put_bits(bw, lit_code[lit], lit_len[lit]);
+        } else {
+            int length = symbols[i].litlen;
+            int lcode = deflate_length_code(length);
+            deflate_put_bits(bw, lit_code[257 + lcode], lit_len[257 + lcode]);
+            deflate_put_bits(bw, (uint32_t)(length - deflate_length_base[lcode]), deflate_length_extra[lcode]);
+
+            int dist = symbols[i].dist;
+            int dcode = deflate_dist_code(dist);
+            deflate_put_bits(bw, dist_code[dcode], dist_len[dcode]);
+            deflate_put_bits(bw, (uint32_t)(dist - deflate_dist_base[dcode]), deflate_dist_extra[dcode]);
+        }
+    }
+
+    deflate_put_bits(bw, lit_code[256], lit_len[256]);
+}
+
+static inline uint32_t deflate_adler32(const uint8_t *data, size_t length) {
+    uint32_t a = 1, b = 0;
+    while (length > 0) {
+        size_t run = length > 5552 ? 5552 : length;
+        length -= run;
+        while (run--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Largest output deflate_compress can produce for length input bytes
+static inline size_t deflate_bound(size_t length) {
+    return length + (length / 65535 + 1) * 5 + 6;
+}
+
+static inline size_t deflate_store(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity) {
+    DeflateBits bw = { dst, capacity, 0, 0, 0, 0 };
+    deflate_put_byte(&bw, 0x78);
+    deflate_put_byte(&bw, 0x01);
+
+    size_t pos = 0;
+    do {
+        size_t run = length - pos > 65535 ? 65535 : length - pos;
+        int final = (pos + run == length);
+        deflate_put_bits(&bw, final ? 1 : 0, 1);
+        deflate_put_bits(&bw, 0, 2);
+        deflate_align(&bw);
+        deflate_put_byte(&bw, (uint8_t)run);
+        deflate_put_byte(&bw, (uint8_t)(run >> 8));
+        deflate_put_byte(&bw, (uint8_t)~run);
+        deflate_put_byte(&bw, (uint8_t)(~run >> 8));
+        if (bw.pos + run <= bw.capacity) memcpy(bw.out + bw.pos, src + pos, run);
+        else bw.overflow = 1;
+        bw.pos += run;
+        pos += run;
+    } while (pos < length);
+
+    uint32_t adler = deflate_adler32(src, length);
+    for (int shift = 24; shift >= 0; shift -= 8) deflate_put_byte(&bw, (uint8_t)(adler >> shift));
+    return bw.overflow ? 0 : bw.pos;
+}
+
+static inline uint32_t deflate_hash(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static inline int deflate_longest_match(const uint8_t *src, size_t length, size_t pos, const int32_t *head,
+                                        const int32_t *prev, int max_chain, int nice_length, int *match_dist) {
+    int best = 0;
+    size_t limit = length - pos;
+    if (limit > DEFLATE_MAX_MATCH) limit = DEFLATE_MAX_MATCH;
+    if (limit < DEFLATE_MIN_MATCH) return 0;
+
+    int32_t candidate = head[deflate_hash(src + pos)];
+    while (candidate >= 0 && max_chain-- > 0) {
+        size_t dist = pos - (size_t)candidate;
+        if (dist > DEFLATE_WINDOW) break;
+
+        const uint8_t *a = src + candidate;
+        const uint8_t *b = src + pos;
+        if (a[best] == b[best]) {
+            size_t len = 0;
+            while (len < limit && a[len] == b[len]) len++;
+            if ((int)len > best) {
+                best = (int)len;
+                *match_dist = (int)dist;
+                if (len == limit || best >= nice_length) break;
+            }
+        }
+        candidate = prev[candidate];
+    }
+    return best >= DEFLATE_MIN_MATCH ? best : 0;
+}
+
+// Compresses src into a zlib stream in dst. level runs from 1 (fastest) to 9
+// and sets how far the hash chains are searched. Returns the stream size, or
+// 0 if dst is too small or memory runs out. deflate_bound(length) is always
+// enough room.
+static inline size_t deflate_compress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity, int level) {
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+    int max_chain = deflate_max_chain[level];
+    int nice_length = deflate_nice_length[level];
+    int lazy_limit = level >= 4 ? 32 : 0;
+
+    int32_t *head = malloc(((size_t)1 << DEFLATE_HASH_BITS) * sizeof(int32_t));
+    int32_t *prev = malloc((length ? length : 1) * sizeof(int32_t));
+    DeflateSymbol *symbols = malloc(DEFLATE_BLOCK_SYMBOLS * sizeof(DeflateSymbol));
+    if (!head || !prev || !symbols) {
+        free(head);
+        free(prev);
+        free(symbols);
+        return 0;
+    }
+    memset(head, 0xff, ((size_t)1 << DEFLATE_HASH_BITS) * sizeof(int32_t));
+
+    DeflateBits bw = { dst, capacity, 0, 0, 0, 0 };
+    deflate_put_byte(&bw, 0x78);
+    deflate_put_byte(&bw, 0x9c);
+
+    int symbol_count = 0;
+    size_t pos = 0;
+    size_t inserted = 0;
+
+    while (pos < length) {
+        // Chain every position up to pos so matches can reference them
+        while (inserted < pos && inserted + DEFLATE_MIN_MATCH <= length) {
+            uint32_t h = deflate_hash(src + inserted);
+            prev[inserted] = head[h];
+            head[h] = (int32_t)inserted;
+            inserted++;
+        }
+
+        int dist = 0;
+        int len = (pos + DEFLATE_MIN_MATCH <= length)
+            ? deflate_longest_match(src, length, pos, head, prev, max_chain, nice_length, &dist) : 0;
+
+        if (len > 0 && len < lazy_limit && pos + 1 + DEFLATE_MIN_MATCH <= length) {
+            // Lazy step: prefer a longer match starting one byte later
+            uint32_t h = deflate_hash(src + pos);
+            prev[pos] = head[h];
+            head[h] = (int32_t)pos;
+            inserted = pos + 1;
+
+            int next_dist = 0;
+            int next_len = deflate_longest_match(src, length, pos + 1, head, prev, max_chain, nice_length, &next_dist);
+            if (next_len > len) {
+                symbols[symbol_count].litlen = src[pos];
+                symbols[symbol_count++].dist = 0;
+                pos++;
+                len = next_len;
+                dist = next_dist;
+                if (symbol_count == DEFLATE_BLOCK_SYMBOLS) {
+                    deflate_write_block(&bw, symbols, symbol_count, 0);
+                    symbol_count = 0;
+                }
+            }
+        }
+
+        if (len > 0) {
+            symbols[symbol_count].litlen = (uint16_t)len;
+            symbols[symbol_count++].dist = (uint16_t)dist;
+            pos += (size_t)len;
+        } else {
+            symbols[symbol_count].litlen = src[pos];
+            symbols[symbol_count++].dist = 0;
+            pos++;
+        }
+
+        if (symbol_count == DEFLATE_BLOCK_SYMBOLS && pos < length) {
+            deflate_write_block(&bw, symbols, symbol_count, 0);
+            symbol_count = 0;
+        }
+        if (bw.overflow) break;
+    }
+
+    deflate_write_block(&bw, symbols, symbol_count, 1);
+    deflate_align(&bw);
+
+    uint32_t adler = deflate_adler32(src, length);
+    for (int shift = 24; shift >= 0; shift -= 8) deflate_put_byte(&bw, (uint8_t)(adler >> shift));
+
+    free(head);
+    free(prev);
+    free(symbols);
+
+    if (bw.overflow || bw.pos > length + 11) {
+        return deflate_store(src, length, dst, capacity);
+    }
+    return bw.pos;
+}
+
+#endif
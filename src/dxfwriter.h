@@ -0,0 +1,362 @@
+#ifndef DXFWRITER_H
+#define DXFWRITER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "numformat.h"
+#include "blockwriter.h"
+
+// Shared DXF writer for lss2dxflines and asc2pointgrid. Group codes and values
+// are encoded into a large buffer and written out in blocks. ASCII numbers go
+// through format_fixed rather than printf. A writer can also be attached to a
+// block's TextBuffer, so the same encoders serve BlockWriter callbacks.
+//
+// Output is R12 unless r2000 is set. R12 needs no handles, tables or
+// objects, but has no LWPOLYLINE. With r2000 the file declares AutoCAD 2000
+// (AC1015) and carries what that version requires: a handle and owner on
+// every table entry, block and entity, $HANDSEED, the symbol tables with
+// their defaults, the *Model_Space and *Paper_Space blocks and block records,
+// subclass markers and the root dictionary in OBJECTS.
+//
+// With binary set the file is "AutoCAD Binary DXF": a 22 byte sentinel, then
+// each group as its code followed by its value, stored as a nul-terminated
+// string, an 8, 16 or 32 bit integer or an 8 byte double depending on the
+// code's range. R12 codes take 1 byte, with 255 escaping a 2 byte code; R2000
+// codes take 2 bytes, little-endian.
+
+#define DXF_BUFFER_SIZE (1 << 20)
+#define DXF_MAX_GROUP 512
+#define DXF_HANDSEED_DIGITS 16
+
+typedef struct {
+    FILE *file;
+    int binary;
+    int r2000;
+    TextBuffer buffer;
+    TextBuffer *out;
+    int failed;
+
+    // R2000 only: the next free handle, the block record that owns the
+    // entities and where the $HANDSEED placeholder sits in the file
+    uint64_t next_handle;
+    uint64_t model_space;
+    long handseed_offset;
+} DxfWriter;
+
+static inline void dxf_flush(DxfWriter *w) {
+    TextBuffer *out = w->out;
+    if (w->file && out->used && fwrite(out->data, 1, out->used, w->file) != out->used) w->failed = 1;
+    out->used = 0;
+}
+
+static inline char *dxf_reserve(DxfWriter *w, size_t size) {
+    if (w->file && w->out->used + size > DXF_BUFFER_SIZE) dxf_flush(w);
+    char *p = text_reserve(w->out, size);
+    if (!p) w->failed = 1;
+    return p;
+}
+
+static inline int dxf_writer_open(DxfWriter *w, const char *path, int binary, int r2000) {
+    memset(w, 0, sizeof(*w));
+    w->binary = binary;
+    w->r2000 = r2000;
+    w->next_handle = 1;
+    w->out = &w->buffer;
+    if (!text_reserve(w->out, DXF_BUFFER_SIZE)) return -1;
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        text_buffer_free(w->out);
+        return -1;
+    }
+    if (binary) {
+        static const char sentinel[22] = "AutoCAD Binary DXF\r\n\x1a";
+        text_append(w->out, sentinel, sizeof(sentinel));
+    }
+    return 0;
+}
+
+// Attaches a writer to a block's buffer instead of a file, encoding like file
+static inline void dxf_writer_attach(DxfWriter *w, TextBuffer *out, const DxfWriter *file) {
+    memset(w, 0, sizeof(*w));
+    w->binary = file->binary;
+    w->r2000 = file->r2000;
+    w->model_space = file->model_space;
+    w->out = out;
+}
+
+// Writes blocks 0..count-1 after everything written so far
+static inline int dxf_write_blocks(DxfWriter *w, BlockWriter *blocks, int count, BlockFormat format, void *ctx) {
+    dxf_flush(w);
+    blocks->file = w->file;
+    if (block_writer_run(blocks, count, format, ctx) != 0) w->failed = 1;
+    return w->failed ? -1 : 0;
+}
+
+// Returns 0 when every byte reached the file. An R2000 header's $HANDSEED
+// is filled in here, once every handle has been given out.
+static inline int dxf_writer_close(DxfWriter *w) {
+    dxf_flush(w);
+    if (w->handseed_offset > 0) {
+        char seed[DXF_HANDSEED_DIGITS + 1];
+        snprintf(seed, sizeof(seed), "%0*llX", DXF_HANDSEED_DIGITS, (unsigned long long)w->next_handle);
+        if (fseek(w->file, w->handseed_offset, SEEK_SET) != 0 ||
+            fwrite(seed, 1, DXF_HANDSEED_DIGITS, w->file) != DXF_HANDSEED_DIGITS) {
+            w->failed = 1;
+        }
+    }
+    if (fclose(w->file) != 0) w->failed = 1;
+    text_buffer_free(w->out);
+    return w->failed ? -1 : 0;
+}
+
+static inline char *dxf_code(DxfWriter *w, int code, size_t value_size) {
+    char *p = dxf_reserve(w, value_size + 16);
+    if (!p) return NULL;
+    if (w->binary) {
+        if (!w->r2000 && code < 255) {
+            p[0] = (char)code;
+            return p + 1;
+        }
+        if (!w->r2000) *p++ = (char)0xff;
+        p[0] = (char)(code & 0xff);
+        p[1] = (char)((code >> 8) & 0xff);
+        return p + 2;
+    }
+    int digits = code >= 100 ? 3 : code >= 10 ? 2 : 1;
+    for (int i = digits - 1; i >= 0; --i) {
+        p[i] = (char)('0' + code % 10);
+        code /= 10;
+    }
+    p[digits] = '\n';
+    return p + digits + 1;
+}
+
+static inline void dxf_string(DxfWriter *w, int code, const char *text) {
+    size_t length = strlen(text);
+    if (length > DXF_MAX_GROUP) length = DXF_MAX_GROUP;
+    char *p = dxf_code(w, code, length);
+    if (!p) return;
+    memcpy(p, text, length);
+    p[length] = w->binary ? '\0' : '\n';
+    w->out->used = (size_t)(p + length + 1 - w->out->data);
+}
+
+// ASCII writes the value with the given number of decimals
+static inline void dxf_real(DxfWriter *w, int code, double value, int decimals) {
+    char *p = dxf_code(w, code, NUMFORMAT_SIZE);
+    if (!p) return;
+    if (w->binary) {
+        memcpy(p, &value, sizeof(double));
+        w->out->used = (size_t)(p + sizeof(double) - w->out->data);
+        return;
+    }
+    int length = format_fixed(p, value, decimals);
+    p[length] = '\n';
+    w->out->used = (size_t)(p + length + 1 - w->out->data);
+}
+
+// Codes 90-99 hold 32 bit integers, 280-299 8 bit ones and the other
+// integer codes 16 bit ones
+static inline void dxf_int(DxfWriter *w, int code, int32_t value) {
+    char *p = dxf_code(w, code, 16);
+    if (!p) return;
+    if (w->binary) {
+        size_t size = (code >= 90 && code <= 99) ? 4 : (code >= 280 && code <= 299) ? 1 : 2;
+        for (size_t i = 0; i < size; ++i) p[i] = (char)(((uint32_t)value >> (8 * i)) & 0xff);
+        w->out->used = (size_t)(p + size - w->out->data);
+        return;
+    }
+    int length = snprintf(p, 16, "%d", (int)value);
+    p[length] = '\n';
+    w->out->used = (size_t)(p + length + 1 - w->out->data);
+}
+
+static inline void dxf_handle(DxfWriter *w, int code, uint64_t handle) {
+    char text[DXF_HANDSEED_DIGITS + 1];
+    snprintf(text, sizeof(text), "%llX", (unsigned long long)handle);
+    dxf_string(w, code, text);
+}
+
+// Writes the HEADER section. R12 output keeps it empty, since a file without
+// $ACADVER is read as R12. R2000 output reserves $HANDSEED for
+// dxf_writer_close to fill in and adds the (empty) CLASSES section.
+static inline void dxf_write_header(DxfWriter *w) {
+    dxf_string(w, 0, "SECTION");
+    dxf_string(w, 2, "HEADER");
+    if (w->r2000) {
+        dxf_string(w, 9, "$ACADVER");
+        dxf_string(w, 1, "AC1015");
+        dxf_string(w, 9, "$HANDSEED");
+        char placeholder[DXF_HANDSEED_DIGITS + 1];
+        memset(placeholder, '0', DXF_HANDSEED_DIGITS);
+        placeholder[DXF_HANDSEED_DIGITS] = '\0';
+        dxf_string(w, 5, placeholder);
+        long position = ftell(w->file);
+        if (position < 0) w->failed = 1;
+        else w->handseed_offset = position + (long)w->out->used - (DXF_HANDSEED_DIGITS + 1);
+    }
+    dxf_string(w, 0, "ENDSEC");
+    if (w->r2000) {
+        dxf_string(w, 0, "SECTION");
+        dxf_string(w, 2, "CLASSES");
+        dxf_string(w, 0, "ENDSEC");
+    }
+}
+
+// Starts a symbol table holding count entries and returns its handle
+static inline uint64_t dxf_table(DxfWriter *w, const char *name, int count) {
+    uint64_t handle = w->next_handle++;
+    dxf_string(w, 0, "TABLE");
+    dxf_string(w, 2, name);
+    dxf_handle(w, 5, handle);
+    dxf_handle(w, 330, 0);
+    dxf_string(w, 100, "AcDbSymbolTable");
+    dxf_int(w, 70, count);
+    return handle;
+}
+
+// Starts a table entry and returns its handle. DIMSTYLE keeps its handle in
+// code 105.
+static inline uint64_t dxf_table_entry(DxfWriter *w, const char *type, uint64_t table, const char *subclass,
+                                       const char *name) {
+    uint64_t handle = w->next_handle++;
+    dxf_string(w, 0, type);
+    dxf_handle(w, strcmp(type, "DIMSTYLE") == 0 ? 105 : 5, handle);
+    dxf_handle(w, 330, table);
+    dxf_string(w, 100, "AcDbSymbolTableRecord");
+    dxf_string(w, 100, subclass);
+    dxf_string(w, 2, name);
+    return handle;
+}
+
+// Writes a layout's empty BLOCK/ENDBLK pair, owned by its block record
+static inline void dxf_layout_block(DxfWriter *w, const char *name, uint64_t record, int paper) {
+    for (int end = 0; end < 2; end++) {
+        dxf_string(w, 0, end ? "ENDBLK" : "BLOCK");
+        dxf_handle(w, 5, w->next_handle++);
+        dxf_handle(w, 330, record);
+        dxf_string(w, 100, "AcDbEntity");
+        if (paper) dxf_int(w, 67, 1);
+        dxf_string(w, 8, "0");
+        if (end) {
+            dxf_string(w, 100, "AcDbBlockEnd");
+            break;
+        }
+        dxf_string(w, 100, "AcDbBlockBegin");
+        dxf_string(w, 2, name);
+        dxf_int(w, 70, 0);
+        dxf_real(w, 10, 0.0, 1);
+        dxf_real(w, 20, 0.0, 1);
+        dxf_real(w, 30, 0.0, 1);
+        dxf_string(w, 3, name);
+        dxf_string(w, 1, "");
+    }
+}
+
+// Writes the TABLES and BLOCKS sections of an R2000 file: the standard
+// linetypes, layer 0, the Standard text and dimension styles, the ACAD
+// application and the model and paper space blocks. Entities written
+// afterwards belong to *Model_Space.
+static inline void dxf_write_tables(DxfWriter *w) {
+    static const char *const empty_tables[3] = { "VPORT", "VIEW", "UCS" };
+    static const char *const linetypes[3] = { "ByBlock", "ByLayer", "Continuous" };
+
+    dxf_string(w, 0, "SECTION");
+    dxf_string(w, 2, "TABLES");
+    for (int i = 0; i < 3; i++) {
+        dxf_table(w, empty_tables[i], 0);
+        dxf_string(w, 0, "ENDTAB");
+    }
+
+    uint64_t table = dxf_table(w, "LTYPE", 3);
+    for (int i = 0; i < 3; i++) {
+        dxf_table_entry(w, "LTYPE", table, "AcDbLinetypeTableRecord", linetypes[i]);
+        dxf_int(w, 70, 0);
+        dxf_string(w, 3, i == 2 ? "Solid line" : "");
+        dxf_int(w, 72, 65);
+        dxf_int(w, 73, 0);
+        dxf_real(w, 40, 0.0, 1);
+    }
+    dxf_string(w, 0, "ENDTAB");
+
+    table = dxf_table(w, "LAYER", 1);
+    dxf_table_entry(w, "LAYER", table, "AcDbLayerTableRecord", "0");
+    dxf_int(w, 70, 0);
+    dxf_int(w, 62, 7);
+    dxf_string(w, 6, "Continuous");
+    dxf_string(w, 0, "ENDTAB");
+
+    table = dxf_table(w, "STYLE", 1);
+    dxf_table_entry(w, "STYLE", table, "AcDbTextStyleTableRecord", "Standard");
+    dxf_int(w, 70, 0);
+    dxf_real(w, 40, 0.0, 1);
+    dxf_real(w, 41, 1.0, 1);
+    dxf_real(w, 50, 0.0, 1);
+    dxf_int(w, 71, 0);
+    dxf_real(w, 42, 0.2, 1);
+    dxf_string(w, 3, "txt");
+    dxf_string(w, 4, "");
+    dxf_string(w, 0, "ENDTAB");
+
+    table = dxf_table(w, "APPID", 1);
+    dxf_table_entry(w, "APPID", table, "AcDbRegAppTableRecord", "ACAD");
+    dxf_int(w, 70, 0);
+    dxf_string(w, 0, "ENDTAB");
+
+    table = dxf_table(w, "DIMSTYLE", 1);
+    dxf_string(w, 100, "AcDbDimStyleTable");
+    dxf_table_entry(w, "DIMSTYLE", table, "AcDbDimStyleTableRecord", "Standard");
+    dxf_int(w, 70, 0);
+    dxf_string(w, 0, "ENDTAB");
+
+    table = dxf_table(w, "BLOCK_RECORD", 2);
+    w->model_space = dxf_table_entry(w, "BLOCK_RECORD", table, "AcDbBlockTableRecord", "*Model_Space");
+    uint64_t paper_space = dxf_table_entry(w, "BLOCK_RECORD", table, "AcDbBlockTableRecord", "*Paper_Space");
+    dxf_string(w, 0, "ENDTAB");
+    dxf_string(w, 0, "ENDSEC");
+
+    dxf_string(w, 0, "SECTION");
+    dxf_string(w, 2, "BLOCKS");
+    dxf_layout_block(w, "*Model_Space", w->model_space, 0);
+    dxf_layout_block(w, "*Paper_Space", paper_space, 1);
+    dxf_string(w, 0, "ENDSEC");
+}
+
+// Starts an entity on layer. R2000 adds its handle, its owner (model space)
+// and the AcDbEntity marker; R12 ignores handle.
+static inline void dxf_entity(DxfWriter *w, const char *type, uint64_t handle, const char *layer) {
+    dxf_string(w, 0, type);
+    if (w->r2000) {
+        dxf_handle(w, 5, handle);
+        dxf_handle(w, 330, w->model_space);
+        dxf_string(w, 100, "AcDbEntity");
+    }
+    dxf_string(w, 8, layer);
+}
+
+// Writes the OBJECTS section of an R2000 file: the root dictionary and the
+// ACAD_GROUP dictionary it must hold
+static inline void dxf_write_objects(DxfWriter *w) {
+    uint64_t root = w->next_handle++, groups = w->next_handle++;
+    dxf_string(w, 0, "SECTION");
+    dxf_string(w, 2, "OBJECTS");
+    dxf_string(w, 0, "DICTIONARY");
+    dxf_handle(w, 5, root);
+    dxf_handle(w, 330, 0);
+    dxf_string(w, 100, "AcDbDictionary");
+    dxf_int(w, 281, 1);
+    dxf_string(w, 3, "ACAD_GROUP");
+    dxf_handle(w, 350, groups);
+    dxf_string(w, 0, "DICTIONARY");
+    dxf_handle(w, 5, groups);
+    dxf_handle(w, 330, root);
+    dxf_string(w, 100, "AcDbDictionary");
+    dxf_int(w, 281, 1);
+    dxf_string(w, 0, "ENDSEC");
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef GROW_H
+#define GROW_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Shared growth for the tools' dynamic arrays. The capacity doubles from
+// GROW_INITIAL until it holds `needed` items, so appending one item at a time
+// costs amortised constant time. On failure the array and its capacity are
+// left as they were.
+
+#define GROW_INITIAL 64
+
+static inline int grow_array(void **items, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return 0;
+    size_t grown = *capacity ? *capacity : GROW_INITIAL;
+    while (grown < needed) {
+        if (grown > SIZE_MAX / 2) return -1;
+        grown *= 2;
+    }
+    if (item_size && grown > SIZE_MAX / item_size) return -1;
+    void *resized = realloc(*items, grown * item_size);
+    if (!resized) return -1;
+    *items = resized;
+    *capacity = grown;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,673 @@
+#ifndef HULL_H
+#define HULL_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "grow.h"
+
+// Streaming convex hull for the lss tools. Points are fed one at a time and
+// only the ones that could still be hull vertices are kept:
+//  - the extreme points seen so far in eight directions (x, y, x+y, x-y) form
+//    an octagon inside the final hull, and any point strictly inside it is
+//    dropped straight away (Akl-Toussaint culling);
+//  - when the kept points fill the buffer they are reduced to their own hull.
+// Memory therefore follows the size of the hull rather than of the survey.
+// The result is the same as running the monotone chain over every point.
+
+#define HULL_CANDIDATES 65536
+#define HULL_REFRESH 1024
+
+typedef struct {
+    double x, y;
+} HullPoint;
+
+typedef struct {
+    HullPoint *points;
+    HullPoint *scratch;
+    size_t count;
+    size_t capacity;
+    size_t total;
+    HullPoint extreme[8];
+    HullPoint octagon[8];
+    int octagon_size;
+    size_t since_refresh;
+} HullBuilder;
+
+static inline int hull_compare(const void *a, const void *b) {
+    const HullPoint *p1 = (const HullPoint *)a;
+    const HullPoint *p2 = (const HullPoint *)b;
+    if (p1->x != p2->x)
+        return (p1->x > p2->x) - (p1->x < p2->x);
+    return (p1->y > p2->y) - (p1->y < p2->y);
+}
+
+static inline double hull_cross(HullPoint o, HullPoint a, HullPoint b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Andrew's monotone chain over points[0..n), counter-clockwise from the
+// lowest-x point with collinear points removed. out needs room for n + 1.
+// Returns the number of hull vertices. points is sorted in place.
+static inline size_t hull_monotone_chain(HullPoint *points, size_t n, HullPoint *out) {
+    if (n == 0) return 0;
+    qsort(points, n, sizeof(HullPoint), hull_compare);
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        while (k >= 2 && hull_cross(out[k - 2], out[k - 1], points[i]) <= 0)
+            k--;
+        out[k++] = points[i];
+    }
+
+    size_t t = k + 1;
+    for (size_t i = n - 1; i-- > 0;) {
+        while (k >= t && hull_cross(out[k - 2], out[k - 1], points[i]) <= 0)
+            k--;
+        out[k++] = points[i];
+    }
+    return k - 1;
+}
+
+static inline int hull_init(HullBuilder *builder) {
+    memset(builder, 0, sizeof(*builder));
+    builder->capacity = HULL_CANDIDATES;
+    builder->points = malloc(builder->capacity * sizeof(HullPoint));
+    builder->scratch = malloc((builder->capacity + 1) * sizeof(HullPoint));
+    if (!builder->points || !builder->scratch) {
+        free(builder->points);
+        free(builder->scratch);
+        builder->points = builder->scratch = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void hull_free(HullBuilder *builder) {
+    free(builder->points);
+    free(builder->scratch);
+    builder->points = builder->scratch = NULL;
+}
+
+// Rebuilds the culling octagon from the current extremes, in counter-clockwise
+// order and without repeated corners.
+static inline void hull_refresh(HullBuilder *builder) {
+    // min y, max x-y, max x, max x+y, max y, min x-y, min x, min x+y
+    static const int order[8] = { 2, 7, 1, 5, 3, 6, 0, 4 };
+    int size = 0;
+    for (int i = 0; i < 8; i++) {
+        HullPoint p = builder->extreme[order[i]];
+        if (size > 0 && p.x == builder->octagon[size - 1].x && p.y == builder->octagon[size - 1].y) continue;
+        builder->octagon[size++] = p;
+    }
+    if (size > 1 && builder->octagon[0].x == builder->octagon[size - 1].x &&
+        builder->octagon[0].y == builder->octagon[size - 1].y) {
+        size--;
+    }
+    builder->octagon_size = size;
+    builder->since_refresh = 0;
+}
+
+static inline int hull_inside_octagon(const HullBuilder *builder, HullPoint p) {
+    int size = builder->octagon_size;
+    if (size < 3) return 0;
+    for (int i = 0; i < size; i++) {
+        HullPoint a = builder->octagon[i];
+        HullPoint b = builder->octagon[(i + 1) % size];
+        if (hull_cross(a, b, p) <= 0) return 0;
+    }
+    return 1;
+}
+
+// Reduces the kept points to their hull, growing the buffer if the hull
+// itself nearly fills it. Returns -1 on allocation failure.
+static inline int hull_compact(HullBuilder *builder) {
+    size_t k = hull_monotone_chain(builder->points, builder->count, builder->scratch);
+    memcpy(builder->points, builder->scratch, k * sizeof(HullPoint));
+    builder->count = k;
+
+    if (builder->count > builder->capacity / 2) {
+        size_t capacity = builder->capacity * 2;
+        HullPoint *points = realloc(builder->points, capacity * sizeof(HullPoint));
+        if (!points) return -1;
+        builder->points = points;
+        HullPoint *scratch = realloc(builder->scratch, (capacity + 1) * sizeof(HullPoint));
+        if (!scratch) return -1;
+        builder->scratch = scratch;
+        builder->capacity = capacity;
+    }
+    hull_refresh(builder);
+    return 0;
+}
+
+// Returns 0, or -1 on allocation failure.
+static inline int hull_add(HullBuilder *builder, double x, double y) {
+    HullPoint p = { x, y };
+    HullPoint *e = builder->extreme;
+
+    if (builder->total++ == 0) {
+        for (int i = 0; i < 8; i++) e[i] = p;
+        builder->points[builder->count++] = p;
+        return 0;
+    }
+    if (hull_inside_octagon(builder, p)) return 0;
+
+    if (x < e[0].x) e[0] = p;
+    if (x > e[1].x) e[1] = p;
+    if (y < e[2].y) e[2] = p;
+    if (y > e[3].y) e[3] = p;
+    if (x + y < e[4].x + e[4].y) e[4] = p;
+    if (x + y > e[5].x + e[5].y) e[5] = p;
+    if (x - y < e[6].x - e[6].y) e[6] = p;
+    if (x - y > e[7].x - e[7].y) e[7] = p;
+
+    builder->points[builder->count++] = p;
+    if (builder->count == builder->capacity) return hull_compact(builder);
+    if (++builder->since_refresh == HULL_REFRESH) hull_refresh(builder);
+    return 0;
+}
+
+// Hands back the hull of every point added, in the same order the monotone
+// chain gives. The caller frees *hull. Returns -1 on allocation failure.
+static inline int hull_finish(HullBuilder *builder, HullPoint **hull, int *hull_size) {
+    HullPoint *out = malloc((builder->count + 1) * sizeof(HullPoint));
+    if (!out) return -1;
+    *hull_size = (int)hull_monotone_chain(builder->points, builder->count, out);
+    *hull = out;
+    return 0;
+}
+
+// Concave boundary (alpha shape). The points are snapped to a fixed integer
+// grid, visited cell by cell along a serpentine grid order and inserted into a
+// Delaunay triangulation (Bowyer-Watson, walking from the previous triangle),
+// which keeps the work close to linear. The shape is the union of the
+// triangles whose circumradius is at most alpha; its boundary is traced into
+// counter-clockwise outer rings and clockwise holes.
+//
+// Orientation and in-circle tests are exact on the snapped coordinates: the
+// data spans at most 2^26 grid units (1 mm, or coarser on very large sites)
+// and the enclosing triangle 2^30, so coordinate differences fit in 31 bits,
+// 2x2 determinants and squared lengths in 63 and the in-circle determinant, a
+// sum of three of their products, in 128. Compilers without __int128 (MSVC,
+// 32-bit MinGW) sum the products in a pair of 64 bit words instead.
+
+#define HULL_GRID_SPAN (1 << 26)
+#define HULL_SUPER_SPAN (1 << 28)
+#define HULL_MIN_QUANTUM 0.001
+
+typedef struct {
+    int64_t key;
+    int32_t qx, qy;
+    double x, y;
+} HullSite;
+
+typedef struct {
+    int v[3];
+    int n[3]; // n[i] is the triangle across the edge opposite v[i], or -1
+} HullTriangle;
+
+typedef struct {
+    int a, b;
+    int outside;
+} HullCavityEdge;
+
+typedef struct {
+    HullSite *sites;
+    size_t site_count;
+    HullTriangle *tris;
+    uint32_t *marks;
+    size_t tri_count;
+    size_t tri_capacity;
+    int *cavity;
+    size_t cavity_capacity;
+    HullCavityEdge *edges;
+    size_t edge_capacity;
+} HullMesh;
+
+// Concave boundary rings. Ring r holds points[start[r]..start[r + 1]) without
+// repeating its first point; parent[r] is -1 for outer rings and the index of
+// the enclosing outer ring for holes.
+typedef struct {
+    HullPoint *points;
+    size_t *start;
+    int *parent;
+    size_t ring_count;
+} HullRings;
+
+static inline int64_t hull_orient(const HullSite *s, int a, int b, int c) {
+    int64_t abx = (int64_t)s[b].qx - s[a].qx, aby = (int64_t)s[b].qy - s[a].qy;
+    int64_t acx = (int64_t)s[c].qx - s[a].qx, acy = (int64_t)s[c].qy - s[a].qy;
+    return abx * acy - aby * acx;
+}
+
+#ifdef __SIZEOF_INT128__
+// Sign of a * b + c * d + e * f
+static inline int hull_product_sum_sign(int64_t a, int64_t b, int64_t c, int64_t d, int64_t e, int64_t f) {
+    __int128 sum = (__int128)a * b + (__int128)c * d + (__int128)e * f;
+    return (sum > 0) - (sum < 0);
+}
+#else
+// Two's complement 128 bit integer
+typedef struct {
+    uint64_t low, high;
+} HullWide;
+
+static inline HullWide hull_wide_product(int64_t a, int64_t b) {
+    uint64_t ua = a < 0 ? 0 - (uint64_t)a : (uint64_t)a;
+    uint64_t ub = b < 0 ? 0 - (uint64_t)b : (uint64_t)b;
+    uint64_t a0 = ua & 0xffffffffu, a1 = ua >> 32, b0 = ub & 0xffffffffu, b1 = ub >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t middle = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+    HullWide r;
+    r.low = (middle << 32) | (p00 & 0xffffffffu);
+    r.high = p11 + (p01 >> 32) + (p10 >> 32) + (middle >> 32);
+    if ((a < 0) != (b < 0)) {
+        r.low = ~r.low + 1;
+        r.high = ~r.high + (r.low == 0);
+    }
+    return r;
+}
+
+static inline HullWide hull_wide_add(HullWide a, HullWide b) {
+    HullWide r;
+    r.low = a.low + b.low;
+    r.high = a.high + b.high + (r.low < a.low);
+    return r;
+}
+
+// Sign of a * b + c * d + e * f
+static inline int hull_product_sum_sign(int64_t a, int64_t b, int64_t c, int64_t d, int64_t e, int64_t f) {
+    HullWide sum = hull_wide_add(hull_wide_add(hull_wide_product(a, b), hull_wide_product(c, d)), hull_wide_product(e, f));
+    if (sum.high >> 63) return -1;
+    return (sum.high | sum.low) != 0;
+}
+#endif
+
+// Positive when d lies strictly inside the circle through the counter-clockwise
+// triangle a, b, c.
+static inline int hull_incircle(const HullSite *s, int a, int b, int c, int d) {
+    int64_t adx = (int64_t)s[a].qx - s[d].qx, ady = (int64_t)s[a].qy - s[d].qy;
+    int64_t bdx = (int64_t)s[b].qx - s[d].qx, bdy = (int64_t)s[b].qy - s[d].qy;
+    int64_t cdx = (int64_t)s[c].qx - s[d].qx, cdy = (int64_t)s[c].qy - s[d].qy;
+    int64_t alift = adx * adx + ady * ady;
+    int64_t blift = bdx * bdx + bdy * bdy;
+    int64_t clift = cdx * cdx + cdy * cdy;
+    return hull_product_sum_sign(alift, bdx * cdy - cdx * bdy, blift, cdx * ady - adx * cdy,
+                                 clift, adx * bdy - bdx * ady);
+}
+
+// Walks from triangle t towards site p and returns the triangle holding it.
+static inline int hull_locate(const HullMesh *mesh, int t, int p) {
+    for (;;) {
+        const HullTriangle *tri = &mesh->tris[t];
+        int moved = 0;
+        for (int i = 0; i < 3; i++) {
+            if (hull_orient(mesh->sites, tri->v[(i + 1) % 3], tri->v[(i + 2) % 3], p) < 0) {
+                t = tri->n[i];
+                moved = 1;
+                break;
+            }
+        }
+        if (!moved) return t;
+    }
+}
+
+// Inserts site p: removes every triangle whose circumcircle holds p and fans
+// the cavity out from p. *last is the triangle to start the next walk from.
+// Returns -1 on allocation failure.
+static inline int hull_mesh_insert(HullMesh *mesh, int p, int *last) {
+    HullSite *s = mesh->sites;
+    uint32_t inside = 2u * (uint32_t)p + 2u;
+    uint32_t outside = inside + 1u;
+
+    int t = hull_locate(mesh, *last, p);
+    size_t cavity_count = 0, edge_count = 0;
+    if (grow_array((void **)&mesh->cavity, &mesh->cavity_capacity, 1, sizeof(int)) != 0) return -1;
+    mesh->cavity[cavity_count++] = t;
+    mesh->marks[t] = inside;
+
+    for (size_t c = 0; c < cavity_count; c++) {
+        int ct = mesh->cavity[c];
+        for (int i = 0; i < 3; i++) {
+            HullTriangle *tri = &mesh->tris[ct];
+            int nb = tri->n[i];
+            if (nb >= 0 && mesh->marks[nb] == inside) continue;
+            if (nb >= 0 && mesh->marks[nb] != outside) {
+                const HullTriangle *other = &mesh->tris[nb];
+                if (hull_incircle(s, other->v[0], other->v[1], other->v[2], p) > 0) {
+                    if (grow_array((void **)&mesh->cavity, &mesh->cavity_capacity, cavity_count + 1, sizeof(int)) != 0)
+                        return -1;
+                    mesh->marks[nb] = inside;
+                    mesh->cavity[cavity_count++] = nb;
+                    continue;
+                }
+                mesh->marks[nb] = outside;
+            }
+            if (grow_array((void **)&mesh->edges, &mesh->edge_capacity, edge_count + 1, sizeof(HullCavityEdge)) != 0)
+                return -1;
+            HullCavityEdge *edge = &mesh->edges[edge_count++];
+            edge->a = tri->v[(i + 1) % 3];
+            edge->b = tri->v[(i + 2) % 3];
+            edge->outside = nb;
+        }
+    }
+
+    // The new triangles reuse the cavity's slots first
+    if (grow_array((void **)&mesh->cavity, &mesh->cavity_capacity, edge_count, sizeof(int)) != 0) return -1;
+    for (size_t e = cavity_count; e < edge_count; e++) {
+        if (mesh->tri_count == mesh->tri_capacity) return -1;
+        mesh->marks[mesh->tri_count] = 0;
+        mesh->cavity[e] = (int)mesh->tri_count++;
+    }
+
+    for (size_t e = 0; e < edge_count; e++) {
+        HullCavityEdge *edge = &mesh->edges[e];
+        int slot = mesh->cavity[e];
+        HullTriangle *tri = &mesh->tris[slot];
+        tri->v[0] = edge->a;
+        tri->v[1] = edge->b;
+        tri->v[2] = p;
+        tri->n[2] = edge->outside;
+        if (edge->outside >= 0) {
+            HullTriangle *other = &mesh->tris[edge->outside];
+            for (int j = 0; j < 3; j++) {
+                if (other->v[(j + 1) % 3] == edge->b && other->v[(j + 2) % 3] == edge->a) other->n[j] = slot;
+            }
+        }
+    }
+    for (size_t e = 0; e < edge_count; e++) {
+        for (size_t f = 0; f < edge_count; f++) {
+            if (mesh->edges[f].a == mesh->edges[e].b) {
+                mesh->tris[mesh->cavity[e]].n[0] = mesh->cavity[f];
+                mesh->tris[mesh->cavity[f]].n[1] = mesh->cavity[e];
+                break;
+            }
+        }
+    }
+
+    *last = mesh->cavity[0];
+    return 0;
+}
+
+static inline int hull_site_compare(const void *a, const void *b) {
+    const HullSite *s1 = (const HullSite *)a;
+    const HullSite *s2 = (const HullSite *)b;
+    if (s1->key != s2->key) return (s1->key > s2->key) - (s1->key < s2->key);
+    if (s1->qx != s2->qx) return (s1->qx > s2->qx) - (s1->qx < s2->qx);
+    return (s1->qy > s2->qy) - (s1->qy < s2->qy);
+}
+
+static inline void hull_mesh_free(HullMesh *mesh) {
+    free(mesh->sites);
+    free(mesh->tris);
+    free(mesh->marks);
+    free(mesh->cavity);
+    free(mesh->edges);
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+// Builds the Delaunay triangulation of points[0..n). The last three sites are
+// the corners of the enclosing triangle. Returns -1 on allocation failure.
+static inline int hull_mesh_build(HullMesh *mesh, const HullPoint *points, size_t n) {
+    memset(mesh, 0, sizeof(*mesh));
+
+    double min_x = points[0].x, max_x = points[0].x, min_y = points[0].y, max_y = points[0].y;
+    for (size_t i = 1; i < n; i++) {
+        if (points[i].x < min_x) min_x = points[i].x;
+        if (points[i].x > max_x) max_x = points[i].x;
+        if (points[i].y < min_y) min_y = points[i].y;
+        if (points[i].y > max_y) max_y = points[i].y;
+    }
+    double span = (max_x - min_x > max_y - min_y) ? max_x - min_x : max_y - min_y;
+    double quantum = span / HULL_GRID_SPAN;
+    if (quantum < HULL_MIN_QUANTUM) quantum = HULL_MIN_QUANTUM;
+
+    mesh->sites = malloc((n + 3) * sizeof(HullSite));
+    if (!mesh->sites) return -1;
+    int64_t max_q = 0;
+    for (size_t i = 0; i < n; i++) {
+        HullSite *site = &mesh->sites[i];
+        site->qx = (int32_t)llround((points[i].x - min_x) / quantum);
+        site->qy = (int32_t)llround((points[i].y - min_y) / quantum);
+        site->x = points[i].x;
+        site->y = points[i].y;
+        if (site->qx > max_q) max_q = site->qx;
+        if (site->qy > max_q) max_q = site->qy;
+    }
+
+    // Sort into grid cells of about eight points each, then drop duplicates
+    int64_t columns = (int64_t)sqrt((double)n / 8.0) + 1;
+    int64_t cell_size = max_q / columns + 1;
+    for (size_t i = 0; i < n; i++) {
+        HullSite *site = &mesh->sites[i];
+        int64_t row = site->qy / cell_size;
+        int64_t column = site->qx / cell_size;
+        if (row & 1) column = columns - 1 - column;
+        site->key = row * columns + column;
+    }
+    qsort(mesh->sites, n, sizeof(HullSite), hull_site_compare);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique > 0 && mesh->sites[i].qx == mesh->sites[unique - 1].qx && mesh->sites[i].qy == mesh->sites[unique - 1].qy)
+            continue;
+        mesh->sites[unique++] = mesh->sites[i];
+    }
+    mesh->site_count = unique;
+
+    HullSite *corner = &mesh->sites[unique];
+    corner[0].qx = -HULL_SUPER_SPAN;
+    corner[0].qy = -HULL_SUPER_SPAN;
+    corner[1].qx = 2 * HULL_SUPER_SPAN;
+    corner[1].qy = -HULL_SUPER_SPAN;
+    corner[2].qx = -HULL_SUPER_SPAN;
+    corner[2].qy = 2 * HULL_SUPER_SPAN;
+    for (int i = 0; i < 3; i++) {
+        corner[i].x = min_x + corner[i].qx * quantum;
+        corner[i].y = min_y + corner[i].qy * quantum;
+    }
+
+    mesh->tri_capacity = 2 * unique + 2;
+    mesh->tris = malloc(mesh->tri_capacity * sizeof(HullTriangle));
+    mesh->marks = malloc(mesh->tri_capacity * sizeof(uint32_t));
+    if (!mesh->tris || !mesh->marks) {
+        hull_mesh_free(mesh);
+        return -1;
+    }
+    HullTriangle first = { { (int)unique, (int)unique + 1, (int)unique + 2 }, { -1, -1, -1 } };
+    mesh->tris[0] = first;
+    mesh->marks[0] = 0;
+    mesh->tri_count = 1;
+
+    int last = 0;
+    for (size_t i = 0; i < unique; i++) {
+        if (hull_mesh_insert(mesh, (int)i, &last) != 0) {
+            hull_mesh_free(mesh);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline double hull_circumradius(const HullSite *a, const HullSite *b, const HullSite *c) {
+    double ab = hypot(b->x - a->x, b->y - a->y);
+    double bc = hypot(c->x - b->x, c->y - b->y);
+    double ca = hypot(a->x - c->x, a->y - c->y);
+    double area2 = fabs((b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x));
+    if (area2 == 0.0) return INFINITY;
+    return ab * bc * ca / (2.0 * area2);
+}
+
+static inline int hull_ring_contains(const HullRings *rings, size_t r, HullPoint p) {
+    int inside = 0;
+    size_t first = rings->start[r], end = rings->start[r + 1];
+    for (size_t i = first, j = end - 1; i < end; j = i++) {
+        HullPoint a = rings->points[i], b = rings->points[j];
+        if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x) inside = !inside;
+    }
+    return inside;
+}
+
+static inline double hull_ring_area(const HullRings *rings, size_t r) {
+    double area = 0.0;
+    size_t first = rings->start[r], end = rings->start[r + 1];
+    for (size_t i = first, j = end - 1; i < end; j = i++) {
+        area += (rings->points[j].x - rings->points[i].x) * (rings->points[j].y + rings->points[i].y);
+    }
+    return area / 2.0;
+}
+
+static inline void hull_rings_free(HullRings *rings) {
+    free(rings->points);
+    free(rings->start);
+    free(rings->parent);
+    memset(rings, 0, sizeof(*rings));
+}
+
+// Traces the alpha shape of points[0..n) into rings. Holes are left out unless
+// keep_holes is set. Returns 0, -1 on allocation failure, or 1 when no
+// triangle fits inside alpha.
+static inline int hull_concave(const HullPoint *points, size_t n, double alpha, int keep_holes, HullRings *rings) {
+    memset(rings, 0, sizeof(*rings));
+    HullMesh mesh;
+    if (hull_mesh_build(&mesh, points, n) != 0) return -1;
+
+    size_t tri_count = mesh.tri_count;
+    int real = (int)mesh.site_count;
+    int *component = malloc(tri_count * sizeof(int));
+    unsigned char *visited = calloc(tri_count, 1);
+    int *stack = malloc(tri_count * sizeof(int));
+    int *ring_component = NULL;
+    size_t point_capacity = 0, start_capacity = 0, component_capacity = 0;
+    int status = 0;
+    if (!component || !visited || !stack) {
+        status = -1;
+        goto done;
+    }
+
+    // Keep the triangles between real sites that fit within alpha
+    size_t kept = 0;
+    for (size_t t = 0; t < tri_count; t++) {
+        const HullTriangle *tri = &mesh.tris[t];
+        component[t] = -2;
+        if (tri->v[0] >= real || tri->v[1] >= real || tri->v[2] >= real) continue;
+        if (hull_circumradius(&mesh.sites[tri->v[0]], &mesh.sites[tri->v[1]], &mesh.sites[tri->v[2]]) > alpha) continue;
+        component[t] = -1;
+        kept++;
+    }
+    if (kept == 0) {
+        status = 1;
+        goto done;
+    }
+
+    // Number the edge-connected groups of kept triangles
+    int component_count = 0;
+    for (size_t t = 0; t < tri_count; t++) {
+        if (component[t] != -1) continue;
+        size_t depth = 0;
+        stack[depth++] = (int)t;
+        component[t] = component_count;
+        while (depth > 0) {
+            const HullTriangle *tri = &mesh.tris[stack[--depth]];
+            for (int i = 0; i < 3; i++) {
+                int nb = tri->n[i];
+                if (nb >= 0 && component[nb] == -1) {
+                    component[nb] = component_count;
+                    stack[depth++] = nb;
+                }
+            }
+        }
+        component_count++;
+    }
+
+    // Follow every boundary edge (kept triangle on its left) around the shape.
+    // At each vertex the walk turns through the kept triangles around it, so
+    // shapes that only touch at a vertex come out as separate rings.
+    size_t point_count = 0;
+    for (size_t t0 = 0; t0 < tri_count; t0++) {
+        if (component[t0] < 0) continue;
+        for (int j0 = 0; j0 < 3; j0++) {
+            int nb = mesh.tris[t0].n[j0];
+            if ((nb >= 0 && component[nb] >= 0) || (visited[t0] & (1 << j0))) continue;
+
+            if (grow_array((void **)&rings->start, &start_capacity, rings->ring_count + 2, sizeof(size_t)) != 0 ||
+                grow_array((void **)&ring_component, &component_capacity, rings->ring_count + 1, sizeof(int)) != 0) {
+                status = -1;
+                goto done;
+            }
+            rings->start[rings->ring_count] = point_count;
+            ring_component[rings->ring_count] = component[t0];
+
+            int t = (int)t0, j = j0;
+            do {
+                visited[t] |= (unsigned char)(1 << j);
+                const HullSite *site = &mesh.sites[mesh.tris[t].v[(j + 1) % 3]];
+                if (grow_array((void **)&rings->points, &point_capacity, point_count + 1, sizeof(HullPoint)) != 0) {
+                    status = -1;
+                    goto done;
+                }
+                rings->points[point_count].x = site->x;
+                rings->points[point_count].y = site->y;
+                point_count++;
+
+                int pivot = mesh.tris[t].v[(j + 2) % 3];
+                j = (j + 1) % 3;
+                for (;;) {
+                    int next = mesh.tris[t].n[j];
+                    if (next < 0 || component[next] < 0) break;
+                    t = next;
+                    int k = 0;
+                    while (mesh.tris[t].v[k] != pivot) k++;
+                    j = (k + 2) % 3;
+                }
+            } while (t != (int)t0 || j != j0);
+            rings->ring_count++;
+        }
+    }
+    rings->start[rings->ring_count] = point_count;
+
+    rings->parent = malloc(rings->ring_count * sizeof(int));
+    if (!rings->parent) {
+        status = -1;
+        goto done;
+    }
+
+    // Holes belong to the outer ring of their own group of triangles
+    for (size_t r = 0; r < rings->ring_count; r++) {
+        rings->parent[r] = -1;
+        if (hull_ring_area(rings, r) >= 0.0) continue;
+        HullPoint probe = rings->points[rings->start[r]];
+        for (size_t o = 0; o < rings->ring_count; o++) {
+            if (ring_component[o] != ring_component[r] || hull_ring_area(rings, o) < 0.0) continue;
+            rings->parent[r] = (int)o;
+            if (hull_ring_contains(rings, o, probe)) break;
+        }
+    }
+
+    if (!keep_holes) {
+        size_t kept_rings = 0, kept_points = 0;
+        for (size_t r = 0; r < rings->ring_count; r++) {
+            if (rings->parent[r] >= 0) continue;
+            size_t first = rings->start[r], length = rings->start[r + 1] - first;
+            memmove(&rings->points[kept_points], &rings->points[first], length * sizeof(HullPoint));
+            rings->start[kept_rings] = kept_points;
+            rings->parent[kept_rings] = -1;
+            kept_rings++;
+            kept_points += length;
+        }
+        rings->start[kept_rings] = kept_points;
+        rings->ring_count = kept_rings;
+    }
+
+done:
+    free(ring_component);
+    free(component);
+    free(visited);
+    free(stack);
+    hull_mesh_free(&mesh);
+    if (status != 0) hull_rings_free(rings);
+    return status;
+}
+
+#endif
@@ -0,0 +1,789 @@
+#ifndef LASWRITER_H
+#define LASWRITER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#include "deflate.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LAS_HAVE_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LAS_HAVE_SSE2 1
+#endif
+
+// Shared LAS writer for asc2las and lss2las. Points are packed into a large
+// in-memory batch and written out in multi-megabyte blocks instead of one
+// fwrite per point. The header is written as a placeholder on open and
+// rewritten at close, once the point count, return counts and bounds are
+// known. Bounds come from the stored integer coordinates, so they always
+// match the points exactly.
+//
+// Output is LAS 1.2 point format 2 by default. With las14 set it is LAS 1.4
+// with point format 6 (format 7 when colouring), 64-bit point counts and the
+// legacy 32-bit counts left at zero as the specification asks.
+//
+// Coordinates are stored relative to x/y/z offsets rounded down to
+// LAS_OFFSET_STEP, so the int32 records cannot overflow at large eastings and
+// northings. Tools that know their extent up front pass its lower bounds to
+// las_set_offsets before writing, so the offsets do not depend on which points
+// come first; otherwise they are taken from the first block of points.
+// las_write_points quantizes whole coordinate columns at a time with an AVX2
+// or SSE2 kernel (picked at run time, with a scalar fallback); every path
+// rounds exactly like las_quantize, so the output does not depend on the CPU.
+//
+// Elevation colouring (-elev_rgb) is deferred to close as well: the global Z
+// range is only known once every point has been seen, so the points are
+// written uncoloured and the point records are then read back a batch at a
+// time, coloured from a lookup table and written in place.
+//
+// With compress set the point records are stored compressed instead (see
+// README, "Compressed point files"): the standard header with bit 7 of the
+// point format set, an 8 byte offset of the chunk table, then chunks of up to
+// LAS_CHUNK_POINTS points. Each chunk is delta coded per field, split into
+// byte planes and DEFLATE compressed on its own, so chunks are encoded in
+// parallel and a reader can seek straight to any chunk through the table.
+
+#define LAS_BATCH_BYTES (8 << 20)
+#define LAS_COLOUR_LUT_SIZE 4096
+#define LAS_CHUNK_POINTS 50000
+#define LAS_MIN_BATCH_CHUNKS 4
+#define LAS_DEFLATE_LEVEL 3
+#define LAS_COMPRESSED_FLAG 0x80
+#define LAS_CHUNK_TABLE_VERSION 1
+#define LAS_OFFSET_STEP 1000.0
+#define LAS_MAX_RECORD_LENGTH 36
+#define LAS_MAX_FIELDS 14
+#define LAS_QUANTIZE_BLOCK 1024
+
+#pragma pack(push, 1)
+
+typedef struct {
+    char file_signature[4];
+    uint16_t file_source_id;
+    uint16_t global_encoding;
+    uint32_t project_id_1;
+    uint16_t project_id_2;
+    uint16_t project_id_3;
+    uint8_t project_id_4[8];
+    uint8_t version_major;
+    uint8_t version_minor;
+    char system_identifier[32];
+    char generating_software[32];
+    uint16_t file_creation_day;
+    uint16_t file_creation_year;
+    uint16_t header_size;
+    uint32_t offset_to_point_data;
+    uint32_t num_variable_length_recs;
+    uint8_t point_data_format_id;
+    uint16_t point_data_record_length;
+    uint32_t num_point_records;
+    uint32_t num_points_by_return[5];
+    double x_scale_factor;
+    double y_scale_factor;
+    double z_scale_factor;
+    double x_offset;
+    double y_offset;
+    double z_offset;
+    double max_x;
+    double min_x;
+    double max_y;
+    double min_y;
+    double max_z;
+    double min_z;
+} LASHeader;
+
+// Fields LAS 1.4 appends to the 1.2 header
+typedef struct {
+    uint64_t start_of_waveform_data;
+    uint64_t start_of_first_evlr;
+    uint32_t num_evlrs;
+    uint64_t num_point_records;
+    uint64_t num_points_by_return[15];
+} LASHeader14Fields;
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    uint16_t intensity;
+    uint8_t return_number : 3;
+    uint8_t number_of_returns : 3;
+    uint8_t scan_direction_flag : 1;
+    uint8_t edge_of_flight_line : 1;
+    uint8_t classification;
+    int8_t scan_angle_rank;
+    uint8_t user_data;
+    uint16_t point_source_id;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+} LASPointFormat2;
+
+// Point format 7; format 6 is the same record without the colour
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    uint16_t intensity;
+    uint8_t return_number : 4;
+    uint8_t number_of_returns : 4;
+    uint8_t classification_flags : 4;
+    uint8_t scanner_channel : 2;
+    uint8_t scan_direction_flag : 1;
+    uint8_t edge_of_flight_line : 1;
+    uint8_t classification;
+    uint8_t user_data;
+    int16_t scan_angle;
+    uint16_t point_source_id;
+    double gps_time;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+} LASPointFormat7;
+
+#pragma pack(pop)
+
+// Per-point values that are the same for every point a tool writes
+typedef struct {
+    uint16_t intensity;
+    uint8_t classification;
+    uint16_t point_source_id;
+} LasPointAttributes;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t byte_count;
+    uint32_t point_count;
+} LasChunkEntry;
+
+// Per-worker scratch for compressing one chunk
+typedef struct {
+    uint8_t *shuffled;
+    uint8_t *encoded;
+    size_t encoded_capacity;
+    size_t encoded_size;
+    uint32_t point_count;
+} LasChunkSlot;
+
+typedef struct {
+    FILE *file;
+    LASHeader header;
+    LASHeader14Fields header14;
+    LasPointAttributes attributes;
+    int las14;
+    int colour_by_elevation;
+    int compress;
+    ThreadPool *pool;
+
+    size_t record_length;
+    uint8_t point_template[LAS_MAX_RECORD_LENGTH];
+    int offsets_set;
+    int32_t min_xyz[3];
+    int32_t max_xyz[3];
+
+    uint8_t *batch;
+    size_t batch_used;
+    size_t batch_capacity;
+    uint64_t point_count;
+    uint64_t file_offset;
+    FILE *spill;
+    char spill_path[300];
+    LasChunkSlot *slots;
+    int slot_count;
+    LasChunkEntry *chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    int failed;
+} LasWriter;
+
+static inline void las_free_slots(LasWriter *w) {
+    if (!w->slots) return;
+    for (int i = 0; i < w->slot_count; i++) {
+        free(w->slots[i].shuffled);
+        free(w->slots[i].encoded);
+    }
+    free(w->slots);
+    w->slots = NULL;
+}
+
+// Viridis style ramp, used to fill the colour lookup table
+static inline void viridis_colormap(double normalized, uint16_t *red, uint16_t *green, uint16_t *blue) {
+    double r = 0.0, g = 0.0, b = 0.0;
+    if (normalized < 0.0) normalized = 0.0;
+    if (normalized > 1.0) normalized = 1.0;
+
+    if (normalized <= 0.25) {
+        r = 0.267 + normalized * 4.0 * (0.282 - 0.267);
+        g = 0.004 + normalized * 4.0 * (0.141 - 0.004);
+        b = 0.329 + normalized * 4.0 * (0.435 - 0.329);
+    } else if (normalized <= 0.5) {
+        normalized = (normalized - 0.25) * 4.0;
+        r = 0.282 + normalized * (0.127 - 0.282);
+        g = 0.141 + normalized * (0.570 - 0.141);
+        b = 0.435 + normalized * (0.704 - 0.435);
+    } else if (normalized <= 0.75) {
+        normalized = (normalized - 0.5) * 4.0;
+        r = 0.127 + normalized * (0.267 - 0.127);
+        g = 0.570 + normalized * (0.678 - 0.570);
+        b = 0.704 + normalized * (0.653 - 0.704);
+    } else {
+        normalized = (normalized - 0.75) * 4.0;
+        r = 0.267 + normalized * (0.993 - 0.267);
+        g = 0.678 + normalized * (0.906 - 0.678);
+        b = 0.653 + normalized * (0.569 - 0.653);
+    }
+
+    *red = (uint16_t)(r * 65535.0);
+    *green = (uint16_t)(g * 65535.0);
+    *blue = (uint16_t)(b * 65535.0);
+}
+
+// Fills in the header fields every file from these tools shares, with 1 cm
+// scales. Version, point format and sizes are set by las_writer_open.
+static inline void las_header_init(LASHeader *header, const char *generating_software) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->file_signature, "LASF", 4);
+    header->version_major = 1;
+    header->version_minor = 2;
+    strncpy(header->system_identifier, "SYSTEM_XYZ", 32);
+    strncpy(header->generating_software, generating_software, 32);
+    header->file_creation_day = 300;
+    header->file_creation_year = 2024;
+    header->x_scale_factor = 0.01;
+    header->y_scale_factor = 0.01;
+    header->z_scale_factor = 0.01;
+}
+
+// Byte widths of the record fields, in order, for the compressed layout.
+// Returns the number of fields.
+static inline int las_record_fields(int point_format, int *widths) {
+    static const int format2[] = { 4, 4, 4, 2, 1, 1, 1, 1, 2, 2, 2, 2 };
+    static const int format7[] = { 4, 4, 4, 2, 1, 1, 1, 1, 2, 2, 8, 2, 2, 2 };
+    if (point_format == 2) {
+        memcpy(widths, format2, sizeof(format2));
+        return 12;
+    }
+    memcpy(widths, format7, sizeof(format7));
+    return point_format == 7 ? 14 : 11;
+}
+
+// Offset of the red/green/blue fields within a record
+static inline size_t las_colour_offset(const LasWriter *w) {
+    return w->header.point_data_format_id == 2 ? 20 : 30;
+}
+
+static inline void las_build_template(LasWriter *w) {
+    memset(w->point_template, 0, sizeof(w->point_template));
+    if (w->las14) {
+        LASPointFormat7 point;
+        memset(&point, 0, sizeof(point));
+        point.intensity = w->attributes.intensity;
+        point.return_number = 1;
+        point.number_of_returns = 1;
+        point.classification = w->attributes.classification;
+        point.point_source_id = w->attributes.point_source_id;
+        memcpy(w->point_template, &point, w->record_length);
+    } else {
+        LASPointFormat2 point;
+        memset(&point, 0, sizeof(point));
+        point.intensity = w->attributes.intensity;
+        point.return_number = 1;
+        point.number_of_returns = 1;
+        point.classification = w->attributes.classification;
+        point.point_source_id = w->attributes.point_source_id;
+        memcpy(w->point_template, &point, w->record_length);
+    }
+}
+
+static inline int las_write_header(LasWriter *w) {
+    if (fwrite(&w->header, sizeof(LASHeader), 1, w->file) != 1) return -1;
+    if (w->las14 && fwrite(&w->header14, sizeof(LASHeader14Fields), 1, w->file) != 1) return -1;
+    return 0;
+}
+
+// Creates the output file and writes the header as a placeholder. Set
+// attributes, las14, colour_by_elevation, compress and pool beforehand.
+// Returns 0, or -1 with errno set.
+static inline int las_writer_open(LasWriter *w, const char *path) {
+    w->batch_used = 0;
+    w->point_count = 0;
+    w->offsets_set = 0;
+    for (int i = 0; i < 3; i++) {
+        w->min_xyz[i] = INT32_MAX;
+        w->max_xyz[i] = INT32_MIN;
+    }
+    w->failed = 0;
+    w->spill = NULL;
+    w->slots = NULL;
+    w->chunks = NULL;
+    w->chunk_count = 0;
+    w->chunk_capacity = 0;
+    memset(&w->header14, 0, sizeof(w->header14));
+
+    size_t header_size = sizeof(LASHeader);
+    if (w->las14) {
+        header_size += sizeof(LASHeader14Fields);
+        w->header.version_minor = 4;
+        w->header.point_data_format_id = w->colour_by_elevation ? 7 : 6;
+        w->record_length = w->colour_by_elevation ? sizeof(LASPointFormat7) : sizeof(LASPointFormat7) - 6;
+        w->header.global_encoding |= 0x10;  // required for point formats 6 and up
+    } else {
+        w->header.version_minor = 2;
+        w->header.point_data_format_id = 2;
+        w->record_length = sizeof(LASPointFormat2);
+    }
+    w->header.header_size = (uint16_t)header_size;
+    w->header.offset_to_point_data = (uint32_t)header_size;
+    w->header.point_data_record_length = (uint16_t)w->record_length;
+    las_build_template(w);
+
+    if (w->compress) {
+        w->slot_count = pool_size(w->pool) * 2;
+        if (w->slot_count < LAS_MIN_BATCH_CHUNKS) w->slot_count = LAS_MIN_BATCH_CHUNKS;
+        size_t chunk_bytes = (size_t)LAS_CHUNK_POINTS * w->record_length;
+        w->batch_capacity = (size_t)w->slot_count * chunk_bytes;
+        w->slots = calloc((size_t)w->slot_count, sizeof(LasChunkSlot));
+        if (!w->slots) {
+            errno = ENOMEM;
+            return -1;
+        }
+        for (int i = 0; i < w->slot_count; i++) {
+            w->slots[i].shuffled = malloc(chunk_bytes);
+            w->slots[i].encoded_capacity = deflate_bound(chunk_bytes);
+            w->slots[i].encoded = malloc(w->slots[i].encoded_capacity);
+            if (!w->slots[i].shuffled || !w->slots[i].encoded) {
+                las_free_slots(w);
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    } else {
+        w->batch_capacity = (LAS_BATCH_BYTES / w->record_length) * w->record_length;
+    }
+
+    w->batch = malloc(w->batch_capacity);
+    if (!w->batch) {
+        las_free_slots(w);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Opened for update so the colouring pass can read the points back
+    w->file = fopen(path, "w+b");
+    if (!w->file) {
+        int saved = errno;
+        free(w->batch);
+        las_free_slots(w);
+        errno = saved;
+        return -1;
+    }
+
+    // Compressed points cannot be coloured in place, so they are kept raw in
+    // a spill file until the Z range is known
+    if (w->compress && w->colour_by_elevation) {
+        snprintf(w->spill_path, sizeof(w->spill_path), "%s.tmp", path);
+        w->spill = fopen(w->spill_path, "w+b");
+        if (!w->spill) {
+            int saved = errno;
+            fclose(w->file);
+            free(w->batch);
+            las_free_slots(w);
+            errno = saved;
+            return -1;
+        }
+    }
+
+    if (las_write_header(w) != 0) w->failed = 1;
+    w->file_offset = header_size;
+    if (w->compress) {
+        uint64_t chunk_table_offset = 0;
+        if (fwrite(&chunk_table_offset, sizeof(chunk_table_offset), 1, w->file) != 1) w->failed = 1;
+        w->file_offset += sizeof(chunk_table_offset);
+    }
+    return 0;
+}
+
+// Delta codes each field of the chunk against the previous point and splits
+// the result into byte planes, so slowly changing fields turn into long runs
+// of identical bytes before DEFLATE sees them.
+static inline void las_shuffle_chunk(const LasWriter *w, const uint8_t *points, size_t count, uint8_t *shuffled) {
+    int widths[LAS_MAX_FIELDS];
+    int field_count = las_record_fields(w->header.point_data_format_id, widths);
+    int field_offset = 0;
+    for (int f = 0; f < field_count; f++) {
+        int width = widths[f];
+        uint64_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t value = 0;
+            memcpy(&value, points + i * w->record_length + field_offset, width);
+            uint64_t delta = value - previous;
+            previous = value;
+            for (int b = 0; b < width; b++) {
+                shuffled[(size_t)(field_offset + b) * count + i] = (uint8_t)(delta >> (8 * b));
+            }
+        }
+        field_offset += width;
+    }
+}
+
+static inline void las_encode_chunk_task(void *ctx, int index) {
+    LasWriter *w = (LasWriter *)ctx;
+    LasChunkSlot *slot = &w->slots[index];
+    size_t chunk_bytes = (size_t)LAS_CHUNK_POINTS * w->record_length;
+    size_t first = (size_t)index * chunk_bytes;
+    size_t bytes = w->batch_used - first;
+    if (bytes > chunk_bytes) bytes = chunk_bytes;
+
+    slot->point_count = (uint32_t)(bytes / w->record_length);
+    las_shuffle_chunk(w, w->batch + first, slot->point_count, slot->shuffled);
+    slot->encoded_size = deflate_compress(slot->shuffled, bytes, slot->encoded, slot->encoded_capacity, LAS_DEFLATE_LEVEL);
+}
+
+// Compresses the batch as consecutive chunks on the pool and appends them to
+// the file in order, recording each one in the chunk table
+static inline void las_compress_batch(LasWriter *w) {
+    size_t chunk_bytes = (size_t)LAS_CHUNK_POINTS * w->record_length;
+    int chunk_total = (int)((w->batch_used + chunk_bytes - 1) / chunk_bytes);
+    pool_run(w->pool, chunk_total, las_encode_chunk_task, w);
+
+    for (int i = 0; i < chunk_total && !w->failed; i++) {
+        LasChunkSlot *slot = &w->slots[i];
+        if (slot->encoded_size == 0) {
+            w->failed = 1;
+            break;
+        }
+        if (w->chunk_count == w->chunk_capacity) {
+            size_t capacity = w->chunk_capacity ? w->chunk_capacity * 2 : 256;
+            LasChunkEntry *chunks = realloc(w->chunks, capacity * sizeof(LasChunkEntry));
+            if (!chunks) {
+                w->failed = 1;
+                break;
+            }
+            w->chunks = chunks;
+            w->chunk_capacity = capacity;
+        }
+        LasChunkEntry *entry = &w->chunks[w->chunk_count++];
+        entry->offset = w->file_offset;
+        entry->byte_count = (uint32_t)slot->encoded_size;
+        entry->point_count = slot->point_count;
+
+        if (fwrite(slot->encoded, 1, slot->encoded_size, w->file) != slot->encoded_size) w->failed = 1;
+        w->file_offset += slot->encoded_size;
+    }
+}
+
+static inline void las_writer_flush(LasWriter *w) {
+    if (w->batch_used == 0) return;
+    if (w->spill) {
+        if (fwrite(w->batch, 1, w->batch_used, w->spill) != w->batch_used) w->failed = 1;
+    } else if (w->compress) {
+        las_compress_batch(w);
+    } else {
+        if (fwrite(w->batch, 1, w->batch_used, w->file) != w->batch_used) w->failed = 1;
+    }
+    w->batch_used = 0;
+}
+
+static inline int32_t las_quantize(double value, double scale, double offset) {
+    return (int32_t)floor((value - offset) / scale + 0.5);
+}
+
+static inline void las_quantize_scalar(const double *values, size_t count, double scale, double offset,
+                                       int32_t *out, int32_t *low, int32_t *high) {
+    for (size_t i = 0; i < count; i++) {
+        int32_t q = las_quantize(values[i], scale, offset);
+        out[i] = q;
+        if (q < *low) *low = q;
+        if (q > *high) *high = q;
+    }
+}
+
+#ifdef LAS_HAVE_AVX2
+__attribute__((target("avx2")))
+static inline void las_quantize_avx2(const double *values, size_t count, double scale, double offset,
+                                     int32_t *out, int32_t *low, int32_t *high) {
+    __m256d vscale = _mm256_set1_pd(scale);
+    __m256d voffset = _mm256_set1_pd(offset);
+    __m256d half = _mm256_set1_pd(0.5);
+    __m128i vlow = _mm_set1_epi32(*low);
+    __m128i vhigh = _mm_set1_epi32(*high);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d t = _mm256_add_pd(_mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(values + i), voffset), vscale), half);
+        __m128i q = _mm256_cvtpd_epi32(_mm256_floor_pd(t));
+        _mm_storeu_si128((__m128i *)(out + i), q);
+        vlow = _mm_min_epi32(vlow, q);
+        vhigh = _mm_max_epi32(vhigh, q);
+    }
+
+    int32_t lanes[2][4];
+    _mm_storeu_si128((__m128i *)lanes[0], vlow);
+    _mm_storeu_si128((__m128i *)lanes[1], vhigh);
+    for (int k = 0; k < 4; k++) {
+        if (lanes[0][k] < *low) *low = lanes[0][k];
+        if (lanes[1][k] > *high) *high = lanes[1][k];
+    }
+    las_quantize_scalar(values + i, count - i, scale, offset, out + i, low, high);
+}
+#endif
+
+#ifdef LAS_HAVE_SSE2
+// SSE2 has no floor, so truncate and step down where that rounded up
+static inline void las_quantize_sse2(const double *values, size_t count, double scale, double offset,
+                                     int32_t *out, int32_t *low, int32_t *high) {
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d voffset = _mm_set1_pd(offset);
+    __m128d half = _mm_set1_pd(0.5);
+    __m128d one = _mm_set1_pd(1.0);
+    __m128i vlow = _mm_set1_epi32(*low);
+    __m128i vhigh = _mm_set1_epi32(*high);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d t = _mm_add_pd(_mm_div_pd(_mm_sub_pd(_mm_loadu_pd(values + i), voffset), vscale), half);
+        __m128d truncated = _mm_cvtepi32_pd(_mm_cvttpd_epi32(t));
+        __m128i q = _mm_cvttpd_epi32(_mm_sub_pd(truncated, _mm_and_pd(_mm_cmplt_pd(t, truncated), one)));
+        _mm_storel_epi64((__m128i *)(out + i), q);
+        __m128i below = _mm_cmplt_epi32(q, vlow);
+        vlow = _mm_or_si128(_mm_and_si128(below, q), _mm_andnot_si128(below, vlow));
+        __m128i above = _mm_cmpgt_epi32(q, vhigh);
+        vhigh = _mm_or_si128(_mm_and_si128(above, q), _mm_andnot_si128(above, vhigh));
+    }
+
+    // Only the low two lanes hold results
+    int32_t lanes[2][4];
+    _mm_storeu_si128((__m128i *)lanes[0], vlow);
+    _mm_storeu_si128((__m128i *)lanes[1], vhigh);
+    for (int k = 0; k < 2; k++) {
+        if (lanes[0][k] < *low) *low = lanes[0][k];
+        if (lanes[1][k] > *high) *high = lanes[1][k];
+    }
+    las_quantize_scalar(values + i, count - i, scale, offset, out + i, low, high);
+}
+#endif
+
+// Quantizes a column of coordinates and widens [*low, *high] to cover them
+static inline void las_quantize_column(const double *values, size_t count, double scale, double offset,
+                                       int32_t *out, int32_t *low, int32_t *high) {
+#ifdef LAS_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        las_quantize_avx2(values, count, scale, offset, out, low, high);
+        return;
+    }
+#endif
+#ifdef LAS_HAVE_SSE2
+    las_quantize_sse2(values, count, scale, offset, out, low, high);
+#else
+    las_quantize_scalar(values, count, scale, offset, out, low, high);
+#endif
+}
+
+// Fixes the offsets from the lower bounds of everything that will be written
+static inline void las_set_offsets(LasWriter *w, double min_x, double min_y, double min_z) {
+    w->header.x_offset = floor(min_x / LAS_OFFSET_STEP) * LAS_OFFSET_STEP;
+    w->header.y_offset = floor(min_y / LAS_OFFSET_STEP) * LAS_OFFSET_STEP;
+    w->header.z_offset = floor(min_z / LAS_OFFSET_STEP) * LAS_OFFSET_STEP;
+    w->offsets_set = 1;
+}
+
+// Without known bounds the offsets come from the first points written
+static inline void las_choose_offsets(LasWriter *w, const double *x, const double *y, const double *z, size_t count) {
+    double low[3] = { x[0], y[0], z[0] };
+    for (size_t i = 1; i < count; i++) {
+        if (x[i] < low[0]) low[0] = x[i];
+        if (y[i] < low[1]) low[1] = y[i];
+        if (z[i] < low[2]) low[2] = z[i];
+    }
+    las_set_offsets(w, low[0], low[1], low[2]);
+}
+
+static inline void las_append_record(LasWriter *w, const int32_t xyz[3]) {
+    if (w->batch_used == w->batch_capacity) las_writer_flush(w);
+    uint8_t *record = w->batch + w->batch_used;
+    memcpy(record, w->point_template, w->record_length);
+    memcpy(record, xyz, 3 * sizeof(int32_t));
+    w->batch_used += w->record_length;
+    w->point_count++;
+}
+
+// Adds one point with the writer's shared attributes
+static inline void las_write_point(LasWriter *w, double x, double y, double z) {
+    if (!w->offsets_set) las_choose_offsets(w, &x, &y, &z, 1);
+
+    int32_t xyz[3] = {
+        las_quantize(x, w->header.x_scale_factor, w->header.x_offset),
+        las_quantize(y, w->header.y_scale_factor, w->header.y_offset),
+        las_quantize(z, w->header.z_scale_factor, w->header.z_offset)
+    };
+    for (int i = 0; i < 3; i++) {
+        if (xyz[i] < w->min_xyz[i]) w->min_xyz[i] = xyz[i];
+        if (xyz[i] > w->max_xyz[i]) w->max_xyz[i] = xyz[i];
+    }
+    las_append_record(w, xyz);
+}
+
+// Adds count points from separate x, y and z columns. Each block of columns
+// is quantized in one pass before the records are packed.
+static inline void las_write_points(LasWriter *w, const double *x, const double *y, const double *z, size_t count) {
+    if (count == 0) return;
+    if (!w->offsets_set) las_choose_offsets(w, x, y, z, count);
+
+    int32_t columns[3][LAS_QUANTIZE_BLOCK];
+    for (size_t done = 0; done < count; done += LAS_QUANTIZE_BLOCK) {
+        size_t n = count - done < LAS_QUANTIZE_BLOCK ? count - done : LAS_QUANTIZE_BLOCK;
+        las_quantize_column(x + done, n, w->header.x_scale_factor, w->header.x_offset, columns[0], &w->min_xyz[0], &w->max_xyz[0]);
+        las_quantize_column(y + done, n, w->header.y_scale_factor, w->header.y_offset, columns[1], &w->min_xyz[1], &w->max_xyz[1]);
+        las_quantize_column(z + done, n, w->header.z_scale_factor, w->header.z_offset, columns[2], &w->min_xyz[2], &w->max_xyz[2]);
+
+        for (size_t i = 0; i < n; i++) {
+            int32_t xyz[3] = { columns[0][i], columns[1][i], columns[2][i] };
+            las_append_record(w, xyz);
+        }
+    }
+}
+
+// Colours every point written so far by its elevation within the final
+// Z range. Points are read back a batch at a time from the output (or the
+// spill file when compressing) and rewritten in place, or handed to the
+// compressor.
+static inline void las_colour_points(LasWriter *w) {
+    uint16_t lut[LAS_COLOUR_LUT_SIZE][3];
+    for (int i = 0; i < LAS_COLOUR_LUT_SIZE; i++) {
+        viridis_colormap((double)i / (LAS_COLOUR_LUT_SIZE - 1), &lut[i][0], &lut[i][1], &lut[i][2]);
+    }
+
+    // Work in the stored integer Z units so no point needs converting back
+    double z_low = w->min_xyz[2];
+    double z_range = (double)w->max_xyz[2] - w->min_xyz[2];
+    double to_index = (z_range > 0.0) ? (LAS_COLOUR_LUT_SIZE - 1) / z_range : 0.0;
+    size_t colour_offset = las_colour_offset(w);
+
+    FILE *source = w->spill ? w->spill : w->file;
+    if (fflush(source) != 0) w->failed = 1;
+    uint64_t offset = w->spill ? 0 : w->header.offset_to_point_data;
+    uint64_t remaining = w->point_count;
+    size_t batch_points = w->batch_capacity / w->record_length;
+
+    while (remaining > 0 && !w->failed) {
+        size_t count = remaining < batch_points ? (size_t)remaining : batch_points;
+        size_t bytes = count * w->record_length;
+        if (fseeko(source, (off_t)offset, SEEK_SET) != 0 || fread(w->batch, 1, bytes, source) != bytes) {
+            w->failed = 1;
+            break;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint8_t *record = w->batch + i * w->record_length;
+            int32_t z;
+            memcpy(&z, record + 8, sizeof(z));
+            int index = (int)((z - z_low) * to_index + 0.5);
+            if (index < 0) index = 0;
+            if (index > LAS_COLOUR_LUT_SIZE - 1) index = LAS_COLOUR_LUT_SIZE - 1;
+            memcpy(record + colour_offset, lut[index], sizeof(lut[index]));
+        }
+
+        if (w->compress) {
+            w->batch_used = bytes;
+            las_compress_batch(w);
+            w->batch_used = 0;
+        } else if (fseeko(source, (off_t)offset, SEEK_SET) != 0 || fwrite(w->batch, 1, bytes, source) != bytes) {
+            w->failed = 1;
+        }
+        offset += bytes;
+        remaining -= count;
+    }
+}
+
+// Appends the chunk table and points the slot after the header at it
+static inline void las_write_chunk_table(LasWriter *w) {
+    uint64_t table_offset = w->file_offset;
+    uint32_t table_header[3] = { LAS_CHUNK_TABLE_VERSION, (uint32_t)w->chunk_count, LAS_CHUNK_POINTS };
+    if (fwrite("LSZT", 1, 4, w->file) != 4) w->failed = 1;
+    if (fwrite(table_header, sizeof(table_header), 1, w->file) != 1) w->failed = 1;
+    for (size_t i = 0; i < w->chunk_count; i++) {
+        LasChunkEntry *entry = &w->chunks[i];
+        if (fwrite(&entry->offset, sizeof(entry->offset), 1, w->file) != 1) w->failed = 1;
+        if (fwrite(&entry->byte_count, sizeof(entry->byte_count), 1, w->file) != 1) w->failed = 1;
+        if (fwrite(&entry->point_count, sizeof(entry->point_count), 1, w->file) != 1) w->failed = 1;
+    }
+
+    if (fseeko(w->file, (off_t)w->header.header_size, SEEK_SET) != 0) w->failed = 1;
+    else if (fwrite(&table_offset, sizeof(table_offset), 1, w->file) != 1) w->failed = 1;
+}
+
+// Point counts and bounds for the final header. Every point is written as a
+// single return, so they all count towards the first return.
+static inline void las_finish_header(LasWriter *w) {
+    if (w->point_count > 0) {
+        w->header.min_x = w->min_xyz[0] * w->header.x_scale_factor + w->header.x_offset;
+        w->header.max_x = w->max_xyz[0] * w->header.x_scale_factor + w->header.x_offset;
+        w->header.min_y = w->min_xyz[1] * w->header.y_scale_factor + w->header.y_offset;
+        w->header.max_y = w->max_xyz[1] * w->header.y_scale_factor + w->header.y_offset;
+        w->header.min_z = w->min_xyz[2] * w->header.z_scale_factor + w->header.z_offset;
+        w->header.max_z = w->max_xyz[2] * w->header.z_scale_factor + w->header.z_offset;
+    }
+
+    if (w->las14) {
+        w->header14.num_point_records = w->point_count;
+        w->header14.num_points_by_return[0] = w->point_count;
+    } else {
+        w->header.num_point_records = (uint32_t)w->point_count;
+        w->header.num_points_by_return[0] = (uint32_t)w->point_count;
+    }
+}
+
+static inline void las_close_spill(LasWriter *w) {
+    if (!w->spill) return;
+    fclose(w->spill);
+    remove(w->spill_path);
+    w->spill = NULL;
+}
+
+// Flushes the remaining points, applies elevation colouring if requested and
+// rewrites the finished header at the start of the file. Returns 0, or -1 if
+// any write failed or a LAS 1.2 file got more points than it can count.
+static inline int las_writer_close(LasWriter *w) {
+    las_writer_flush(w);
+    if (!w->las14 && w->point_count > UINT32_MAX) {
+        fprintf(stderr, "Too many points for LAS 1.2, use LAS 1.4 output instead\n");
+        w->failed = 1;
+        errno = EOVERFLOW;
+    }
+    if (w->colour_by_elevation && !w->failed) las_colour_points(w);
+    if (w->compress && !w->failed) {
+        las_write_chunk_table(w);
+        w->header.point_data_format_id |= LAS_COMPRESSED_FLAG;
+    }
+    las_finish_header(w);
+
+    if (fseek(w->file, 0, SEEK_SET) != 0) w->failed = 1;
+    else if (las_write_header(w) != 0) w->failed = 1;
+
+    if (fclose(w->file) != 0) w->failed = 1;
+    las_close_spill(w);
+    free(w->batch);
+    free(w->chunks);
+    las_free_slots(w);
+    return w->failed ? -1 : 0;
+}
+
+// Closes and frees the writer without finalising the header
+static inline void las_writer_abort(LasWriter *w) {
+    fclose(w->file);
+    las_close_spill(w);
+    free(w->batch);
+    free(w->chunks);
+    las_free_slots(w);
+}
+
+#endif
@@ -2,54 +2,57 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <ctype.h>
-
-typedef struct {
-    double x, y;
-} Point;
-
-int compare(const void *a, const void *b) {
-    Point *p1 = (Point *)a;
-    Point *p2 = (Point *)b;
-    if (p1->x != p2->x)
-        return (p1->x > p2->x) - (p1->x < p2->x);
-    return (p1->y > p2->y) - (p1->y < p2->y);
-}
-
-double cross(Point o, Point a, Point b) {
-    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
-}
-
-void compute_convex_hull(Point *points, int n, Point **hull, int *hull_size) {
-    *hull = malloc(n * sizeof(Point));
-    if (!*hull) {
-        fprintf(stderr, "Memory allocation failed for hull.\n");
-        exit(1);
-    }
 
-    qsort(points, n, sizeof(Point), compare);
+#include "lssreader.h"
+#include "hull.h"
 
-    int k = 0;
-    for (int i = 0; i < n; ++i) {
-        while (k >= 2 && cross((*hull)[k - 2], (*hull)[k - 1], points[i]) <= 0)
-            k--;
-        (*hull)[k++] = points[i];
+void write_ring(FILE *out_fp, const HullRings *rings, size_t r, const char *indent) {
+    fprintf(out_fp, "%s[\n", indent);
+    for (size_t i = rings->start[r]; i < rings->start[r + 1]; ++i) {
+        fprintf(out_fp, "%s  [%.6f, %.6f]%s\n", indent, rings->points[i].x, rings->points[i].y,
+                (i == rings->start[r + 1] - 1) ? "" : ",");
     }
+    fprintf(out_fp, "%s]", indent);
+}
 
-    for (int i = n - 2, t = k + 1; i >= 0; --i) {
-        while (k >= t && cross((*hull)[k - 2], (*hull)[k - 1], points[i]) <= 0)
-            k--;
-        (*hull)[k++] = points[i];
+// Writes an outer ring followed by its holes
+void write_polygon(FILE *out_fp, const HullRings *rings, size_t outer, const char *indent) {
+    write_ring(out_fp, rings, outer, indent);
+    for (size_t r = 0; r < rings->ring_count; ++r) {
+        if (rings->parent[r] != (int)outer) continue;
+        fprintf(out_fp, ",\n");
+        write_ring(out_fp, rings, r, indent);
     }
-    *hull_size = k - 1;
+    fprintf(out_fp, "\n");
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input.00{x}>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input.00{x}> [-threads N] [-concave alpha] [-holes]\n", argv[0]);
         return 1;
     }
 
+    int thread_count = 1;
+    double alpha = 0.0;
+    int keep_holes = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-concave") == 0 && i + 1 < argc) {
+            alpha = atof(argv[++i]);
+            if (alpha <= 0.0) {
+                fprintf(stderr, "Invalid alpha. It must be a distance greater than 0.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-holes") == 0) {
+            keep_holes = 1;
+        }
+    }
+
     char *input_file = argv[1];
     char output_file[256];
 
@@ -59,95 +62,143 @@ int main(int argc, char *argv[]) {
     if (dot) *dot = '\0';
     strcat(output_file, "_boundary.geojson");
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
+    LssFile lss;
+    if (lss_open(input_file, &lss) != 0) {
         fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
         return 1;
     }
-
-    int capacity = 1000;
-    int point_count = 0;
-    Point *points = malloc(capacity * sizeof(Point));
-    if (!points) {
+    lss_enable_cache(&lss, input_file);
+
+    // The convex hull only keeps candidate points; the concave one needs them all
+    size_t point_count = 0;
+    size_t capacity = 0;
+    HullPoint *points = NULL;
+    HullBuilder boundary;
+    if (hull_init(&boundary) != 0) {
         fprintf(stderr, "Memory allocation failed for points.\n");
-        fclose(fp);
+        lss_close(&lss);
         return 1;
     }
 
-    char line[255];
-    while (fgets(line, sizeof(line), fp)) {
-        char *newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-
-        if (strncmp(line, "21", 2) != 0) continue;
-
-        char clean_line[255] = "";
-        char *src = line, *dest = clean_line;
-        while (*src) {
-            if (!isspace((unsigned char)*src)) {
-                *dest++ = *src;
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    LssBatch batch = {0};
+    int status;
+    while ((status = lss_read_batch(&lss, &batch, pool)) > 0) {
+        for (size_t i = 0; i < batch.count; i++) {
+            if (batch.flags[i] & LSS_FLAG_MALFORMED) {
+                fprintf(stderr, "Malformed line: %.*s\n", (int)batch.line[i].len, batch.line[i].text);
+                continue;
             }
-            src++;
-        }
-        *dest = '\0';
-
-        char *fields[5];
-        int field_count = 0;
-        char *token = strtok(clean_line, ",");
-        while (token != NULL && field_count < 5) {
-            fields[field_count++] = token;
-            token = strtok(NULL, ",");
-        }
 
-        if (field_count < 4) {
-            fprintf(stderr, "Malformed line: %s\n", line);
-            continue;
-        }
-
-        if (point_count >= capacity) {
-            capacity *= 2;
-            points = realloc(points, capacity * sizeof(Point));
-            if (!points) {
+            if (alpha > 0.0 && grow_array((void **)&points, &capacity, point_count + 1, sizeof(HullPoint)) != 0) {
                 fprintf(stderr, "Memory reallocation failed for points.\n");
-                fclose(fp);
+                lss_batch_free(&batch);
+                pool_destroy(pool);
+                lss_close(&lss);
+                hull_free(&boundary);
+                free(points);
+                return 1;
+            }
+
+            if (alpha > 0.0) {
+                points[point_count].x = batch.x[i];
+                points[point_count].y = batch.y[i];
+            } else if (hull_add(&boundary, batch.x[i], batch.y[i]) != 0) {
+                fprintf(stderr, "Memory allocation failed for hull points.\n");
+                lss_batch_free(&batch);
+                pool_destroy(pool);
+                lss_close(&lss);
+                hull_free(&boundary);
+                free(points);
                 return 1;
             }
+            point_count++;
         }
+    }
+    lss_batch_free(&batch);
+    pool_destroy(pool);
+    lss_close(&lss);
 
-        points[point_count].x = atof(fields[2]);
-        points[point_count].y = atof(fields[3]);
-        point_count++;
+    if (status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_file);
+        hull_free(&boundary);
+        free(points);
+        return 1;
     }
-    fclose(fp);
 
     if (point_count < 3) {
-        fprintf(stderr, "Not enough points to form a convex hull.\n");
+        fprintf(stderr, "Not enough points to form a boundary.\n");
+        hull_free(&boundary);
         free(points);
         return 1;
     }
 
-    Point *hull;
-    int hull_size;
-    compute_convex_hull(points, point_count, &hull, &hull_size);
-    free(points);
+    HullRings rings;
+    if (alpha > 0.0) {
+        int result = hull_concave(points, point_count, alpha, keep_holes, &rings);
+        free(points);
+        hull_free(&boundary);
+        if (result < 0) {
+            fprintf(stderr, "Memory allocation failed for the concave boundary.\n");
+            return 1;
+        }
+        if (result > 0) {
+            fprintf(stderr, "No part of the survey fits within alpha %.3f; try a larger value.\n", alpha);
+            return 1;
+        }
+    } else {
+        // The convex hull is a single outer ring
+        HullPoint *hull;
+        int hull_size;
+        int result = hull_finish(&boundary, &hull, &hull_size);
+        hull_free(&boundary);
+        rings.points = hull;
+        rings.start = malloc(2 * sizeof(size_t));
+        rings.parent = malloc(sizeof(int));
+        if (result != 0 || !rings.start || !rings.parent) {
+            fprintf(stderr, "Memory allocation failed for hull.\n");
+            if (result == 0) hull_rings_free(&rings);
+            return 1;
+        }
+        rings.start[0] = 0;
+        rings.start[1] = (size_t)hull_size;
+        rings.parent[0] = -1;
+        rings.ring_count = 1;
+    }
 
     FILE *out_fp = fopen(output_file, "w");
     if (out_fp == NULL) {
         fprintf(stderr, "Error creating output file '%s': %s\n", output_file, strerror(errno));
-        free(hull);
+        hull_rings_free(&rings);
         return 1;
     }
 
-    fprintf(out_fp, "{\n  \"type\": \"FeatureCollection\",\n  \"features\": [\n    {\n");
-    fprintf(out_fp, "      \"type\": \"Feature\",\n      \"geometry\": {\n        \"type\": \"Polygon\",\n        \"coordinates\": [\n          [\n");
+    size_t outer_count = 0, outer = 0;
+    for (size_t r = 0; r < rings.ring_count; ++r) {
+        if (rings.parent[r] < 0) {
+            if (outer_count == 0) outer = r;
+            outer_count++;
+        }
+    }
 
-    for (int i = 0; i < hull_size; ++i) {
-        fprintf(out_fp, "            [%.6f, %.6f]%s\n", hull[i].x, hull[i].y, (i == hull_size - 1) ? "" : ",");
+    fprintf(out_fp, "{\n  \"type\": \"FeatureCollection\",\n  \"features\": [\n    {\n");
+    if (outer_count == 1) {
+        fprintf(out_fp, "      \"type\": \"Feature\",\n      \"geometry\": {\n        \"type\": \"Polygon\",\n        \"coordinates\": [\n");
+        write_polygon(out_fp, &rings, outer, "          ");
+    } else {
+        fprintf(out_fp, "      \"type\": \"Feature\",\n      \"geometry\": {\n        \"type\": \"MultiPolygon\",\n        \"coordinates\": [\n");
+        size_t written = 0;
+        for (size_t r = 0; r < rings.ring_count; ++r) {
+            if (rings.parent[r] >= 0) continue;
+            fprintf(out_fp, "          [\n");
+            write_polygon(out_fp, &rings, r, "            ");
+            fprintf(out_fp, "          ]%s\n", (++written == outer_count) ? "" : ",");
+        }
     }
-    fprintf(out_fp, "          ]\n        ]\n      },\n      \"properties\": {}\n    }\n  ]\n}\n");
+    fprintf(out_fp, "        ]\n      },\n      \"properties\": {}\n    }\n  ]\n}\n");
 
     fclose(out_fp);
-    free(hull);
+    hull_rings_free(&rings);
 
     printf("Boundary GeoJSON output complete. Output file: %s\n", output_file);
     return 0;
@@ -2,11 +2,92 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <ctype.h>
+
+#include "lssreader.h"
+#include "lssindex.h"
+#include "clip.h"
+#include "blockwriter.h"
+
+#define CSV_BLOCK_RECORDS 8192
+
+// One parsed batch; each block covers CSV_BLOCK_RECORDS of its records
+typedef struct {
+    const LssBatch *batch;
+    const Clip *clip;
+} CsvRound;
+
+void format_records(void *ctx, int block, TextBuffer *out) {
+    const CsvRound *round = (const CsvRound *)ctx;
+    const LssBatch *batch = round->batch;
+    size_t first = (size_t)block * CSV_BLOCK_RECORDS;
+    size_t last = first + CSV_BLOCK_RECORDS < batch->count ? first + CSV_BLOCK_RECORDS : batch->count;
+
+    for (size_t i = first; i < last; i++) {
+        if (batch->flags[i] & LSS_FLAG_MALFORMED) continue;
+        if (!clip_contains(round->clip, batch->x[i], batch->y[i])) continue;
+
+        const LssField *text = &batch->text[3 * i];
+        char *p = text_reserve(out, text[0].len + text[1].len + text[2].len + 3);
+        if (!p) return;
+        memcpy(p, text[0].text, text[0].len);
+        p += text[0].len;
+        *p++ = ',';
+        memcpy(p, text[1].text, text[1].len);
+        p += text[1].len;
+        *p++ = ',';
+        memcpy(p, text[2].text, text[2].len);
+        p += text[2].len;
+        *p++ = '\n';
+        out->used = (size_t)(p - out->data);
+    }
+}
+
+// Parses the next CSV_BLOCK_RECORDS of the records the index selected into
+// batch. Returns 1 when records were read, 0 after the last and -1 if memory
+// ran out.
+int read_selected(const LssFile *lss, const LssIndex *index, const uint64_t *points, size_t count,
+                  size_t *next, LssBatch *batch) {
+    batch->count = 0;
+    if (*next >= count) return 0;
+    size_t last = count - *next < CSV_BLOCK_RECORDS ? count : *next + CSV_BLOCK_RECORDS;
+    for (; *next < last; (*next)++) {
+        if (lss_index_read_line(lss, index->position[points[*next]], batch) != 0) return -1;
+    }
+    return 1;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input.00{x}>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input.00{x}> [-threads N] [-bbox minx,miny,maxx,maxy] [-clip polygon.geojson]\n", argv[0]);
+        return 1;
+    }
+
+    int thread_count = 1;
+    Clip clip = {0};
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                clip_free(&clip);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-bbox") == 0 && i + 1 < argc) {
+            if (clip_set_box(&clip, argv[++i]) != 0) {
+                fprintf(stderr, "Invalid bounding box '%s'. Expected minx,miny,maxx,maxy.\n", argv[i]);
+                clip_free(&clip);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-clip") == 0 && i + 1 < argc) {
+            if (clip_load_polygon(&clip, argv[++i]) != 0) {
+                clip_free(&clip);
+                return 1;
+            }
+        }
+    }
+    if (clip_prepare(&clip) != 0) {
+        fprintf(stderr, "Memory allocation failed for the clip polygon.\n");
+        clip_free(&clip);
         return 1;
     }
 
@@ -19,60 +100,88 @@ int main(int argc, char *argv[]) {
     if (dot) *dot = '\0';
     strcat(output_file, ".csv");
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
+    LssFile lss;
+    if (lss_open(input_file, &lss) != 0) {
         fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
+        clip_free(&clip);
         return 1;
     }
 
     FILE *out_fp = fopen(output_file, "w");
     if (out_fp == NULL) {
         fprintf(stderr, "Error creating output file '%s': %s\n", output_file, strerror(errno));
-        fclose(fp);
+        lss_close(&lss);
+        clip_free(&clip);
         return 1;
     }
 
     fprintf(out_fp, "x,y,z\n");
 
-    char line[255];
-    while (fgets(line, sizeof(line), fp)) {
-        char *newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-
-        if (strncmp(line, "21", 2) != 0) continue;
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    BlockWriter writer;
+    block_writer_init(&writer, out_fp, pool);
+    LssBatch batch = {0};
+    CsvRound round = { &batch, &clip };
+    int status = 1;
 
-        char clean_line[255] = "";
-        char *src = line, *dest = clean_line;
-        while (*src) {
-            if (!isspace((unsigned char)*src)) {
-                *dest++ = *src;
-            }
-            src++;
+    // With a clip the spatial index picks the records inside its bounds, and
+    // only their lines are parsed
+    LssIndex index = {0};
+    uint64_t *points = NULL;
+    size_t selected = 0, next = 0;
+    if (clip.active) {
+        if (lss_index_open(input_file, pool, &index) != 0) {
+            fprintf(stderr, "Error indexing input file '%s': %s\n", input_file, strerror(errno));
+            pool_destroy(pool);
+            lss_close(&lss);
+            clip_free(&clip);
+            fclose(out_fp);
+            return 1;
         }
-        *dest = '\0';
-
-        char *fields[5];
-        int field_count = 0;
-        char *token = strtok(clean_line, ",");
-        while (token != NULL && field_count < 5) {
-            fields[field_count++] = token;
-            token = strtok(NULL, ",");
+        LssBox box;
+        clip_bounds(&clip, &box.min_x, &box.min_y, &box.max_x, &box.max_y);
+        int64_t found = lss_index_select_points(&index, box, &points);
+        if (found < 0) status = -1;
+        else selected = (size_t)found;
+
+        for (uint64_t i = 0; status > 0 && i < index.header->malformed_count; i++) {
+            batch.count = 0;
+            if (lss_index_read_line(&lss, index.malformed[i], &batch) != 0) status = -1;
+            else if (batch.count > 0) fprintf(stderr, "Malformed line: %.*s\n", (int)batch.line[0].len, batch.line[0].text);
         }
+    }
 
-        if (field_count < 4) {
-            fprintf(stderr, "Malformed line: %s\n", line);
-            continue;
+    while (status > 0 && (status = clip.active ? read_selected(&lss, &index, points, selected, &next, &batch)
+                                               : lss_read_batch(&lss, &batch, pool)) > 0) {
+        for (size_t i = 0; i < batch.count; i++) {
+            if (batch.flags[i] & LSS_FLAG_MALFORMED) {
+                fprintf(stderr, "Malformed line: %.*s\n", (int)batch.line[i].len, batch.line[i].text);
+            }
         }
 
-        char *x = fields[2];
-        char *y = fields[3];
-        char *z = (field_count > 4) ? fields[4] : "";
+        int blocks = (int)((batch.count + CSV_BLOCK_RECORDS - 1) / CSV_BLOCK_RECORDS);
+        if (block_writer_run(&writer, blocks, format_records, &round) != 0) break;
+    }
+    int write_failed = writer.failed;
+    block_writer_free(&writer);
+    lss_batch_free(&batch);
+    free(points);
+    if (clip.active) lss_index_close(&index);
+    pool_destroy(pool);
+    clip_free(&clip);
 
-        fprintf(out_fp, "%s,%s,%s\n", x, y, z);
+    if (status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_file);
+        lss_close(&lss);
+        fclose(out_fp);
+        return 1;
     }
 
-    fclose(fp);
-    fclose(out_fp);
+    lss_close(&lss);
+    if (fclose(out_fp) != 0 || write_failed) {
+        fprintf(stderr, "Error writing output file '%s'\n", output_file);
+        return 1;
+    }
 
     printf("Conversion complete. Output file: %s\n", output_file);
     return 0;
@@ -2,24 +2,47 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_LINE_LENGTH 1024
-#define NUM_PARTS 6
-#define MAX_POINTS 300
-#define MAX_FEATURES 2500
+#include "lssreader.h"
+#include "lssindex.h"
+#include "clip.h"
+#include "dxfwriter.h"
+
+#define CODE_LENGTH 9
+#define ROUND_VERTICES (256 * 1024)
+#define BLOCK_FEATURES 256
 
 typedef struct {
-    float x;
-    float y;
-    float z;
+    double x;
+    double y;
+    double z;
 } Vertex;
 
 typedef struct {
-    char code[10];
-    Vertex *vertices;
-    int vertex_count;
-    int vertex_capacity;
+    char code[CODE_LENGTH + 1];
+    size_t first;
+    size_t vertex_count;
 } Feature;
 
+// Features are built one at a time, so every feature's vertices sit in one
+// run of the shared vertex buffer.
+typedef struct {
+    Feature *features;
+    size_t feature_count;
+    size_t feature_capacity;
+    Vertex *vertices;
+    size_t vertex_count;
+    size_t vertex_capacity;
+} FeatureArena;
+
+// Codes asked for with --list-codes, found through an open-addressing table
+typedef struct {
+    LssField *codes;
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;
+    size_t slot_count;
+} CodeSet;
+
 void generate_output_filename(const char *input_filename, char *output_filename) {
     strcpy(output_filename, input_filename);
 
@@ -31,25 +54,254 @@ void generate_output_filename(const char *input_filename, char *output_filename)
     }
 }
 
-int feature_in_list(const char *feature_code, char **list, int list_count) {
-    for (int i = 0; i < list_count; i++) {
-        if (strcmp(feature_code, list[i]) == 0) {
-            return 1;
+int code_set_contains(const CodeSet *set, LssField code) {
+    if (set->count == 0) return 0;
+    size_t mask = set->slot_count - 1;
+    size_t slot = lss_hash(code) & mask;
+    while (set->slots[slot]) {
+        if (lss_field_equals(set->codes[set->slots[slot] - 1], code)) return 1;
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+int code_set_add(CodeSet *set, LssField code) {
+    if (code_set_contains(set, code)) return 0;
+    if ((set->count + 1) * 2 > set->slot_count) {
+        size_t slot_count = set->slot_count ? set->slot_count * 2 : 64;
+        uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+        if (!slots) return -1;
+        for (size_t i = 0; i < set->count; i++) {
+            size_t slot = lss_hash(set->codes[i]) & (slot_count - 1);
+            while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = (uint32_t)(i + 1);
         }
+        free(set->slots);
+        set->slots = slots;
+        set->slot_count = slot_count;
+    }
+    if (grow_array((void **)&set->codes, &set->capacity, set->count + 1, sizeof(LssField)) != 0) return -1;
+
+    size_t slot = lss_hash(code) & (set->slot_count - 1);
+    while (set->slots[slot]) slot = (slot + 1) & (set->slot_count - 1);
+    set->codes[set->count++] = code;
+    set->slots[slot] = (uint32_t)set->count;
+    return 0;
+}
+
+void code_set_free(CodeSet *set) {
+    free(set->codes);
+    free(set->slots);
+}
+
+// Starts a new feature with the given code; later vertices are added to it.
+// Returns -1 with a message on stderr when memory runs out.
+int start_feature(FeatureArena *arena, const char *code) {
+    if (grow_array((void **)&arena->features, &arena->feature_capacity,
+                 arena->feature_count + 1, sizeof(Feature)) != 0) {
+        fprintf(stderr, "Memory allocation failed for feature %s.\n", code);
+        return -1;
+    }
+    Feature *feature = &arena->features[arena->feature_count++];
+    snprintf(feature->code, sizeof(feature->code), "%s", code);
+    feature->first = arena->vertex_count;
+    feature->vertex_count = 0;
+    return 0;
+}
+
+int add_vertex(FeatureArena *arena, Vertex v) {
+    if (grow_array((void **)&arena->vertices, &arena->vertex_capacity,
+                 arena->vertex_count + 1, sizeof(Vertex)) != 0) {
+        fprintf(stderr, "Memory allocation failed for vertices of feature %s.\n",
+                arena->features[arena->feature_count - 1].code);
+        return -1;
     }
+    arena->vertices[arena->vertex_count++] = v;
+    arena->features[arena->feature_count - 1].vertex_count++;
+    return 0;
+}
+
+// LWPOLYLINE is 2D: it only carries an elevation when the string is flat.
+// It is only written to R2000 files, where handle identifies it.
+void write_feature(DxfWriter *out, const Feature *feature, const Vertex *vertices, int lwpolyline, uint64_t handle) {
+    if (lwpolyline) {
+        dxf_entity(out, "LWPOLYLINE", handle, feature->code);
+        dxf_string(out, 100, "AcDbPolyline");
+        dxf_int(out, 90, (int32_t)feature->vertex_count);
+        dxf_int(out, 70, 0);
+        size_t flat = 1;
+        while (flat < feature->vertex_count && vertices[flat].z == vertices[0].z) flat++;
+        if (flat == feature->vertex_count && vertices[0].z != 0.0) dxf_real(out, 38, vertices[0].z, 3);
+        for (size_t j = 0; j < feature->vertex_count; j++) {
+            dxf_real(out, 10, vertices[j].x, 3);
+            dxf_real(out, 20, vertices[j].y, 3);
+        }
+        return;
+    }
+
+    dxf_string(out, 0, "POLYLINE");
+    dxf_string(out, 8, feature->code);
+    dxf_int(out, 66, 1);
+    dxf_int(out, 70, 0);
+
+    for (size_t j = 0; j < feature->vertex_count; j++) {
+        dxf_string(out, 0, "VERTEX");
+        dxf_string(out, 8, feature->code);
+        dxf_real(out, 10, vertices[j].x, 3);
+        dxf_real(out, 20, vertices[j].y, 3);
+        dxf_real(out, 30, vertices[j].z, 3);
+    }
+
+    dxf_string(out, 0, "SEQEND");
+}
+
+// Finished features waiting to be written; each block is BLOCK_FEATURES of them
+typedef struct {
+    const FeatureArena *arena;
+    int lwpolyline;
+    const DxfWriter *file;
+    uint64_t first_handle;
+} FeatureRound;
+
+void format_features(void *ctx, int block, TextBuffer *out) {
+    const FeatureRound *round = (const FeatureRound *)ctx;
+    const FeatureArena *arena = round->arena;
+    size_t first = (size_t)block * BLOCK_FEATURES;
+    size_t last = first + BLOCK_FEATURES < arena->feature_count ? first + BLOCK_FEATURES : arena->feature_count;
+
+    DxfWriter writer;
+    dxf_writer_attach(&writer, out, round->file);
+    for (size_t i = first; i < last; i++) {
+        const Feature *feature = &arena->features[i];
+        write_feature(&writer, feature, arena->vertices + feature->first, round->lwpolyline, round->first_handle + i);
+    }
+}
+
+// Writes the finished features and empties the arena
+int emit_features(DxfWriter *out, BlockWriter *blocks, FeatureArena *arena, int lwpolyline) {
+    FeatureRound round = { arena, lwpolyline, out, out->next_handle };
+    out->next_handle += arena->feature_count;
+    int count = (int)((arena->feature_count + BLOCK_FEATURES - 1) / BLOCK_FEATURES);
+    int result = dxf_write_blocks(out, blocks, count, format_features, &round);
+    arena->feature_count = 0;
+    arena->vertex_count = 0;
+    return result;
+}
+
+void free_features(FeatureArena *arena) {
+    free(arena->features);
+    free(arena->vertices);
+}
+
+Vertex interpolate(Vertex a, Vertex b, double t) {
+    Vertex v = { a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), a.z + t * (b.z - a.z) };
+    return v;
+}
+
+// Turns the coded points of the survey, in order, into features. A string
+// starts at a linked point or at the first coded point. With a clip, each
+// stretch of the string inside the area becomes its own feature. Strings with
+// unwanted codes are skipped. Finished strings are written out in rounds of
+// about ROUND_VERTICES vertices, formatted in parallel.
+typedef struct {
+    FeatureArena arena;
+    Clip *clip;
+    const char *one_code;
+    const CodeSet *list_codes;
+    DxfWriter *out;
+    BlockWriter *blocks;
+    int lwpolyline;
+    char string_code[CODE_LENGTH + 1];
+    int in_string;
+    int keep_string;
+    int open_piece;
+    Vertex previous;
+} StringCutter;
+
+// Adds the next coded point; starts is set when it begins a new string.
+// Returns -1 with a message on stderr when memory runs out or a write fails.
+int cut_point(StringCutter *s, Vertex v, LssField code, int starts) {
+    if (starts || !s->in_string) {
+        if (s->arena.vertex_count >= ROUND_VERTICES &&
+            emit_features(s->out, s->blocks, &s->arena, s->lwpolyline) != 0) {
+            return -1;
+        }
+        if (code.len > CODE_LENGTH) code.len = CODE_LENGTH;
+        snprintf(s->string_code, sizeof(s->string_code), "%.*s", (int)code.len, code.text);
+        s->in_string = 1;
+        s->keep_string = (!s->one_code || lss_field_is(code, s->one_code)) &&
+                         (s->list_codes->count == 0 || code_set_contains(s->list_codes, code));
+        s->open_piece = s->keep_string && clip_contains(s->clip, v.x, v.y);
+        s->previous = v;
+        if (s->open_piece && (start_feature(&s->arena, s->string_code) != 0 || add_vertex(&s->arena, v) != 0)) {
+            return -1;
+        }
+        return 0;
+    }
+    if (!s->keep_string) return 0;
+
+    Vertex previous = s->previous;
+    s->previous = v;
+    int pieces = clip_segment(s->clip, previous.x, previous.y, v.x, v.y);
+    if (pieces < 0) {
+        fprintf(stderr, "Memory allocation failed while clipping feature %s.\n", s->string_code);
+        return -1;
+    }
+    if (pieces == 0) s->open_piece = 0;
+    for (int k = 0; k < pieces; k++) {
+        double t0 = s->clip->intervals[2 * k], t1 = s->clip->intervals[2 * k + 1];
+        if (t0 > 0.0 || !s->open_piece) {
+            if (start_feature(&s->arena, s->string_code) != 0 ||
+                add_vertex(&s->arena, interpolate(previous, v, t0)) != 0) {
+                return -1;
+            }
+        }
+        if (add_vertex(&s->arena, t1 < 1.0 ? interpolate(previous, v, t1) : v) != 0) return -1;
+        s->open_piece = t1 >= 1.0;
+    }
+    return 0;
+}
+
+// Cuts the strings the spatial index finds crossing the clip's bounds, in
+// survey order. A string that misses the bounds has no piece inside the clip.
+int cut_selected(StringCutter *s, const LssIndex *index) {
+    LssBox box;
+    clip_bounds(s->clip, &box.min_x, &box.min_y, &box.max_x, &box.max_y);
+    uint64_t *lines;
+    int64_t count = lss_index_select_lines(index, box, &lines);
+    if (count < 0) {
+        fprintf(stderr, "Memory allocation failed while searching the index.\n");
+        return -1;
+    }
+    for (int64_t i = 0; i < count; i++) {
+        const LssIndexLine *line = &index->lines[lines[i]];
+        LssField code = lss_index_code(index, line->code);
+        for (uint32_t k = 0; k < line->count; k++) {
+            uint32_t p = index->line_points[line->first + k];
+            Vertex v = { index->x[p], index->y[p], index->z[p] };
+            if (cut_point(s, v, code, k == 0) != 0) {
+                free(lines);
+                return -1;
+            }
+        }
+    }
+    free(lines);
     return 0;
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input_file> [--one-code {x}] [--list-codes {x},{y},{z}]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <input_file> [--one-code {x}] [--list-codes {x},{y},{z}] [-threads N] [-bbox minx,miny,maxx,maxy] [-clip polygon.geojson] [-lwpolyline] [-binary]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     const char *input_filename = argv[1];
     char *one_code = NULL;
-    char *list_codes[MAX_FEATURES];
-    int list_count = 0;
+    CodeSet list_codes = {0};
+    int thread_count = 1;
+    int lwpolyline = 0;
+    int binary = 0;
+    Clip clip = {0};
 
     // Parse additional arguments
     for (int i = 2; i < argc; i++) {
@@ -57,139 +309,129 @@ int main(int argc, char *argv[]) {
             one_code = argv[++i];
         } else if (strcmp(argv[i], "--list-codes") == 0 && i + 1 < argc) {
             char *token = strtok(argv[++i], ",");
-            while (token != NULL && list_count < MAX_FEATURES) {
-                list_codes[list_count++] = token;
+            while (token != NULL) {
+                LssField code = { token, strlen(token) };
+                if (code_set_add(&list_codes, code) != 0) {
+                    fprintf(stderr, "Memory allocation failed for the code list.\n");
+                    code_set_free(&list_codes);
+                    clip_free(&clip);
+                    return EXIT_FAILURE;
+                }
                 token = strtok(NULL, ",");
             }
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                clip_free(&clip);
+                code_set_free(&list_codes);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-lwpolyline") == 0) {
+            lwpolyline = 1;
+        } else if (strcmp(argv[i], "-binary") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[i], "-bbox") == 0 && i + 1 < argc) {
+            if (clip_set_box(&clip, argv[++i]) != 0) {
+                fprintf(stderr, "Invalid bounding box '%s'. Expected minx,miny,maxx,maxy.\n", argv[i]);
+                clip_free(&clip);
+                code_set_free(&list_codes);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-clip") == 0 && i + 1 < argc) {
+            if (clip_load_polygon(&clip, argv[++i]) != 0) {
+                clip_free(&clip);
+                code_set_free(&list_codes);
+                return EXIT_FAILURE;
+            }
         }
     }
+    if (clip_prepare(&clip) != 0) {
+        fprintf(stderr, "Memory allocation failed for the clip polygon.\n");
+        clip_free(&clip);
+        code_set_free(&list_codes);
+        return EXIT_FAILURE;
+    }
 
     char output_filename[256];
     generate_output_filename(input_filename, output_filename);
 
-    FILE *input_file = fopen(input_filename, "r");
-    if (input_file == NULL) {
+    // With a clip the strings come from the survey's spatial index instead
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    LssFile input_file = {0};
+    LssIndex index = {0};
+    if ((clip.active ? lss_index_open(input_filename, pool, &index) : lss_open(input_filename, &input_file)) != 0) {
         perror("Failed to open input file");
+        pool_destroy(pool);
+        clip_free(&clip);
+        code_set_free(&list_codes);
         return EXIT_FAILURE;
     }
+    if (!clip.active) lss_enable_cache(&input_file, input_filename);
 
-    FILE *output_file = fopen(output_filename, "w");
-    if (output_file == NULL) {
+    DxfWriter output_file;
+    // LWPOLYLINE needs R2000; the POLYLINE output stays R12
+    if (dxf_writer_open(&output_file, output_filename, binary, lwpolyline) != 0) {
         perror("Failed to open output file");
-        fclose(input_file);
+        pool_destroy(pool);
+        if (clip.active) lss_index_close(&index);
+        else lss_close(&input_file);
+        clip_free(&clip);
+        code_set_free(&list_codes);
         return EXIT_FAILURE;
     }
 
-    fprintf(output_file, "0\nSECTION\n");
-    fprintf(output_file, "2\nHEADER\n");
-    fprintf(output_file, "0\nENDSEC\n");
-
-    fprintf(output_file, "0\nSECTION\n");
-    fprintf(output_file, "2\nENTITIES\n");
-
-    Feature features[MAX_FEATURES];
-    int feature_count = 0;
-    int current_feature_index = -1;
+    dxf_write_header(&output_file);
+    if (lwpolyline) dxf_write_tables(&output_file);
 
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), input_file)) {
-        line[strcspn(line, "\n")] = '\0';
+    dxf_string(&output_file, 0, "SECTION");
+    dxf_string(&output_file, 2, "ENTITIES");
 
-        if (strncmp(line, "21", 2) == 0) {
-            char *parts[NUM_PARTS];
-            char *token = strtok(line, ", ");
-            int part_count = 0;
-
-            while (token != NULL && part_count < NUM_PARTS) {
-                parts[part_count++] = token;
-                token = strtok(NULL, ", ");
-            }
-
-            if (part_count == NUM_PARTS) {
-                Vertex v;
-                v.x = atof(parts[2]);
-                v.y = atof(parts[3]);
-                v.z = atof(parts[4]);
-
-                char raw_code[10];
-                strncpy(raw_code, parts[5], sizeof(raw_code) - 1);
-                raw_code[sizeof(raw_code) - 1] = '\0';
-
-                char cleaned_code[10] = "";
-                char *src = raw_code, *dest = cleaned_code;
-                while (*src) {
-                    if (*src != '.') {
-                        *dest++ = *src;
-                    }
-                    src++;
-                }
-                *dest = '\0';
-
-                if (strchr(parts[5], '.') != NULL || current_feature_index == -1) {
-                    current_feature_index = feature_count;
-                    features[current_feature_index].vertex_capacity = MAX_POINTS;
-                    features[current_feature_index].vertices = malloc(features[current_feature_index].vertex_capacity * sizeof(Vertex));
-                    if (!features[current_feature_index].vertices) {
-                        fprintf(stderr, "Memory allocation failed for feature %s.\n", cleaned_code);
-                        fclose(input_file);
-                        fclose(output_file);
-                        return EXIT_FAILURE;
-                    }
-                    strncpy(features[current_feature_index].code, cleaned_code, sizeof(features[current_feature_index].code) - 1);
-                    features[current_feature_index].code[sizeof(features[current_feature_index].code) - 1] = '\0';
-                    features[current_feature_index].vertex_count = 0;
-                    feature_count++;
-                }
+    BlockWriter blocks;
+    block_writer_init(&blocks, NULL, pool);
+    StringCutter cutter = { {0}, &clip, one_code, &list_codes, &output_file, &blocks, lwpolyline, "", 0, 0, 0, { 0.0, 0.0, 0.0 } };
+    LssBatch batch = {0};
+    int status = 0;
+    int failed = clip.active && cut_selected(&cutter, &index) != 0;
+    while (!clip.active && !failed && (status = lss_read_batch(&input_file, &batch, pool)) > 0) {
+        for (size_t i = 0; i < batch.count && !failed; i++) {
+            if ((batch.flags[i] & (LSS_FLAG_MALFORMED | LSS_FLAG_NO_Z)) || batch.code[i].len == 0) continue;
 
-                Feature *current_feature = &features[current_feature_index];
-                if (current_feature->vertex_count >= current_feature->vertex_capacity) {
-                    current_feature->vertex_capacity *= 2;
-                    current_feature->vertices = realloc(current_feature->vertices, current_feature->vertex_capacity * sizeof(Vertex));
-                    if (!current_feature->vertices) {
-                        fprintf(stderr, "Memory reallocation failed for vertices of feature %s.\n", cleaned_code);
-                        fclose(input_file);
-                        fclose(output_file);
-                        return EXIT_FAILURE;
-                    }
-                }
-                current_feature->vertices[current_feature->vertex_count++] = v;
-            }
+            Vertex v = { batch.x[i], batch.y[i], batch.z[i] };
+            failed = cut_point(&cutter, v, batch.code[i], (batch.flags[i] & LSS_FLAG_LINKED) != 0) != 0;
         }
     }
+    lss_batch_free(&batch);
+    if (clip.active) lss_index_close(&index);
+    else lss_close(&input_file);
+    clip_free(&clip);
+    code_set_free(&list_codes);
 
-    for (int i = 0; i < feature_count; i++) {
-        if (one_code && strcmp(features[i].code, one_code) != 0) {
-            continue;
-        }
-        if (list_count > 0 && !feature_in_list(features[i].code, list_codes, list_count)) {
-            continue;
-        }
-
-        fprintf(output_file, "0\nPOLYLINE\n");
-        fprintf(output_file, "8\n%s\n", features[i].code);
-        fprintf(output_file, "66\n1\n");
-        fprintf(output_file, "70\n0\n");
-
-        for (int j = 0; j < features[i].vertex_count; j++) {
-            fprintf(output_file, "0\nVERTEX\n");
-            fprintf(output_file, "8\n%s\n", features[i].code);
-            fprintf(output_file, "10\n%.3f\n", features[i].vertices[j].x);
-            fprintf(output_file, "20\n%.3f\n", features[i].vertices[j].y);
-            fprintf(output_file, "30\n%.3f\n", features[i].vertices[j].z);
-        }
+    if (!failed && status == 0) failed = emit_features(&output_file, &blocks, &cutter.arena, lwpolyline) != 0;
+    block_writer_free(&blocks);
+    pool_destroy(pool);
+    free_features(&cutter.arena);
 
-        fprintf(output_file, "0\nSEQEND\n");
+    if (failed) {
+        if (output_file.failed) fprintf(stderr, "Error writing output file '%s'\n", output_filename);
+        dxf_writer_close(&output_file);
+        return EXIT_FAILURE;
     }
 
-    for (int i = 0; i < feature_count; i++) {
-        free(features[i].vertices);
+    if (status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_filename);
+        dxf_writer_close(&output_file);
+        return EXIT_FAILURE;
     }
 
-    fprintf(output_file, "0\nENDSEC\n");
-    fprintf(output_file, "0\nEOF\n");
+    dxf_string(&output_file, 0, "ENDSEC");
+    if (lwpolyline) dxf_write_objects(&output_file);
+    dxf_string(&output_file, 0, "EOF");
 
-    fclose(input_file);
-    fclose(output_file);
+    if (dxf_writer_close(&output_file) != 0) {
+        fprintf(stderr, "Error writing output file '%s'\n", output_filename);
+        return EXIT_FAILURE;
+    }
 
     printf("DXF file created successfully: %s\n", output_filename);
     return EXIT_SUCCESS;
@@ -2,16 +2,56 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_LINE_LENGTH 1024
-#define NUM_PARTS 6
-#define MAX_POINTS 100
-
+#include "lssreader.h"
+#include "blockwriter.h"
+
+#define JSON_BLOCK_RECORDS 8192
+
+static const char feature_open[] =
+    "  {\n"
+    "    \"type\": \"Feature\",\n"
+    "    \"geometry\": {\n"
+    "      \"type\": \"LineString\",\n"
+    "      \"coordinates\": [\n";
+static const char feature_close[] = "\n      ]\n    }\n  }";
+
+// One parsed batch; each block covers JSON_BLOCK_RECORDS of its records.
+// first_point is the batch index of the survey's first string point, or the
+// batch size when an earlier batch already had it.
 typedef struct {
-    float x;
-    float y;
-    float z;
-    char code[10];
-} Point;
+    const LssBatch *batch;
+    size_t first_point;
+} JsonRound;
+
+// Only coded points belong to strings; a linked code starts a new one
+void format_points(void *ctx, int block, TextBuffer *out) {
+    const JsonRound *round = (const JsonRound *)ctx;
+    const LssBatch *batch = round->batch;
+    size_t first = (size_t)block * JSON_BLOCK_RECORDS;
+    size_t last = first + JSON_BLOCK_RECORDS < batch->count ? first + JSON_BLOCK_RECORDS : batch->count;
+
+    for (size_t i = first; i < last; i++) {
+        if ((batch->flags[i] & (LSS_FLAG_MALFORMED | LSS_FLAG_NO_Z)) || batch->code[i].len == 0) continue;
+
+        if (i == round->first_point) {
+            text_append(out, feature_open, sizeof(feature_open) - 1);
+        } else if (batch->flags[i] & LSS_FLAG_LINKED) {
+            text_append(out, feature_close, sizeof(feature_close) - 1);
+            text_append(out, ",\n", 2);
+            text_append(out, feature_open, sizeof(feature_open) - 1);
+        } else {
+            text_append(out, ",\n", 2);
+        }
+
+        text_append(out, "        [", 9);
+        text_fixed(out, batch->x[i], 3);
+        text_append(out, ", ", 2);
+        text_fixed(out, batch->y[i], 3);
+        text_append(out, ", ", 2);
+        text_fixed(out, batch->z[i], 3);
+        text_char(out, ']');
+    }
+}
 
 void generate_output_filename(const char *input_filename, char *output_filename) {
     strcpy(output_filename, input_filename);
@@ -25,26 +65,38 @@ void generate_output_filename(const char *input_filename, char *output_filename)
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input_file> [-threads N]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     const char *input_filename = argv[1];
+    int thread_count = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
 
     char output_filename[256];
     generate_output_filename(input_filename, output_filename);
 
-    FILE *input_file = fopen(input_filename, "r");
-    if (input_file == NULL) {
+    LssFile input_file;
+    if (lss_open(input_filename, &input_file) != 0) {
         perror("Failed to open input file");
         return EXIT_FAILURE;
     }
+    lss_enable_cache(&input_file, input_filename);
 
     FILE *output_file = fopen(output_filename, "w");
     if (output_file == NULL) {
         perror("Failed to open output file");
-        fclose(input_file);
+        lss_close(&input_file);
         return EXIT_FAILURE;
     }
 
@@ -52,72 +104,50 @@ int main(int argc, char *argv[]) {
     fprintf(output_file, "  \"type\": \"FeatureCollection\",\n");
     fprintf(output_file, "  \"features\": [\n");
 
-    char line[MAX_LINE_LENGTH];
-    Point line_points[MAX_POINTS];
-    int point_count = 0;
-    int is_first_feature = 1;
-
-    while (fgets(line, sizeof(line), input_file)) {
-        line[strcspn(line, "\n")] = '\0';
-
-        if (strncmp(line, "21", 2) == 0) {
-            char *parts[NUM_PARTS];
-            char *token = strtok(line, ", ");
-            int part_count = 0;
-
-            while (token != NULL && part_count < NUM_PARTS) {
-                parts[part_count++] = token;
-                token = strtok(NULL, ", ");
-            }
-
-            if (part_count == NUM_PARTS) {
-                if (strchr(parts[5], '.') != NULL) {
-                    if (!is_first_feature) {
-                        fprintf(output_file, "      ]\n");
-                        fprintf(output_file, "    }\n");
-                        fprintf(output_file, "  },\n");
-                    }
-
-                    point_count = 0;
-                    is_first_feature = 0;
-
-                    fprintf(output_file, "  {\n");
-                    fprintf(output_file, "    \"type\": \"Feature\",\n");
-                    fprintf(output_file, "    \"geometry\": {\n");
-                    fprintf(output_file, "      \"type\": \"LineString\",\n");
-                    fprintf(output_file, "      \"coordinates\": [\n");
-                }
-
-                if (point_count < MAX_POINTS) {
-                    Point p;
-                    p.x = atof(parts[2]);
-                    p.y = atof(parts[3]);
-                    p.z = atof(parts[4]);
-                    strncpy(p.code, parts[5], sizeof(p.code) - 1);
-                    p.code[sizeof(p.code) - 1] = '\0';
-                    line_points[point_count++] = p;
-
-                    if (point_count > 1) {
-                        fprintf(output_file, ",\n");
-                    }
-                    fprintf(output_file, "        [%.3f, %.3f, %.3f]", p.x, p.y, p.z);
-                }
-            }
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    BlockWriter writer;
+    block_writer_init(&writer, output_file, pool);
+    LssBatch batch = {0};
+    JsonRound round = { &batch, 0 };
+    int status;
+    int has_features = 0;
+
+    while ((status = lss_read_batch(&input_file, &batch, pool)) > 0) {
+        round.first_point = batch.count;
+        for (size_t i = 0; i < batch.count && !has_features; i++) {
+            if ((batch.flags[i] & (LSS_FLAG_MALFORMED | LSS_FLAG_NO_Z)) || batch.code[i].len == 0) continue;
+            round.first_point = i;
+            has_features = 1;
         }
+
+        int blocks = (int)((batch.count + JSON_BLOCK_RECORDS - 1) / JSON_BLOCK_RECORDS);
+        if (block_writer_run(&writer, blocks, format_points, &round) != 0) break;
+    }
+    int write_failed = writer.failed;
+    block_writer_free(&writer);
+    lss_batch_free(&batch);
+    pool_destroy(pool);
+
+    if (status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_filename);
+        lss_close(&input_file);
+        fclose(output_file);
+        return EXIT_FAILURE;
     }
 
-    if (point_count > 0) {
-        fprintf(output_file, "\n      ]\n");
-        fprintf(output_file, "    }\n");
-        fprintf(output_file, "  }\n");
+    if (has_features) {
+        fprintf(output_file, "%s\n", feature_close);
     }
 
     // Close the GeoJSON file
     fprintf(output_file, "  ]\n");
     fprintf(output_file, "}\n");
 
-    fclose(input_file);
-    fclose(output_file);
+    lss_close(&input_file);
+    if (fclose(output_file) != 0 || write_failed) {
+        fprintf(stderr, "Error writing output file '%s'\n", output_filename);
+        return EXIT_FAILURE;
+    }
 
     printf("GeoJSON file created successfully: %s\n", output_filename);
     return EXIT_SUCCESS;
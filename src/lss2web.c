@@ -2,16 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_LINE_LENGTH 1024
-#define NUM_PARTS 6
-#define MAX_POINTS 100
-
-typedef struct {
-    float x;
-    float y;
-    float z;
-    char code[10];
-} Point;
+#include "lssreader.h"
 
 void generate_output_filename(const char *input_filename, char *output_filename) {
     strcpy(output_filename, input_filename);
@@ -25,35 +16,43 @@ void generate_output_filename(const char *input_filename, char *output_filename)
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input_file> [-ge]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <input_file> [-ge] [-points] [-threads N]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     const char *input_filename = argv[1];
     int include_google_earth = 0;
     int include_points = 0;
+    int thread_count = 1;
 
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "-ge") == 0) {
             include_google_earth = 1;
         } else if (strcmp(argv[i], "-points") == 0) {
             include_points = 1;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return EXIT_FAILURE;
+            }
         }
     }
 
     char output_filename[256];
     generate_output_filename(input_filename, output_filename);
 
-    FILE *input_file = fopen(input_filename, "r");
-    if (input_file == NULL) {
+    LssFile input_file;
+    if (lss_open(input_filename, &input_file) != 0) {
         perror("Failed to open input file");
         return EXIT_FAILURE;
     }
+    lss_enable_cache(&input_file, input_filename);
 
     FILE *output_file = fopen(output_filename, "w");
     if (output_file == NULL) {
         perror("Failed to open output file");
-        fclose(input_file);
+        lss_close(&input_file);
         return EXIT_FAILURE;
     }
 
@@ -120,43 +119,29 @@ int main(int argc, char *argv[]) {
 
     fprintf(output_file, "      L.control.layers(baseLayers, overlayLayers).addTo(map);\n");
 
-    char line[MAX_LINE_LENGTH];
-    Point line_points[MAX_POINTS];
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    LssBatch batch = {0};
+    int status;
     int point_count = 0;
     int is_first_feature = 1;
     int polyline_counter = 0;
 
-    while (fgets(line, sizeof(line), input_file)) {
-        line[strcspn(line, "\n")] = '\0';
+    // Only coded points belong to strings; a linked code starts a new one
+    while ((status = lss_read_batch(&input_file, &batch, pool)) > 0) {
+        for (size_t i = 0; i < batch.count; i++) {
+            if ((batch.flags[i] & (LSS_FLAG_MALFORMED | LSS_FLAG_NO_Z)) || batch.code[i].len == 0) continue;
 
-        if (strncmp(line, "21", 2) == 0) {
-            char *parts[NUM_PARTS];
-            char *token = strtok(line, ", ");
-            int part_count = 0;
-
-            while (token != NULL && part_count < NUM_PARTS) {
-                parts[part_count++] = token;
-                token = strtok(NULL, ", ");
-            }
-
-            if (part_count == NUM_PARTS) {
-                float x = atof(parts[2]);
-                float y = atof(parts[3]);
-                float z = atof(parts[4]);
-                char *code = parts[5];
-
-                if (strchr(code, '.') != NULL) {
-                    if (!is_first_feature) {
-                        fprintf(output_file, "      ];\n");
-                    }
-                    polyline_counter++;
-                    fprintf(output_file, "      const line%d = [\n", polyline_counter);
-                    is_first_feature = 0;
-                    point_count = 0;
+            if ((batch.flags[i] & LSS_FLAG_LINKED) || is_first_feature) {
+                if (!is_first_feature) {
+                    fprintf(output_file, "      ];\n");
                 }
-                fprintf(output_file, "        [%f, %f],\n", x, y);
-                point_count++;
+                polyline_counter++;
+                fprintf(output_file, "      const line%d = [\n", polyline_counter);
+                is_first_feature = 0;
+                point_count = 0;
             }
+            fprintf(output_file, "        [%f, %f],\n", batch.x[i], batch.y[i]);
+            point_count++;
         }
     }
 
@@ -173,31 +158,13 @@ int main(int argc, char *argv[]) {
     fprintf(output_file, "      linesLayer.addTo(map);\n");
 
     if (include_points){
-        char line[MAX_LINE_LENGTH];
-        float min_z = 999999, max_z = -999999;
-
-        rewind(input_file);
+        lss_rewind(&input_file);
 
         fprintf(output_file, "const points = [\n");
-        while (fgets(line, sizeof(line), input_file)) {
-            char *parts[NUM_PARTS];
-            int part_count = 0;
-            char *token = strtok(line, ", ");
-            while (token != NULL && part_count < NUM_PARTS) {
-                parts[part_count++] = token;
-                token = strtok(NULL, ", ");
-            }
-
-            if (part_count == NUM_PARTS) {
-                float x = atof(parts[2]);
-                float y = atof(parts[3]);
-                float z = atof(parts[4]);
-                if (x == 0.0 ) {
-                    continue; 
-                }
-                if (z < min_z) min_z = z;
-                if (z > max_z) max_z = z;
-                fprintf(output_file, "  {lat: %f, lng: %f, z: %f},\n", y, x, z);
+        while (status >= 0 && (status = lss_read_batch(&input_file, &batch, pool)) > 0) {
+            for (size_t i = 0; i < batch.count; i++) {
+                if (batch.flags[i] & (LSS_FLAG_MALFORMED | LSS_FLAG_NO_Z)) continue;
+                fprintf(output_file, "  {lat: %f, lng: %f, z: %f},\n", batch.y[i], batch.x[i], batch.z[i]);
             }
         }
         fprintf(output_file, "];\n");
@@ -221,11 +188,21 @@ int main(int argc, char *argv[]) {
         fprintf(output_file, "      pointsLayer.addTo(map);\n");
     }
 
+    lss_batch_free(&batch);
+    pool_destroy(pool);
+
+    if (status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_filename);
+        lss_close(&input_file);
+        fclose(output_file);
+        return EXIT_FAILURE;
+    }
+
     fprintf(output_file, "    </script>\n");
     fprintf(output_file, "</body>\n");
     fprintf(output_file, "</html>\n");
 
-    fclose(input_file);
+    lss_close(&input_file);
     fclose(output_file);
 
     printf("HTML file created successfully: %s\n", output_filename);
@@ -0,0 +1,754 @@
+#ifndef LSSINDEX_H
+#define LSSINDEX_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "lssreader.h"
+
+// Spatial index over a parsed LSS survey, for tools that only want the points
+// or lines inside a window (lss2csv, lss2las and lss2dxflines with -bbox or
+// -clip). It holds:
+//  - every well-formed point, stored in the order of a uniform bucket grid so
+//    the points of a cell are contiguous, with the byte position of its line
+//    in the survey so callers can restore survey order or reread the text;
+//  - the positions of the malformed lines, so their warnings can be repeated;
+//  - the line strings (the same runs of coded points the line tools draw),
+//    each with its bounding box and the indices of its points;
+//  - a packed R-tree over the line boxes, bulk loaded in Hilbert order of the
+//    box centres with LSS_INDEX_FANOUT children per node.
+//
+// The index is one block laid out exactly like its file, <survey>.lssi, so a
+// saved index is mapped and used in place. lss_index_open loads it when the
+// survey's stamp still matches and otherwise builds and saves it.
+
+#define LSS_INDEX_MAGIC "LSSI"
+#define LSS_INDEX_VERSION 3
+#define LSS_INDEX_CELL_POINTS 16
+#define LSS_INDEX_MAX_CELLS (1 << 24)
+#define LSS_INDEX_FANOUT 16
+#define LSS_INDEX_HILBERT_ORDER 16
+
+typedef struct {
+    double min_x, min_y;
+    double max_x, max_y;
+} LssBox;
+
+typedef struct {
+    LssBox box;
+    uint64_t first; // into line_points
+    uint32_t count;
+    uint32_t code;
+} LssIndexLine;
+
+// Level 0 nodes hold lines, the others hold nodes of the level below.
+typedef struct {
+    LssBox box;
+    uint64_t first;
+    uint32_t count;
+    uint32_t level;
+} LssIndexNode;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    LssSourceStamp source;
+    uint64_t size;
+    LssBox bounds;
+    double cell_size;
+    uint64_t columns;
+    uint64_t rows;
+    uint64_t point_count;
+    uint64_t line_count;
+    uint64_t line_point_count;
+    uint64_t node_count;
+    uint64_t malformed_count;
+    uint64_t code_count;
+    uint64_t code_text_size;
+    uint64_t x_offset;
+    uint64_t y_offset;
+    uint64_t z_offset;
+    uint64_t position_offset;
+    uint64_t malformed_offset;
+    uint64_t code_offset;
+    uint64_t flags_offset;
+    uint64_t cell_offset;
+    uint64_t line_offset;
+    uint64_t line_point_offset;
+    uint64_t node_offset;
+    uint64_t code_table_offset;
+} LssIndexHeader;
+
+typedef struct {
+    const LssIndexHeader *header;
+    const double *x;
+    const double *y;
+    const double *z;
+    const uint64_t *position;
+    const uint32_t *code;
+    const unsigned char *flags;
+    const uint64_t *cell_start; // columns * rows + 1 entries
+    const LssIndexLine *lines;
+    const uint32_t *line_points;
+    const LssIndexNode *nodes; // root last
+    const uint32_t *code_offsets;
+    const char *code_text;
+    const uint64_t *malformed;
+    MappedFile file;
+    void *owned;
+} LssIndex;
+
+typedef void (*LssIndexVisit)(void *ctx, uint64_t index);
+
+static inline int lss_box_overlaps(LssBox a, LssBox b) {
+    return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+static inline int lss_box_contains(LssBox box, double x, double y) {
+    return x >= box.min_x && x <= box.max_x && y >= box.min_y && y <= box.max_y;
+}
+
+static inline void lss_box_extend(LssBox *box, LssBox other) {
+    if (other.min_x < box->min_x) box->min_x = other.min_x;
+    if (other.min_y < box->min_y) box->min_y = other.min_y;
+    if (other.max_x > box->max_x) box->max_x = other.max_x;
+    if (other.max_y > box->max_y) box->max_y = other.max_y;
+}
+
+static inline LssField lss_index_code(const LssIndex *index, uint32_t code) {
+    LssField field = { index->code_text + index->code_offsets[code],
+                       index->code_offsets[code + 1] - index->code_offsets[code] };
+    return field;
+}
+
+static inline uint64_t lss_index_align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Points the typed views at a block holding a complete index.
+static inline void lss_index_attach(LssIndex *index, const char *base) {
+    const LssIndexHeader *h = (const LssIndexHeader *)base;
+    index->header = h;
+    index->x = (const double *)(base + h->x_offset);
+    index->y = (const double *)(base + h->y_offset);
+    index->z = (const double *)(base + h->z_offset);
+    index->position = (const uint64_t *)(base + h->position_offset);
+    index->code = (const uint32_t *)(base + h->code_offset);
+    index->flags = (const unsigned char *)(base + h->flags_offset);
+    index->cell_start = (const uint64_t *)(base + h->cell_offset);
+    index->lines = (const LssIndexLine *)(base + h->line_offset);
+    index->line_points = (const uint32_t *)(base + h->line_point_offset);
+    index->nodes = (const LssIndexNode *)(base + h->node_offset);
+    index->code_offsets = (const uint32_t *)(base + h->code_table_offset);
+    index->code_text = (const char *)(index->code_offsets + h->code_count + 1);
+    index->malformed = (const uint64_t *)(base + h->malformed_offset);
+}
+
+// Distance of (x, y) along a Hilbert curve over a 2^order square grid.
+static inline uint64_t lss_hilbert(uint32_t x, uint32_t y, int order) {
+    uint64_t d = 0;
+    for (uint32_t s = 1u << (order - 1); s > 0; s >>= 1) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            } else {
+                x &= s - 1;
+                y &= s - 1;
+            }
+            uint32_t t = x;
+            x = y;
+            y = t;
+        } else {
+            x &= s - 1;
+            y &= s - 1;
+        }
+    }
+    return d;
+}
+
+typedef struct {
+    uint64_t key;
+    uint64_t line;
+} LssIndexSortKey;
+
+static inline int lss_index_key_compare(const void *a, const void *b) {
+    const LssIndexSortKey *k1 = (const LssIndexSortKey *)a;
+    const LssIndexSortKey *k2 = (const LssIndexSortKey *)b;
+    if (k1->key != k2->key) return (k1->key > k2->key) - (k1->key < k2->key);
+    return (k1->line > k2->line) - (k1->line < k2->line);
+}
+
+// Records gathered in survey order before they are laid out.
+typedef struct {
+    double *x, *y, *z;
+    uint64_t *position;
+    uint32_t *code;
+    unsigned char *flags;
+    size_t count, capacity;
+    uint64_t *malformed;
+    size_t malformed_count, malformed_capacity;
+    LssField *codes;
+    size_t code_count, code_capacity;
+    uint32_t *slots;
+    size_t slot_count;
+    uint64_t *line_first; // into line_points, line_count + 1 entries
+    size_t line_count, line_capacity;
+    uint32_t *line_points;
+    size_t line_point_count, line_point_capacity;
+} LssIndexInput;
+
+static inline void lss_index_input_free(LssIndexInput *in) {
+    free(in->x);
+    free(in->y);
+    free(in->z);
+    free(in->position);
+    free(in->malformed);
+    free(in->code);
+    free(in->flags);
+    free(in->codes);
+    free(in->slots);
+    free(in->line_first);
+    free(in->line_points);
+    memset(in, 0, sizeof(*in));
+}
+
+// Interns code, keeping code 0 as "no code". Returns -1 on allocation failure.
+static inline int64_t lss_index_intern(LssIndexInput *in, LssField code) {
+    if (code.len == 0) return 0;
+    if ((in->code_count + 1) * 2 > in->slot_count) {
+        size_t slot_count = in->slot_count ? in->slot_count * 2 : 256;
+        uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+        if (!slots) return -1;
+        for (size_t i = 1; i < in->code_count; i++) {
+            size_t slot = lss_hash(in->codes[i]) & (slot_count - 1);
+            while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = (uint32_t)i;
+        }
+        free(in->slots);
+        in->slots = slots;
+        in->slot_count = slot_count;
+    }
+
+    size_t mask = in->slot_count - 1;
+    size_t slot = lss_hash(code) & mask;
+    while (in->slots[slot]) {
+        if (lss_field_equals(in->codes[in->slots[slot]], code)) return in->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+    if (grow_array((void **)&in->codes, &in->code_capacity, in->code_count + 1, sizeof(LssField)) != 0) return -1;
+    in->codes[in->code_count] = code;
+    in->slots[slot] = (uint32_t)in->code_count;
+    return (int64_t)in->code_count++;
+}
+
+// Reads the whole survey text; the cache holds no line positions. Lines start
+// at a linked point or at the first coded point, and skip malformed, codeless
+// and z-less records, as in lss2json.
+static inline int lss_index_gather(LssFile *lss, ThreadPool *pool, LssIndexInput *in) {
+    static const LssField no_code = { "", 0 };
+    if (grow_array((void **)&in->codes, &in->code_capacity, 1, sizeof(LssField)) != 0) return -1;
+    in->codes[0] = no_code;
+    in->code_count = 1;
+
+    LssBatch batch = {0};
+    int status;
+    while ((status = lss_read_batch(lss, &batch, pool)) > 0) {
+        size_t needed = in->count + batch.count;
+        if (grow_array((void **)&in->x, &in->capacity, needed, sizeof(double)) != 0) break;
+        size_t capacity = in->capacity;
+        double *y = realloc(in->y, capacity * sizeof(double));
+        if (y) in->y = y;
+        double *z = realloc(in->z, capacity * sizeof(double));
+        if (z) in->z = z;
+        uint64_t *positions = realloc(in->position, capacity * sizeof(uint64_t));
+        if (positions) in->position = positions;
+        uint32_t *codes = realloc(in->code, capacity * sizeof(uint32_t));
+        if (codes) in->code = codes;
+        unsigned char *flags = realloc(in->flags, capacity);
+        if (flags) in->flags = flags;
+        if (!y || !z || !positions || !codes || !flags) {
+            status = -1;
+            break;
+        }
+
+        for (size_t i = 0; i < batch.count; i++) {
+            uint64_t position = (uint64_t)(batch.line[i].text - lss->file.data);
+            if (batch.flags[i] & LSS_FLAG_MALFORMED) {
+                if (grow_array((void **)&in->malformed, &in->malformed_capacity, in->malformed_count + 1,
+                             sizeof(uint64_t)) != 0) {
+                    status = -1;
+                    break;
+                }
+                in->malformed[in->malformed_count++] = position;
+                continue;
+            }
+
+            int64_t code = lss_index_intern(in, batch.code[i]);
+            if (code < 0) {
+                status = -1;
+                break;
+            }
+            size_t n = in->count++;
+            in->x[n] = batch.x[i];
+            in->y[n] = batch.y[i];
+            in->z[n] = batch.z[i];
+            in->position[n] = position;
+            in->code[n] = (uint32_t)code;
+            in->flags[n] = batch.flags[i];
+            if (code == 0 || (batch.flags[i] & LSS_FLAG_NO_Z)) continue;
+
+            if ((batch.flags[i] & LSS_FLAG_LINKED) || in->line_count == 0) {
+                if (grow_array((void **)&in->line_first, &in->line_capacity, in->line_count + 2, sizeof(uint64_t)) != 0) {
+                    status = -1;
+                    break;
+                }
+                in->line_first[in->line_count++] = in->line_point_count;
+            }
+            if (grow_array((void **)&in->line_points, &in->line_point_capacity, in->line_point_count + 1,
+                         sizeof(uint32_t)) != 0) {
+                status = -1;
+                break;
+            }
+            in->line_points[in->line_point_count++] = (uint32_t)n;
+        }
+        if (status < 0) break;
+    }
+    lss_batch_free(&batch);
+    if (status != 0) return -1;
+
+    if (in->line_count > 0) in->line_first[in->line_count] = in->line_point_count;
+    return 0;
+}
+
+// Lays the gathered records out as a complete index block.
+static inline char *lss_index_layout(const LssIndexInput *in, const LssSourceStamp *source) {
+    size_t n = in->count;
+    LssIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LSS_INDEX_MAGIC, 4);
+    h.version = LSS_INDEX_VERSION;
+    h.source = *source;
+    h.point_count = n;
+    h.line_count = in->line_count;
+    h.line_point_count = in->line_point_count;
+    h.malformed_count = in->malformed_count;
+    h.code_count = in->code_count;
+
+    LssBox bounds = { 0.0, 0.0, 0.0, 0.0 };
+    if (n > 0) {
+        bounds.min_x = bounds.max_x = in->x[0];
+        bounds.min_y = bounds.max_y = in->y[0];
+    }
+    for (size_t i = 1; i < n; i++) {
+        LssBox point = { in->x[i], in->y[i], in->x[i], in->y[i] };
+        lss_box_extend(&bounds, point);
+    }
+    h.bounds = bounds;
+
+    // Square cells holding about LSS_INDEX_CELL_POINTS points each
+    double width = bounds.max_x - bounds.min_x, height = bounds.max_y - bounds.min_y;
+    double cells = (double)n / LSS_INDEX_CELL_POINTS;
+    if (cells < 1.0) cells = 1.0;
+    if (cells > LSS_INDEX_MAX_CELLS) cells = LSS_INDEX_MAX_CELLS;
+    double area = (width > 0.0 ? width : 1.0) * (height > 0.0 ? height : 1.0);
+    h.cell_size = sqrt(area / cells);
+    if (h.cell_size <= 0.0) h.cell_size = 1.0;
+    h.columns = (uint64_t)(width / h.cell_size) + 1;
+    h.rows = (uint64_t)(height / h.cell_size) + 1;
+    while (h.columns * h.rows > 4 * (uint64_t)LSS_INDEX_MAX_CELLS) {
+        h.cell_size *= 2.0;
+        h.columns = (uint64_t)(width / h.cell_size) + 1;
+        h.rows = (uint64_t)(height / h.cell_size) + 1;
+    }
+    uint64_t cell_count = h.columns * h.rows;
+
+    size_t leaf_nodes = (in->line_count + LSS_INDEX_FANOUT - 1) / LSS_INDEX_FANOUT;
+    size_t node_count = 0;
+    for (size_t level = leaf_nodes; level > 0; level = (level == 1) ? 0 : (level + LSS_INDEX_FANOUT - 1) / LSS_INDEX_FANOUT) {
+        node_count += level;
+    }
+    h.node_count = node_count;
+
+    uint64_t text_size = 0;
+    for (size_t i = 0; i < in->code_count; i++) text_size += in->codes[i].len;
+    h.code_text_size = text_size;
+
+    uint64_t offset = lss_index_align(sizeof(LssIndexHeader));
+    h.x_offset = offset;
+    offset += n * sizeof(double);
+    h.y_offset = offset;
+    offset += n * sizeof(double);
+    h.z_offset = offset;
+    offset += n * sizeof(double);
+    h.position_offset = offset;
+    offset += n * sizeof(uint64_t);
+    h.malformed_offset = offset;
+    offset += in->malformed_count * sizeof(uint64_t);
+    h.cell_offset = offset;
+    offset += (cell_count + 1) * sizeof(uint64_t);
+    h.line_offset = offset;
+    offset += in->line_count * sizeof(LssIndexLine);
+    h.node_offset = offset;
+    offset += node_count * sizeof(LssIndexNode);
+    h.code_offset = offset;
+    offset = lss_index_align(offset + n * sizeof(uint32_t));
+    h.line_point_offset = offset;
+    offset = lss_index_align(offset + in->line_point_count * sizeof(uint32_t));
+    h.code_table_offset = offset;
+    offset += (in->code_count + 1) * sizeof(uint32_t) + text_size;
+    h.flags_offset = offset;
+    offset = lss_index_align(offset + n);
+    h.size = offset;
+
+    char *base = calloc(1, (size_t)h.size);
+    uint32_t *cell_of = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *position = malloc((n ? n : 1) * sizeof(uint32_t));
+    LssIndexSortKey *keys = malloc((in->line_count ? in->line_count : 1) * sizeof(LssIndexSortKey));
+    if (!base || !cell_of || !position || !keys) {
+        free(base);
+        free(cell_of);
+        free(position);
+        free(keys);
+        return NULL;
+    }
+    memcpy(base, &h, sizeof(h));
+    LssIndex index;
+    lss_index_attach(&index, base);
+
+    // Counting sort of the points into their cells, keeping survey order
+    uint64_t *cell_start = (uint64_t *)index.cell_start;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t column = (uint64_t)((in->x[i] - bounds.min_x) / h.cell_size);
+        uint64_t row = (uint64_t)((in->y[i] - bounds.min_y) / h.cell_size);
+        if (column >= h.columns) column = h.columns - 1;
+        if (row >= h.rows) row = h.rows - 1;
+        cell_of[i] = (uint32_t)(row * h.columns + column);
+        cell_start[cell_of[i] + 1]++;
+    }
+    for (uint64_t c = 0; c < cell_count; c++) cell_start[c + 1] += cell_start[c];
+    for (size_t i = 0; i < n; i++) {
+        size_t p = (size_t)cell_start[cell_of[i]]++;
+        position[i] = (uint32_t)p;
+        ((double *)index.x)[p] = in->x[i];
+        ((double *)index.y)[p] = in->y[i];
+        ((double *)index.z)[p] = in->z[i];
+        ((uint64_t *)index.position)[p] = in->position[i];
+        ((uint32_t *)index.code)[p] = in->code[i];
+        ((unsigned char *)index.flags)[p] = in->flags[i];
+    }
+    for (uint64_t c = cell_count; c > 0; c--) cell_start[c] = cell_start[c - 1];
+    cell_start[0] = 0;
+
+    // Lines in Hilbert order of their box centres
+    LssBox *boxes = malloc((in->line_count ? in->line_count : 1) * sizeof(LssBox));
+    if (!boxes) {
+        free(base);
+        free(cell_of);
+        free(position);
+        free(keys);
+        return NULL;
+    }
+    double scale_x = width > 0.0 ? ((1u << LSS_INDEX_HILBERT_ORDER) - 1) / width : 0.0;
+    double scale_y = height > 0.0 ? ((1u << LSS_INDEX_HILBERT_ORDER) - 1) / height : 0.0;
+    for (size_t l = 0; l < in->line_count; l++) {
+        uint32_t first = in->line_points[in->line_first[l]];
+        LssBox box = { in->x[first], in->y[first], in->x[first], in->y[first] };
+        for (uint64_t k = in->line_first[l]; k < in->line_first[l + 1]; k++) {
+            uint32_t p = in->line_points[k];
+            LssBox point = { in->x[p], in->y[p], in->x[p], in->y[p] };
+            lss_box_extend(&box, point);
+        }
+        boxes[l] = box;
+        double centre_x = (box.min_x + box.max_x) / 2.0 - bounds.min_x;
+        double centre_y = (box.min_y + box.max_y) / 2.0 - bounds.min_y;
+        keys[l].key = lss_hilbert((uint32_t)(centre_x * scale_x), (uint32_t)(centre_y * scale_y), LSS_INDEX_HILBERT_ORDER);
+        keys[l].line = l;
+    }
+    qsort(keys, in->line_count, sizeof(LssIndexSortKey), lss_index_key_compare);
+
+    LssIndexLine *lines = (LssIndexLine *)index.lines;
+    uint32_t *line_points = (uint32_t *)index.line_points;
+    uint64_t next_point = 0;
+    for (size_t l = 0; l < in->line_count; l++) {
+        size_t source = (size_t)keys[l].line;
+        uint64_t first = in->line_first[source], end = in->line_first[source + 1];
+        lines[l].box = boxes[source];
+        lines[l].first = next_point;
+        lines[l].count = (uint32_t)(end - first);
+        lines[l].code = in->code[in->line_points[first]];
+        for (uint64_t k = first; k < end; k++) {
+            line_points[next_point++] = position[in->line_points[k]];
+        }
+    }
+
+    // Pack the tree bottom up: each level groups FANOUT consecutive entries
+    LssIndexNode *nodes = (LssIndexNode *)index.nodes;
+    size_t node = 0, below_first = 0, below_count = in->line_count;
+    uint32_t level = 0;
+    while (below_count > 0) {
+        size_t level_first = node;
+        for (size_t i = 0; i < below_count; i += LSS_INDEX_FANOUT) {
+            size_t count = below_count - i < LSS_INDEX_FANOUT ? below_count - i : LSS_INDEX_FANOUT;
+            LssIndexNode *parent = &nodes[node++];
+            parent->first = below_first + i;
+            parent->count = (uint32_t)count;
+            parent->level = level;
+            parent->box = level == 0 ? lines[below_first + i].box : nodes[below_first + i].box;
+            for (size_t c = 1; c < count; c++) {
+                lss_box_extend(&parent->box, level == 0 ? lines[below_first + i + c].box : nodes[below_first + i + c].box);
+            }
+        }
+        below_first = level_first;
+        below_count = node - level_first;
+        level++;
+        if (below_count == 1) break;
+    }
+
+    uint32_t *code_offsets = (uint32_t *)index.code_offsets;
+    char *text = (char *)index.code_text;
+    uint32_t text_offset = 0;
+    for (size_t i = 0; i < in->code_count; i++) {
+        code_offsets[i] = text_offset;
+        memcpy(text + text_offset, in->codes[i].text, in->codes[i].len);
+        text_offset += (uint32_t)in->codes[i].len;
+    }
+    code_offsets[in->code_count] = text_offset;
+    memcpy((uint64_t *)index.malformed, in->malformed, in->malformed_count * sizeof(uint64_t));
+
+    free(boxes);
+    free(cell_of);
+    free(position);
+    free(keys);
+    return base;
+}
+
+static inline int lss_index_valid(const MappedFile *file, const LssSourceStamp *source) {
+    if (file->size < sizeof(LssIndexHeader)) return 0;
+    const LssIndexHeader *h = (const LssIndexHeader *)file->data;
+    if (memcmp(h->magic, LSS_INDEX_MAGIC, 4) != 0 || h->version != LSS_INDEX_VERSION) return 0;
+    if (!lss_source_stamp_equal(&h->source, source)) return 0;
+    if (h->size != file->size) return 0;
+
+    uint64_t size = h->size;
+    uint64_t cells = h->columns * h->rows;
+    if (h->columns == 0 || h->rows == 0 || cells / h->columns != h->rows) return 0;
+    if (h->x_offset > size || h->point_count > (size - h->x_offset) / 8) return 0;
+    if (h->y_offset > size || h->point_count > (size - h->y_offset) / 8) return 0;
+    if (h->z_offset > size || h->point_count > (size - h->z_offset) / 8) return 0;
+    if (h->position_offset > size || h->point_count > (size - h->position_offset) / 8) return 0;
+    if (h->malformed_offset > size || h->malformed_count > (size - h->malformed_offset) / 8) return 0;
+    if (h->code_offset > size || h->point_count > (size - h->code_offset) / 4) return 0;
+    if (h->flags_offset > size || h->point_count > size - h->flags_offset) return 0;
+    if (h->cell_offset > size || cells + 1 > (size - h->cell_offset) / 8) return 0;
+    if (h->line_offset > size || h->line_count > (size - h->line_offset) / sizeof(LssIndexLine)) return 0;
+    if (h->line_point_offset > size || h->line_point_count > (size - h->line_point_offset) / 4) return 0;
+    if (h->node_offset > size || h->node_count > (size - h->node_offset) / sizeof(LssIndexNode)) return 0;
+    if (h->code_table_offset > size || h->code_count + 1 > (size - h->code_table_offset) / 4) return 0;
+    uint64_t text_start = h->code_table_offset + (h->code_count + 1) * 4;
+    return h->code_text_size <= size - text_start;
+}
+
+// Writes the index block to <survey>.lssi through a temporary file. A failed
+// save is not an error; the survey is simply indexed again next time.
+static inline void lss_index_save(const char *index_path, const char *base) {
+    const LssIndexHeader *h = (const LssIndexHeader *)base;
+    size_t path_len = strlen(index_path);
+    char *tmp_path = malloc(path_len + 5);
+    if (!tmp_path) return;
+    snprintf(tmp_path, path_len + 5, "%s.tmp", index_path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file) {
+        int failed = fwrite(base, 1, (size_t)h->size, file) != h->size;
+        if (fclose(file) != 0) failed = 1;
+        if (!failed) {
+            remove(index_path);
+            failed = rename(tmp_path, index_path) != 0;
+        }
+        if (failed) remove(tmp_path);
+    }
+    free(tmp_path);
+}
+
+// Opens the index of the survey at path, building and saving it when there is
+// no up-to-date <survey>.lssi. Returns 0, or -1 with errno set when the survey
+// cannot be read or memory runs out.
+static inline int lss_index_open(const char *path, ThreadPool *pool, LssIndex *index) {
+    memset(index, 0, sizeof(*index));
+    LssSourceStamp source;
+    if (lss_source_stamp(path, &source) != 0) return -1;
+
+    size_t path_len = strlen(path);
+    char *index_path = malloc(path_len + 6);
+    if (!index_path) return -1;
+    snprintf(index_path, path_len + 6, "%s.lssi", path);
+
+    if (map_file(index_path, &index->file) == 0) {
+        if (lss_index_valid(&index->file, &source)) {
+            lss_index_attach(index, index->file.data);
+            free(index_path);
+            return 0;
+        }
+        unmap_file(&index->file);
+        memset(&index->file, 0, sizeof(index->file));
+    }
+
+    LssFile lss;
+    if (lss_open(path, &lss) != 0) {
+        free(index_path);
+        return -1;
+    }
+
+    LssIndexInput in;
+    memset(&in, 0, sizeof(in));
+    char *base = NULL;
+    if (lss_index_gather(&lss, pool, &in) == 0) base = lss_index_layout(&in, &source);
+    lss_index_input_free(&in);
+    lss_close(&lss);
+    if (!base) {
+        free(index_path);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    lss_index_save(index_path, base);
+    free(index_path);
+    index->owned = base;
+    lss_index_attach(index, base);
+    return 0;
+}
+
+static inline void lss_index_close(LssIndex *index) {
+    if (index->owned) free(index->owned);
+    else if (index->header) unmap_file(&index->file);
+    memset(index, 0, sizeof(*index));
+}
+
+// Calls visit with the index of every point inside box (edges included), cell
+// by cell.
+static inline void lss_index_query_points(const LssIndex *index, LssBox box, LssIndexVisit visit, void *ctx) {
+    const LssIndexHeader *h = index->header;
+    if (h->point_count == 0 || !lss_box_overlaps(box, h->bounds)) return;
+
+    double min_column = floor((box.min_x - h->bounds.min_x) / h->cell_size);
+    double max_column = floor((box.max_x - h->bounds.min_x) / h->cell_size);
+    double min_row = floor((box.min_y - h->bounds.min_y) / h->cell_size);
+    double max_row = floor((box.max_y - h->bounds.min_y) / h->cell_size);
+    uint64_t first_column = min_column < 0.0 ? 0 : (uint64_t)min_column;
+    uint64_t first_row = min_row < 0.0 ? 0 : (uint64_t)min_row;
+    uint64_t last_column = max_column >= (double)h->columns ? h->columns - 1 : (uint64_t)max_column;
+    uint64_t last_row = max_row >= (double)h->rows ? h->rows - 1 : (uint64_t)max_row;
+
+    for (uint64_t row = first_row; row <= last_row; row++) {
+        // A row of cells is one contiguous run of points
+        uint64_t begin = index->cell_start[row * h->columns + first_column];
+        uint64_t end = index->cell_start[row * h->columns + last_column + 1];
+        for (uint64_t p = begin; p < end; p++) {
+            if (lss_box_contains(box, index->x[p], index->y[p])) visit(ctx, p);
+        }
+    }
+}
+
+// Calls visit with the index of every line whose bounding box overlaps box.
+static inline void lss_index_query_lines(const LssIndex *index, LssBox box, LssIndexVisit visit, void *ctx) {
+    const LssIndexHeader *h = index->header;
+    if (h->node_count == 0) return;
+
+    uint64_t stack[64 * LSS_INDEX_FANOUT];
+    int depth = 0;
+    stack[depth++] = h->node_count - 1;
+    while (depth > 0) {
+        const LssIndexNode *node = &index->nodes[stack[--depth]];
+        if (!lss_box_overlaps(box, node->box)) continue;
+        for (uint32_t c = 0; c < node->count; c++) {
+            uint64_t child = node->first + c;
+            if (node->level == 0) {
+                if (lss_box_overlaps(box, index->lines[child].box)) visit(ctx, child);
+            } else {
+                stack[depth++] = child;
+            }
+        }
+    }
+}
+
+// Sorted selections: the matching points or lines, in survey order.
+typedef struct {
+    LssIndexSortKey *keys;
+    size_t count, capacity;
+    const uint64_t *position;
+    const LssIndex *index;
+    int failed;
+} LssIndexSelection;
+
+static inline void lss_index_select_point(void *ctx, uint64_t point) {
+    LssIndexSelection *s = (LssIndexSelection *)ctx;
+    if (s->failed) return;
+    if (grow_array((void **)&s->keys, &s->capacity, s->count + 1, sizeof(LssIndexSortKey)) != 0) {
+        s->failed = 1;
+        return;
+    }
+    s->keys[s->count].key = s->position[point];
+    s->keys[s->count].line = point;
+    s->count++;
+}
+
+static inline void lss_index_select_line(void *ctx, uint64_t line) {
+    LssIndexSelection *s = (LssIndexSelection *)ctx;
+    const LssIndex *index = s->index;
+    lss_index_select_point(ctx, index->line_points[index->lines[line].first]);
+    if (!s->failed) s->keys[s->count - 1].line = line;
+}
+
+// Puts the matches in survey order and hands them back as a plain array of
+// point or line indices. Returns the count, or -1 when memory ran out.
+static inline int64_t lss_index_selection_finish(LssIndexSelection *s, uint64_t **out) {
+    *out = NULL;
+    if (s->failed) {
+        free(s->keys);
+        return -1;
+    }
+    qsort(s->keys, s->count, sizeof(LssIndexSortKey), lss_index_key_compare);
+    uint64_t *items = malloc((s->count ? s->count : 1) * sizeof(uint64_t));
+    if (items) {
+        for (size_t i = 0; i < s->count; i++) items[i] = s->keys[i].line;
+    }
+    free(s->keys);
+    *out = items;
+    return items ? (int64_t)s->count : -1;
+}
+
+// Finds the points inside box, in survey order. *points is malloc'd and must
+// be freed by the caller.
+static inline int64_t lss_index_select_points(const LssIndex *index, LssBox box, uint64_t **points) {
+    LssIndexSelection s = { NULL, 0, 0, index->position, index, 0 };
+    lss_index_query_points(index, box, lss_index_select_point, &s);
+    return lss_index_selection_finish(&s, points);
+}
+
+// Finds the lines whose bounding box overlaps box, in the survey order of
+// their first points.
+static inline int64_t lss_index_select_lines(const LssIndex *index, LssBox box, uint64_t **lines) {
+    LssIndexSelection s = { NULL, 0, 0, index->position, index, 0 };
+    lss_index_query_lines(index, box, lss_index_select_line, &s);
+    return lss_index_selection_finish(&s, lines);
+}
+
+// Parses the survey line at position (as stored in the index) onto the end of
+// batch. lss must be the survey the index was built from.
+static inline int lss_index_read_line(const LssFile *lss, uint64_t position, LssBatch *batch) {
+    if (position >= lss->file.size) return 0;
+    const char *line = lss->file.data + position;
+    const char *end = lss->file.data + lss->file.size;
+    const char *newline = memchr(line, '\n', (size_t)(end - line));
+    return lss_parse_range(line, newline ? newline : end, batch);
+}
+
+#endif
@@ -2,180 +2,340 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <ctype.h>
+#include <stdint.h>
 #include <math.h>
 
+#include "lssreader.h"
+#include "hull.h"
+
+#define Z_HISTOGRAM_BINS 4096
+#define Z_HISTOGRAM_REPORT_BINS 10
+#define DENSITY_CELL_SIZE 10.0
+#define DENSITY_BUCKETS 32
+
+// Per feature code totals. Codes are views into the survey (or its cache),
+// kept in first-seen order and found through an open-addressing table.
+typedef struct {
+    LssField code;
+    uint64_t points;
+    uint64_t lines;
+    uint64_t z_points; // points with a surveyed z
+    double min_z, max_z, total_z;
+} CodeStats;
+
+typedef struct {
+    CodeStats *entries;
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;
+    size_t slot_count;
+} CodeTable;
+
+// Z histogram kept in one streaming pass: a fixed number of fine bins that
+// re-centre when a value falls outside them and double their width when the
+// data no longer fits. Bins are indexed by floor(z / width).
 typedef struct {
-    double x, y;
-} Point;
-
-int compare(const void *a, const void *b) {
-    Point *p1 = (Point *)a;
-    Point *p2 = (Point *)b;
-    if (p1->x != p2->x)
-        return (p1->x > p2->x) - (p1->x < p2->x);
-    return (p1->y > p2->y) - (p1->y < p2->y);
+    double width;
+    int64_t origin;
+    int64_t low_key, high_key;
+    uint64_t total;
+    uint64_t counts[Z_HISTOGRAM_BINS];
+} ZHistogram;
+
+// Points per DENSITY_CELL_SIZE square cell, keyed by cell column and row
+typedef struct {
+    int64_t *keys;
+    uint32_t *counts;
+    size_t used;
+    size_t slot_count;
+} DensityGrid;
+
+CodeStats *code_table_find(CodeTable *table, LssField code) {
+    if ((table->count + 1) * 2 > table->slot_count) {
+        size_t slot_count = table->slot_count ? table->slot_count * 2 : 64;
+        uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+        if (!slots) return NULL;
+        for (size_t i = 0; i < table->count; i++) {
+            size_t slot = lss_hash(table->entries[i].code) & (slot_count - 1);
+            while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = (uint32_t)(i + 1);
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->slot_count = slot_count;
+    }
+
+    size_t mask = table->slot_count - 1;
+    size_t slot = lss_hash(code) & mask;
+    while (table->slots[slot]) {
+        CodeStats *entry = &table->entries[table->slots[slot] - 1];
+        if (lss_field_equals(entry->code, code)) return entry;
+        slot = (slot + 1) & mask;
+    }
+
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 64;
+        CodeStats *entries = realloc(table->entries, capacity * sizeof(CodeStats));
+        if (!entries) return NULL;
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    CodeStats *entry = &table->entries[table->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->code = code;
+    entry->min_z = INFINITY;
+    entry->max_z = -INFINITY;
+    table->slots[slot] = (uint32_t)table->count;
+    return entry;
 }
 
-double cross(Point o, Point a, Point b) {
-    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+int64_t floor_half(int64_t key) {
+    return key >= 0 ? key / 2 : -((-key + 1) / 2);
 }
 
-void compute_convex_hull(Point *points, int n, Point **hull, int *hull_size) {
-    *hull = malloc(n * sizeof(Point));
-    if (!*hull) {
-        fprintf(stderr, "Memory allocation failed for hull.\n");
-        exit(1);
+void z_histogram_add(ZHistogram *h, double z) {
+    if (!isfinite(z)) return;
+    int64_t key = (int64_t)floor(z / h->width);
+    if (h->total == 0) {
+        h->origin = key - Z_HISTOGRAM_BINS / 2;
+        h->low_key = h->high_key = key;
     }
 
-    qsort(points, n, sizeof(Point), compare);
+    while (key < h->origin || key >= h->origin + Z_HISTOGRAM_BINS) {
+        int64_t low = key < h->low_key ? key : h->low_key;
+        int64_t high = key > h->high_key ? key : h->high_key;
+        if (high - low < Z_HISTOGRAM_BINS) {
+            int64_t origin = low - (Z_HISTOGRAM_BINS - (high - low + 1)) / 2;
+            uint64_t counts[Z_HISTOGRAM_BINS] = {0};
+            for (int64_t k = h->low_key; k <= h->high_key; k++) counts[k - origin] = h->counts[k - h->origin];
+            memcpy(h->counts, counts, sizeof(counts));
+            h->origin = origin;
+            break;
+        }
 
-    int k = 0;
-    for (int i = 0; i < n; ++i) {
-        while (k >= 2 && cross((*hull)[k - 2], (*hull)[k - 1], points[i]) <= 0)
-            k--;
-        (*hull)[k++] = points[i];
+        uint64_t counts[Z_HISTOGRAM_BINS] = {0};
+        int64_t origin = floor_half(h->origin);
+        for (int i = 0; i < Z_HISTOGRAM_BINS; i++) counts[floor_half(h->origin + i) - origin] += h->counts[i];
+        memcpy(h->counts, counts, sizeof(counts));
+        h->origin = origin;
+        h->low_key = floor_half(h->low_key);
+        h->high_key = floor_half(h->high_key);
+        h->width *= 2.0;
+        key = (int64_t)floor(z / h->width);
     }
 
-    for (int i = n - 2, t = k + 1; i >= 0; --i) {
-        while (k >= t && cross((*hull)[k - 2], (*hull)[k - 1], points[i]) <= 0)
-            k--;
-        (*hull)[k++] = points[i];
+    h->counts[key - h->origin]++;
+    if (key < h->low_key) h->low_key = key;
+    if (key > h->high_key) h->high_key = key;
+    h->total++;
+}
+
+uint64_t cell_hash(int64_t column, int64_t row) {
+    uint64_t h = (uint64_t)column * 0x9E3779B97F4A7C15ull ^ (uint64_t)row * 0xC2B2AE3D27D4EB4Full;
+    return h ^ (h >> 29);
+}
+
+int density_add(DensityGrid *grid, double x, double y) {
+    if (!isfinite(x) || !isfinite(y)) return 0;
+    if ((grid->used + 1) * 2 > grid->slot_count) {
+        size_t slot_count = grid->slot_count ? grid->slot_count * 2 : 1024;
+        int64_t *keys = malloc(slot_count * 2 * sizeof(int64_t));
+        uint32_t *counts = calloc(slot_count, sizeof(uint32_t));
+        if (!keys || !counts) {
+            free(keys);
+            free(counts);
+            return -1;
+        }
+        for (size_t i = 0; i < grid->slot_count; i++) {
+            if (!grid->counts[i]) continue;
+            size_t slot = cell_hash(grid->keys[2 * i], grid->keys[2 * i + 1]) & (slot_count - 1);
+            while (counts[slot]) slot = (slot + 1) & (slot_count - 1);
+            keys[2 * slot] = grid->keys[2 * i];
+            keys[2 * slot + 1] = grid->keys[2 * i + 1];
+            counts[slot] = grid->counts[i];
+        }
+        free(grid->keys);
+        free(grid->counts);
+        grid->keys = keys;
+        grid->counts = counts;
+        grid->slot_count = slot_count;
     }
-    *hull_size = k - 1;
+
+    int64_t column = (int64_t)floor(x / DENSITY_CELL_SIZE);
+    int64_t row = (int64_t)floor(y / DENSITY_CELL_SIZE);
+    size_t mask = grid->slot_count - 1;
+    size_t slot = cell_hash(column, row) & mask;
+    while (grid->counts[slot]) {
+        if (grid->keys[2 * slot] == column && grid->keys[2 * slot + 1] == row) {
+            grid->counts[slot]++;
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+    grid->keys[2 * slot] = column;
+    grid->keys[2 * slot + 1] = row;
+    grid->counts[slot] = 1;
+    grid->used++;
+    return 0;
+}
+
+void print_json_string(const char *text, size_t len) {
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input.00{x}>\n", argv[0]);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input.00{x}> [-threads N] [-json]\n", argv[0]);
         return 1;
     }
 
+    int thread_count = 1;
+    int json = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) {
+                fprintf(stderr, "Invalid thread count. It must be at least 1.\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-json") == 0) {
+            json = 1;
+        }
+    }
+
     char *input_file = argv[1];
 
-    FILE *fp = fopen(input_file, "r");
-    if (fp == NULL) {
+    LssFile lss;
+    if (lss_open(input_file, &lss) != 0) {
         fprintf(stderr, "Error opening input file '%s': %s\n", input_file, strerror(errno));
         return 1;
     }
+    lss_enable_cache(&lss, input_file);
 
-    int capacity = 1000;
     int point_count = 0;
-    Point *points = malloc(capacity * sizeof(Point));
-    if (!points) {
+    HullBuilder boundary;
+    ZHistogram *z_histogram = calloc(1, sizeof(ZHistogram));
+    if (!z_histogram || hull_init(&boundary) != 0) {
         fprintf(stderr, "Memory allocation failed for points.\n");
-        fclose(fp);
+        free(z_histogram);
+        lss_close(&lss);
         return 1;
     }
+    z_histogram->width = 0.01;
 
     double min_x = 9999999, max_x = -9999999;
     double min_y = 9999999, max_y = -9999999;
     double min_z = 9999999, max_z = -9999999;
     double total_z = 0.0;
+    int z_count = 0;
     int link_count = 0;
 
-    char line[255];
-    char feature_codes[1000][10];
-    int feature_code_count = 0;
-
-    while (fgets(line, sizeof(line), fp)) {
-        char *newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-
-        if (strncmp(line, "21", 2) != 0) continue;
-
-        char clean_line[255] = "";
-        char *src = line, *dest = clean_line;
-        while (*src) {
-            if (!isspace((unsigned char)*src)) {
-                *dest++ = *src;
+    CodeTable codes = {0};
+    DensityGrid density = {0};
+    int out_of_memory = 0;
+
+    // Everything is gathered in this one pass over the records
+    ThreadPool *pool = thread_count > 1 ? pool_create(thread_count) : NULL;
+    LssBatch batch = {0};
+    int status;
+    while (!out_of_memory && (status = lss_read_batch(&lss, &batch, pool)) > 0) {
+        for (size_t i = 0; i < batch.count; i++) {
+            if (batch.flags[i] & LSS_FLAG_MALFORMED) {
+                fprintf(stderr, "Malformed line: %.*s\n", (int)batch.line[i].len, batch.line[i].text);
+                continue;
             }
-            src++;
-        }
-        *dest = '\0';
-
-        char *fields[6];
-        int field_count = 0;
-        char *token = strtok(clean_line, ",");
-        while (token != NULL && field_count < 6) {
-            fields[field_count++] = token;
-            token = strtok(NULL, ",");
-        }
 
-        if (field_count < 5) {
-            fprintf(stderr, "Malformed line: %s\n", line);
-            continue;
-        }
+            double x = batch.x[i];
+            double y = batch.y[i];
+            double z = batch.z[i];
+            int linked = (batch.flags[i] & LSS_FLAG_LINKED) != 0;
+            int has_z = !(batch.flags[i] & LSS_FLAG_NO_Z);
 
-        if (point_count >= capacity) {
-            capacity *= 2;
-            points = realloc(points, capacity * sizeof(Point));
-            if (!points) {
-                fprintf(stderr, "Memory reallocation failed for points.\n");
-                fclose(fp);
-                return 1;
+            if (hull_add(&boundary, x, y) != 0) {
+                out_of_memory = 1;
+                break;
             }
-        }
-
-        double x = atof(fields[2]);
-        double y = atof(fields[3]);
-        double z = atof(fields[4]);
-
-        points[point_count].x = x;
-        points[point_count].y = y;
-        point_count++;
-
-        if (x < min_x) min_x = x;
-        if (x > max_x) max_x = x;
-        if (y < min_y) min_y = y;
-        if (y > max_y) max_y = y;
-        if (z < min_z) min_z = z;
-        if (z > max_z) max_z = z;
-
-        total_z += z;
-
-        if (field_count == 6 && strchr(fields[5], '.') != NULL) {
-            link_count++;
-        }
-
-        if (field_count == 6) {
-            char feature_code[10];
-            char *src_code = fields[5];
-            char *dest_code = feature_code;
-            while (*src_code) {
-                if (*src_code != '.') {
-                    *dest_code++ = *src_code;
-                }
-                src_code++;
+            point_count++;
+
+            if (x < min_x) min_x = x;
+            if (x > max_x) max_x = x;
+            if (y < min_y) min_y = y;
+            if (y > max_y) max_y = y;
+            link_count += linked;
+
+            // Records without a z count as points but not as heights
+            if (has_z) {
+                if (z < min_z) min_z = z;
+                if (z > max_z) max_z = z;
+                total_z += z;
+                z_count++;
+                z_histogram_add(z_histogram, z);
+            }
+            if (density_add(&density, x, y) != 0) {
+                out_of_memory = 1;
+                break;
             }
-            *dest_code = '\0';
 
-            int found = 0;
-            for (int i = 0; i < feature_code_count; i++) {
-                if (strcmp(feature_codes[i], feature_code) == 0) {
-                    found = 1;
+            if (batch.code[i].len > 0) {
+                CodeStats *entry = code_table_find(&codes, batch.code[i]);
+                if (!entry) {
+                    out_of_memory = 1;
                     break;
                 }
-            }
-            if (!found) {
-                strncpy(feature_codes[feature_code_count], feature_code, 9);
-                feature_codes[feature_code_count][9] = '\0';
-                feature_code_count++;
+                entry->points++;
+                entry->lines += linked;
+                if (has_z) {
+                    entry->z_points++;
+                    entry->total_z += z;
+                    if (z < entry->min_z) entry->min_z = z;
+                    if (z > entry->max_z) entry->max_z = z;
+                }
             }
         }
     }
-    fclose(fp);
-
-    if (point_count < 3) {
+    lss_batch_free(&batch);
+    pool_destroy(pool);
+
+    int failed = 0;
+    if (out_of_memory || status < 0) {
+        fprintf(stderr, "Memory allocation failed while reading '%s'\n", input_file);
+        failed = 1;
+    } else if (point_count < 3) {
         fprintf(stderr, "Not enough points to form a convex hull.\n");
-        free(points);
+        failed = 1;
+    }
+    if (failed) {
+        hull_free(&boundary);
+        free(z_histogram);
+        free(codes.entries);
+        free(codes.slots);
+        free(density.keys);
+        free(density.counts);
+        lss_close(&lss);
         return 1;
     }
 
-    Point *hull;
+    HullPoint *hull;
     int hull_size;
-    compute_convex_hull(points, point_count, &hull, &hull_size);
-    free(points);
+    if (hull_finish(&boundary, &hull, &hull_size) != 0) {
+        fprintf(stderr, "Memory allocation failed for hull.\n");
+        hull_free(&boundary);
+        free(z_histogram);
+        free(codes.entries);
+        free(codes.slots);
+        free(density.keys);
+        free(density.counts);
+        lss_close(&lss);
+        return 1;
+    }
+    hull_free(&boundary);
 
     double centroid_x = 0.0, centroid_y = 0.0;
     for (int i = 0; i < hull_size; ++i) {
@@ -185,25 +345,135 @@ int main(int argc, char *argv[]) {
     centroid_x /= hull_size;
     centroid_y /= hull_size;
 
-    printf("Total points in survey: %d\n", point_count);
-    printf("Total links in survey: %d\n", link_count);
-    printf("Min_x, Min_y, Min_z: %.6f, %.6f, %.6f\n", min_x, min_y, min_z);
-    printf("Max_x, Max_y, Max_z: %.6f, %.6f, %.6f\n", max_x, max_y, max_z);
-    printf("Average Z: %.6f\n", total_z / point_count);
-    printf("Boundary: ");
-    for (int i = 0; i < hull_size; ++i) {
-        printf("[%.6f,%.6f]%s", hull[i].x, hull[i].y, (i == hull_size - 1) ? "" : ",");
+    // Z figures only cover points with a z; with none they report 0
+    double average_z = z_count > 0 ? total_z / z_count : 0.0;
+    if (z_count == 0) min_z = max_z = 0.0;
+    for (size_t i = 0; i < codes.count; i++) {
+        CodeStats *entry = &codes.entries[i];
+        if (entry->z_points == 0) entry->min_z = entry->max_z = 0.0;
     }
-    printf("\n");
-    printf("Centroid: [%.6f,%.6f]\n", centroid_x, centroid_y);
 
-    printf("Feature codes present: ");
-    for (int i = 0; i < feature_code_count; i++) {
-        printf("%s%s", feature_codes[i], (i == feature_code_count - 1) ? "" : ",");
+    // Fold the fine Z bins into equal report bins between the Z bounds
+    uint64_t z_bins[Z_HISTOGRAM_REPORT_BINS] = {0};
+    double z_step = (max_z - min_z) / Z_HISTOGRAM_REPORT_BINS;
+    for (int i = 0; i < Z_HISTOGRAM_BINS; i++) {
+        if (!z_histogram->counts[i]) continue;
+        double centre = (z_histogram->origin + i + 0.5) * z_histogram->width;
+        int bin = z_step > 0.0 ? (int)((centre - min_z) / z_step) : 0;
+        if (bin < 0) bin = 0;
+        if (bin > Z_HISTOGRAM_REPORT_BINS - 1) bin = Z_HISTOGRAM_REPORT_BINS - 1;
+        z_bins[bin] += z_histogram->counts[i];
+    }
+
+    // Cells grouped by point count in powers of two: 1, 2-3, 4-7, ...
+    uint64_t density_bins[DENSITY_BUCKETS] = {0};
+    uint32_t densest_cell = 0;
+    for (size_t i = 0; i < density.slot_count; i++) {
+        uint32_t count = density.counts[i];
+        if (!count) continue;
+        int bucket = 0;
+        while ((count >> (bucket + 1)) && bucket < DENSITY_BUCKETS - 1) bucket++;
+        density_bins[bucket]++;
+        if (count > densest_cell) densest_cell = count;
+    }
+    double occupied_area = density.used * DENSITY_CELL_SIZE * DENSITY_CELL_SIZE;
+    double points_per_m2 = occupied_area > 0.0 ? point_count / occupied_area : 0.0;
+
+    if (json) {
+        printf("{\n");
+        printf("  \"points\": %d,\n", point_count);
+        printf("  \"links\": %d,\n", link_count);
+        printf("  \"min\": [%.6f, %.6f, %.6f],\n", min_x, min_y, min_z);
+        printf("  \"max\": [%.6f, %.6f, %.6f],\n", max_x, max_y, max_z);
+        printf("  \"average_z\": %.6f,\n", average_z);
+        printf("  \"boundary\": [");
+        for (int i = 0; i < hull_size; ++i) {
+            printf("[%.6f, %.6f]%s", hull[i].x, hull[i].y, (i == hull_size - 1) ? "" : ", ");
+        }
+        printf("],\n");
+        printf("  \"centroid\": [%.6f, %.6f],\n", centroid_x, centroid_y);
+        printf("  \"feature_codes\": [\n");
+        for (size_t i = 0; i < codes.count; i++) {
+            CodeStats *entry = &codes.entries[i];
+            printf("    {\"code\": ");
+            print_json_string(entry->code.text, entry->code.len);
+            printf(", \"points\": %llu, \"lines\": %llu, \"min_z\": %.6f, \"max_z\": %.6f, \"mean_z\": %.6f}%s\n",
+                   (unsigned long long)entry->points, (unsigned long long)entry->lines, entry->min_z, entry->max_z,
+                   entry->z_points > 0 ? entry->total_z / entry->z_points : 0.0, (i == codes.count - 1) ? "" : ",");
+        }
+        printf("  ],\n");
+        printf("  \"z_histogram\": [\n");
+        for (int i = 0; i < Z_HISTOGRAM_REPORT_BINS; i++) {
+            printf("    {\"from\": %.6f, \"to\": %.6f, \"points\": %llu}%s\n", min_z + i * z_step,
+                   (i == Z_HISTOGRAM_REPORT_BINS - 1) ? max_z : min_z + (i + 1) * z_step,
+                   (unsigned long long)z_bins[i], (i == Z_HISTOGRAM_REPORT_BINS - 1) ? "" : ",");
+        }
+        printf("  ],\n");
+        printf("  \"density\": {\n");
+        printf("    \"cell_size\": %.1f,\n", DENSITY_CELL_SIZE);
+        printf("    \"occupied_cells\": %llu,\n", (unsigned long long)density.used);
+        printf("    \"points_per_m2\": %.6f,\n", points_per_m2);
+        printf("    \"max_points_per_cell\": %u,\n", densest_cell);
+        printf("    \"histogram\": [");
+        int first_bucket = 1;
+        for (int i = 0; i < DENSITY_BUCKETS; i++) {
+            if (!density_bins[i]) continue;
+            printf("%s\n      {\"min_points\": %llu, \"max_points\": %llu, \"cells\": %llu}", first_bucket ? "" : ",",
+                   1ull << i, (2ull << i) - 1, (unsigned long long)density_bins[i]);
+            first_bucket = 0;
+        }
+        printf("\n    ]\n");
+        printf("  }\n");
+        printf("}\n");
+    } else {
+        printf("Total points in survey: %d\n", point_count);
+        printf("Total links in survey: %d\n", link_count);
+        printf("Min_x, Min_y, Min_z: %.6f, %.6f, %.6f\n", min_x, min_y, min_z);
+        printf("Max_x, Max_y, Max_z: %.6f, %.6f, %.6f\n", max_x, max_y, max_z);
+        printf("Average Z: %.6f\n", average_z);
+        printf("Boundary: ");
+        for (int i = 0; i < hull_size; ++i) {
+            printf("[%.6f,%.6f]%s", hull[i].x, hull[i].y, (i == hull_size - 1) ? "" : ",");
+        }
+        printf("\n");
+        printf("Centroid: [%.6f,%.6f]\n", centroid_x, centroid_y);
+
+        printf("Feature codes present: ");
+        for (size_t i = 0; i < codes.count; i++) {
+            printf("%.*s%s", (int)codes.entries[i].code.len, codes.entries[i].code.text,
+                   (i == codes.count - 1) ? "" : ",");
+        }
+        printf("\n");
+
+        printf("Feature code statistics:\n");
+        for (size_t i = 0; i < codes.count; i++) {
+            CodeStats *entry = &codes.entries[i];
+            printf("  %.*s: %llu points, %llu lines, Z %.6f to %.6f, mean %.6f\n", (int)entry->code.len,
+                   entry->code.text, (unsigned long long)entry->points, (unsigned long long)entry->lines,
+                   entry->min_z, entry->max_z, entry->z_points > 0 ? entry->total_z / entry->z_points : 0.0);
+        }
+
+        printf("Z histogram:\n");
+        for (int i = 0; i < Z_HISTOGRAM_REPORT_BINS; i++) {
+            printf("  %.6f to %.6f: %llu\n", min_z + i * z_step,
+                   (i == Z_HISTOGRAM_REPORT_BINS - 1) ? max_z : min_z + (i + 1) * z_step, (unsigned long long)z_bins[i]);
+        }
+
+        printf("Point density (%.0f m cells): %llu occupied cells, %.6f points/m2, at most %u points in a cell\n",
+               DENSITY_CELL_SIZE, (unsigned long long)density.used, points_per_m2, densest_cell);
+        for (int i = 0; i < DENSITY_BUCKETS; i++) {
+            if (!density_bins[i]) continue;
+            printf("  %llu-%llu points: %llu cells\n", 1ull << i, (2ull << i) - 1, (unsigned long long)density_bins[i]);
+        }
     }
-    printf("\n");
 
     free(hull);
+    free(z_histogram);
+    free(codes.entries);
+    free(codes.slots);
+    free(density.keys);
+    free(density.counts);
+    lss_close(&lss);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,796 @@
+#ifndef LSSREADER_H
+#define LSSREADER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "grow.h"
+#include "mapfile.h"
+#include "numscan.h"
+#include "parallel.h"
+
+// Shared LSS survey reader for the lss* tools. The file is mapped once and
+// every "21" point record is split in place into views of the mapped bytes,
+// replacing the per-tool fgets/strtok loops that each had their own line
+// limit, delimiter set and field count rules.
+//
+// A point record is "21, id, x, y, z[, code]" with optional blanks around
+// each comma. A '.' in the code marks the first point of a new linked string;
+// the code view has trailing dots trimmed so "WL." and "WL" compare equal.
+// The z may be empty or left out: the x/y exporters keep such records, tools
+// that need a height skip them by LSS_FLAG_NO_Z.
+//
+// Records are read in batches of columns (x, y, z, flags, code, line and the
+// coordinate text), so callers loop over plain arrays and the parse can be
+// split across a thread pool without changing the record order.
+//
+// lss_enable_cache keeps a binary copy of the parsed columns next to the
+// survey (<survey>.lssc). The first read writes it, later runs map it and
+// skip the text parse entirely until the survey changes.
+
+#define LSS_END 0
+#define LSS_RECORD 1
+#define LSS_MALFORMED 2
+
+#define LSS_MAX_FIELDS 6
+
+typedef struct {
+    const char *text;
+    size_t len;
+} LssField;
+
+typedef struct {
+    LssField line;
+    LssField id;
+    LssField x_text;
+    LssField y_text;
+    LssField z_text;
+    LssField code;
+    double x, y, z;
+    int linked;
+    int no_z;
+} LssRecord;
+
+struct LssCacheWriter;
+
+typedef struct {
+    MappedFile file;
+    const char *cursor;
+    const char *end;
+    MappedFile cache;
+    int cached;
+    uint64_t next_block;
+    struct LssCacheWriter *writer;
+} LssFile;
+
+static inline int lss_is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline int lss_field_equals(LssField a, LssField b) {
+    return a.len == b.len && memcmp(a.text, b.text, a.len) == 0;
+}
+
+static inline int lss_field_is(LssField field, const char *text) {
+    size_t len = strlen(text);
+    return field.len == len && memcmp(field.text, text, len) == 0;
+}
+
+static inline int lss_parse_number(LssField field, double *out) {
+    if (field.len == 0) return 0;
+    const char *end = field.text + field.len;
+    return scan_double(field.text, end, out) == end;
+}
+
+// Parses one line (without its newline). Returns LSS_RECORD for a point
+// record, LSS_MALFORMED for a "21" line that is missing x or y or has a
+// coordinate that is not a number, and LSS_END for any other record type. A
+// record may leave z out or empty; it then has z 0, an empty z_text and no_z.
+static inline int lss_parse_line(const char *line, const char *eol, LssRecord *rec) {
+    while (eol > line && lss_is_blank(eol[-1])) eol--;
+    rec->line.text = line;
+    rec->line.len = (size_t)(eol - line);
+
+    const char *p = line;
+    while (p < eol && lss_is_blank(*p)) p++;
+    if (eol - p < 2 || p[0] != '2' || p[1] != '1') return LSS_END;
+
+    LssField fields[LSS_MAX_FIELDS];
+    int field_count = 0;
+    while (field_count < LSS_MAX_FIELDS) {
+        while (p < eol && lss_is_blank(*p)) p++;
+        const char *start = p;
+        while (p < eol && *p != ',') p++;
+        const char *stop = p;
+        while (stop > start && lss_is_blank(stop[-1])) stop--;
+        fields[field_count].text = start;
+        fields[field_count].len = (size_t)(stop - start);
+        field_count++;
+        if (p == eol) break;
+        p++;
+    }
+
+    if (!lss_field_is(fields[0], "21")) return LSS_END;
+    if (field_count < 4) return LSS_MALFORMED;
+
+    rec->id = fields[1];
+    rec->x_text = fields[2];
+    rec->y_text = fields[3];
+    rec->z_text.text = eol;
+    rec->z_text.len = 0;
+    if (field_count > 4) rec->z_text = fields[4];
+    if (!lss_parse_number(rec->x_text, &rec->x) || !lss_parse_number(rec->y_text, &rec->y)) return LSS_MALFORMED;
+
+    rec->z = 0.0;
+    rec->no_z = rec->z_text.len == 0;
+    if (!rec->no_z && !lss_parse_number(rec->z_text, &rec->z)) return LSS_MALFORMED;
+
+    rec->code.text = eol;
+    rec->code.len = 0;
+    rec->linked = 0;
+    if (field_count > 5) {
+        rec->code = fields[5];
+        rec->linked = memchr(rec->code.text, '.', rec->code.len) != NULL;
+        while (rec->code.len > 0 && rec->code.text[rec->code.len - 1] == '.') rec->code.len--;
+    }
+    return LSS_RECORD;
+}
+
+#define LSS_FLAG_LINKED 1
+#define LSS_FLAG_MALFORMED 2
+#define LSS_FLAG_NO_Z 4
+
+#define LSS_BATCH_BYTES (4 << 20)
+#define LSS_CHUNKS_PER_THREAD 4
+
+struct LssChunk;
+
+// One batch of records in file order. text holds three views per record: the
+// x, y and z fields exactly as written. Malformed records keep only their line.
+typedef struct {
+    double *x;
+    double *y;
+    double *z;
+    unsigned char *flags;
+    LssField *code;
+    LssField *line;
+    LssField *text;
+    size_t count;
+    size_t capacity;
+    struct LssChunk *chunks;
+    int chunk_count;
+} LssBatch;
+
+typedef struct LssChunk {
+    const char *begin;
+    const char *end;
+    size_t first;
+    int failed;
+    LssBatch records;
+} LssChunk;
+
+static inline int lss_batch_reserve(LssBatch *batch, size_t capacity) {
+    if (capacity <= batch->capacity) return 0;
+    size_t new_capacity = batch->capacity ? batch->capacity : 4096;
+    while (new_capacity < capacity) new_capacity *= 2;
+
+    double *x = realloc(batch->x, new_capacity * sizeof(double));
+    if (x) batch->x = x;
+    double *y = realloc(batch->y, new_capacity * sizeof(double));
+    if (y) batch->y = y;
+    double *z = realloc(batch->z, new_capacity * sizeof(double));
+    if (z) batch->z = z;
+    unsigned char *flags = realloc(batch->flags, new_capacity);
+    if (flags) batch->flags = flags;
+    LssField *code = realloc(batch->code, new_capacity * sizeof(LssField));
+    if (code) batch->code = code;
+    LssField *line = realloc(batch->line, new_capacity * sizeof(LssField));
+    if (line) batch->line = line;
+    LssField *text = realloc(batch->text, new_capacity * 3 * sizeof(LssField));
+    if (text) batch->text = text;
+    if (!x || !y || !z || !flags || !code || !line || !text) return -1;
+
+    batch->capacity = new_capacity;
+    return 0;
+}
+
+static inline void lss_batch_free(LssBatch *batch) {
+    for (int i = 0; i < batch->chunk_count; i++) {
+        lss_batch_free(&batch->chunks[i].records);
+    }
+    free(batch->chunks);
+    free(batch->x);
+    free(batch->y);
+    free(batch->z);
+    free(batch->flags);
+    free(batch->code);
+    free(batch->line);
+    free(batch->text);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Parses every line in [p, end) onto the end of batch. Returns -1 if the
+// columns could not grow.
+static inline int lss_parse_range(const char *p, const char *end, LssBatch *batch) {
+    LssRecord rec;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = newline ? newline : end;
+        const char *line = p;
+        p = newline ? newline + 1 : end;
+
+        int status = lss_parse_line(line, eol, &rec);
+        if (status == LSS_END) continue;
+        if (batch->count == batch->capacity && lss_batch_reserve(batch, batch->count + 1) != 0) return -1;
+
+        size_t i = batch->count++;
+        batch->line[i] = rec.line;
+        if (status == LSS_MALFORMED) {
+            batch->x[i] = batch->y[i] = batch->z[i] = 0.0;
+            batch->flags[i] = LSS_FLAG_MALFORMED;
+            batch->code[i].text = rec.line.text;
+            batch->code[i].len = 0;
+            continue;
+        }
+        batch->x[i] = rec.x;
+        batch->y[i] = rec.y;
+        batch->z[i] = rec.z;
+        batch->flags[i] = (rec.linked ? LSS_FLAG_LINKED : 0) | (rec.no_z ? LSS_FLAG_NO_Z : 0);
+        batch->code[i] = rec.code;
+        batch->text[3 * i] = rec.x_text;
+        batch->text[3 * i + 1] = rec.y_text;
+        batch->text[3 * i + 2] = rec.z_text;
+    }
+    return 0;
+}
+
+static inline const char *lss_next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', (size_t)(end - p));
+    return newline ? newline + 1 : end;
+}
+
+static inline void lss_parse_task(void *ctx, int index) {
+    LssChunk *chunk = &((LssBatch *)ctx)->chunks[index];
+    chunk->records.count = 0;
+    chunk->failed = lss_parse_range(chunk->begin, chunk->end, &chunk->records) != 0;
+}
+
+static inline void lss_merge_task(void *ctx, int index) {
+    LssBatch *batch = (LssBatch *)ctx;
+    LssChunk *chunk = &batch->chunks[index];
+    const LssBatch *part = &chunk->records;
+    size_t first = chunk->first;
+    size_t n = part->count;
+
+    memcpy(batch->x + first, part->x, n * sizeof(double));
+    memcpy(batch->y + first, part->y, n * sizeof(double));
+    memcpy(batch->z + first, part->z, n * sizeof(double));
+    memcpy(batch->flags + first, part->flags, n);
+    memcpy(batch->code + first, part->code, n * sizeof(LssField));
+    memcpy(batch->line + first, part->line, n * sizeof(LssField));
+    memcpy(batch->text + 3 * first, part->text, 3 * n * sizeof(LssField));
+}
+
+// Parses the next window of the survey text. With a pool the window is cut
+// into chunks at line boundaries, the chunks are parsed concurrently into
+// their own columns and then copied back in file order, so linked strings come
+// out exactly as a serial read would give them.
+static inline int lss_read_text_batch(LssFile *lss, LssBatch *batch, ThreadPool *pool) {
+    batch->count = 0;
+
+    while (batch->count == 0 && lss->cursor < lss->end) {
+        const char *start = lss->cursor;
+        int nthreads = pool_size(pool);
+        size_t available = (size_t)(lss->end - start);
+        size_t span = (size_t)LSS_BATCH_BYTES * (size_t)nthreads;
+        const char *window_end = (span >= available) ? lss->end : lss_next_line(start + span, lss->end);
+        lss->cursor = window_end;
+
+        if (nthreads == 1) {
+            if (lss_parse_range(start, window_end, batch) != 0) return -1;
+            continue;
+        }
+
+        int nchunks = nthreads * LSS_CHUNKS_PER_THREAD;
+        if (batch->chunks == NULL) {
+            batch->chunks = calloc((size_t)nchunks, sizeof(LssChunk));
+            if (!batch->chunks) return -1;
+            batch->chunk_count = nchunks;
+        }
+
+        size_t window_size = (size_t)(window_end - start);
+        const char *chunk_begin = start;
+        for (int i = 0; i < nchunks; i++) {
+            const char *chunk_end = (i == nchunks - 1) ? window_end
+                : lss_next_line(start + window_size * (size_t)(i + 1) / (size_t)nchunks, window_end);
+            if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+            batch->chunks[i].begin = chunk_begin;
+            batch->chunks[i].end = chunk_end;
+            chunk_begin = chunk_end;
+        }
+
+        pool_run(pool, nchunks, lss_parse_task, batch);
+
+        size_t total = 0;
+        for (int i = 0; i < nchunks; i++) {
+            if (batch->chunks[i].failed) return -1;
+            batch->chunks[i].first = total;
+            total += batch->chunks[i].records.count;
+        }
+        if (lss_batch_reserve(batch, total) != 0) return -1;
+
+        pool_run(pool, nchunks, lss_merge_task, batch);
+        batch->count = total;
+    }
+    return batch->count > 0;
+}
+
+// Identifies the survey a cache or index was built from. Size and whole-second
+// mtime miss an edit made within the same second, so the stamp also holds the
+// mtime's nanoseconds, the inode and ctime where the platform has them, and a
+// hash of the first and last LSS_STAMP_SPAN bytes of the survey.
+
+#define LSS_STAMP_SPAN (64 * 1024)
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint64_t inode;
+    int64_t ctime;
+    uint64_t hash;
+} LssSourceStamp;
+
+static inline uint64_t lss_hash_bytes(uint64_t hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Returns 0 and fills stamp, or -1 when the survey cannot be read
+static inline int lss_source_stamp(const char *path, LssSourceStamp *stamp) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->size = (uint64_t)st.st_size;
+    stamp->mtime = (int64_t)st.st_mtime;
+    stamp->ctime = (int64_t)st.st_ctime;
+#if defined(__APPLE__)
+    stamp->mtime_nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    stamp->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+#endif
+#ifndef _WIN32
+    stamp->inode = (uint64_t)st.st_ino;
+#endif
+
+    MappedFile file;
+    if (map_file(path, &file) != 0) return -1;
+    size_t head = file.size < LSS_STAMP_SPAN ? file.size : LSS_STAMP_SPAN;
+    size_t tail = file.size - head < LSS_STAMP_SPAN ? file.size - head : LSS_STAMP_SPAN;
+    stamp->hash = 14695981039346656037ull;
+    if (file.data) {
+        stamp->hash = lss_hash_bytes(stamp->hash, file.data, head);
+        stamp->hash = lss_hash_bytes(stamp->hash, file.data + file.size - tail, tail);
+    }
+    unmap_file(&file);
+    return 0;
+}
+
+static inline int lss_source_stamp_equal(const LssSourceStamp *a, const LssSourceStamp *b) {
+    return a->size == b->size && a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+           a->inode == b->inode && a->ctime == b->ctime && a->hash == b->hash;
+}
+
+// Cache layout: an LssCacheHeader, then one block per batch, each holding
+// the batch's x, y and z doubles, uint32 code indices and flag bytes, padded
+// to 8 bytes. After the blocks come the block table ({offset, count} per
+// block), the code table (code_count + 1 uint32 offsets, then the bytes) and
+// the indices of every linked record. Code 0 is the empty code; malformed
+// records keep their line text as their code so warnings can be repeated.
+// The header also carries the x/y bounds of the well-formed records, so
+// writers that need them before the first point can skip a pass.
+// Everything is in native byte order; the cache is a local artefact.
+
+#define LSS_CACHE_MAGIC "LSSC"
+#define LSS_CACHE_VERSION 4
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    LssSourceStamp source;
+    uint64_t record_count;
+    uint64_t block_count;
+    uint64_t block_table_offset;
+    uint64_t code_count;
+    uint64_t code_table_offset;
+    uint64_t line_start_count;
+    uint64_t line_start_offset;
+    uint64_t point_count; // well-formed records
+    double min_x, min_y;
+    double max_x, max_y;
+} LssCacheHeader;
+
+typedef struct LssCacheWriter {
+    FILE *file;
+    char *path;
+    char *tmp_path;
+    LssCacheHeader header;
+    uint64_t offset;
+    uint64_t *blocks;
+    size_t block_capacity;
+    LssField *codes;
+    size_t code_capacity;
+    uint32_t *slots;
+    size_t slot_capacity;
+    uint32_t *code_index;
+    size_t index_capacity;
+    uint64_t *line_starts;
+    size_t line_start_capacity;
+    int failed;
+} LssCacheWriter;
+
+static inline uint32_t lss_hash(LssField field) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < field.len; i++) {
+        hash = (hash ^ (unsigned char)field.text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the index of code in the writer's code table, adding it if it is
+// new. Codes are views into the mapped survey, so nothing is copied.
+static inline int64_t lss_cache_intern(LssCacheWriter *w, LssField code) {
+    if (code.len == 0) return 0;
+
+    uint64_t count = w->header.code_count;
+    if ((count + 1) * 2 > w->slot_capacity) {
+        size_t capacity = w->slot_capacity ? w->slot_capacity * 2 : 1024;
+        uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+        if (!slots) return -1;
+        for (uint64_t i = 1; i < count; i++) {
+            size_t slot = lss_hash(w->codes[i]) & (capacity - 1);
+            while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+            slots[slot] = (uint32_t)i;
+        }
+        free(w->slots);
+        w->slots = slots;
+        w->slot_capacity = capacity;
+    }
+
+    size_t mask = w->slot_capacity - 1;
+    size_t slot = lss_hash(code) & mask;
+    while (w->slots[slot]) {
+        if (lss_field_equals(w->codes[w->slots[slot]], code)) return w->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    if (grow_array((void **)&w->codes, &w->code_capacity, count + 1, sizeof(LssField)) != 0) return -1;
+    w->codes[count] = code;
+    w->slots[slot] = (uint32_t)count;
+    w->header.code_count = count + 1;
+    return (int64_t)count;
+}
+
+static inline void lss_cache_put(LssCacheWriter *w, const void *data, size_t size) {
+    if (w->failed || size == 0) return;
+    if (fwrite(data, 1, size, w->file) != size) w->failed = 1;
+    w->offset += size;
+}
+
+static inline void lss_cache_align(LssCacheWriter *w) {
+    static const char zeros[8] = {0};
+    lss_cache_put(w, zeros, (size_t)((8 - w->offset % 8) % 8));
+}
+
+static inline void lss_cache_discard(LssFile *lss) {
+    LssCacheWriter *w = lss->writer;
+    if (!w) return;
+    if (w->file) fclose(w->file);
+    if (w->tmp_path) remove(w->tmp_path);
+    free(w->path);
+    free(w->tmp_path);
+    free(w->blocks);
+    free(w->codes);
+    free(w->slots);
+    free(w->code_index);
+    free(w->line_starts);
+    free(w);
+    lss->writer = NULL;
+}
+
+static inline void lss_cache_write_batch(LssFile *lss, const LssBatch *batch) {
+    LssCacheWriter *w = lss->writer;
+    size_t n = batch->count;
+    if (grow_array((void **)&w->code_index, &w->index_capacity, n, sizeof(uint32_t)) != 0 ||
+        grow_array((void **)&w->blocks, &w->block_capacity, 2 * (w->header.block_count + 1), sizeof(uint64_t)) != 0) {
+        w->failed = 1;
+        return;
+    }
+
+    LssCacheHeader *h = &w->header;
+    for (size_t i = 0; i < n; i++) {
+        int malformed = (batch->flags[i] & LSS_FLAG_MALFORMED) != 0;
+        int64_t index = lss_cache_intern(w, malformed ? batch->line[i] : batch->code[i]);
+        if (index < 0) {
+            w->failed = 1;
+            return;
+        }
+        w->code_index[i] = (uint32_t)index;
+
+        if (!malformed) {
+            double x = batch->x[i], y = batch->y[i];
+            if (h->point_count++ == 0) {
+                h->min_x = h->max_x = x;
+                h->min_y = h->max_y = y;
+            }
+            if (x < h->min_x) h->min_x = x;
+            if (x > h->max_x) h->max_x = x;
+            if (y < h->min_y) h->min_y = y;
+            if (y > h->max_y) h->max_y = y;
+        }
+
+        if (batch->flags[i] & LSS_FLAG_LINKED) {
+            size_t count = w->header.line_start_count;
+            if (grow_array((void **)&w->line_starts, &w->line_start_capacity, count + 1, sizeof(uint64_t)) != 0) {
+                w->failed = 1;
+                return;
+            }
+            w->line_starts[count] = w->header.record_count + i;
+            w->header.line_start_count = count + 1;
+        }
+    }
+
+    w->blocks[2 * w->header.block_count] = w->offset;
+    w->blocks[2 * w->header.block_count + 1] = n;
+    w->header.block_count++;
+    w->header.record_count += n;
+
+    lss_cache_put(w, batch->x, n * sizeof(double));
+    lss_cache_put(w, batch->y, n * sizeof(double));
+    lss_cache_put(w, batch->z, n * sizeof(double));
+    lss_cache_put(w, w->code_index, n * sizeof(uint32_t));
+    lss_cache_put(w, batch->flags, n);
+    lss_cache_align(w);
+}
+
+// Writes the tables and the final header, then moves the finished cache into
+// place. Any failure just leaves the survey uncached.
+static inline void lss_cache_finish(LssFile *lss) {
+    LssCacheWriter *w = lss->writer;
+
+    w->header.block_table_offset = w->offset;
+    lss_cache_put(w, w->blocks, (size_t)w->header.block_count * 2 * sizeof(uint64_t));
+
+    w->header.code_table_offset = w->offset;
+    uint32_t text_offset = 0;
+    for (uint64_t i = 0; i <= w->header.code_count; i++) {
+        lss_cache_put(w, &text_offset, sizeof(text_offset));
+        if (i < w->header.code_count) text_offset += (uint32_t)w->codes[i].len;
+    }
+    for (uint64_t i = 0; i < w->header.code_count; i++) {
+        lss_cache_put(w, w->codes[i].text, w->codes[i].len);
+    }
+    lss_cache_align(w);
+
+    w->header.line_start_offset = w->offset;
+    lss_cache_put(w, w->line_starts, (size_t)w->header.line_start_count * sizeof(uint64_t));
+
+    if (!w->failed && (fseek(w->file, 0, SEEK_SET) != 0 ||
+                       fwrite(&w->header, sizeof(w->header), 1, w->file) != 1)) {
+        w->failed = 1;
+    }
+    if (fclose(w->file) != 0) w->failed = 1;
+    w->file = NULL;
+
+    if (!w->failed) {
+        remove(w->path);
+        if (rename(w->tmp_path, w->path) == 0) {
+            free(w->tmp_path);
+            w->tmp_path = NULL;
+        }
+    }
+    lss_cache_discard(lss);
+}
+
+static inline int lss_cache_valid(const MappedFile *cache, const LssSourceStamp *source) {
+    if (cache->size < sizeof(LssCacheHeader)) return 0;
+    const LssCacheHeader *h = (const LssCacheHeader *)cache->data;
+    if (memcmp(h->magic, LSS_CACHE_MAGIC, 4) != 0 || h->version != LSS_CACHE_VERSION) return 0;
+    if (!lss_source_stamp_equal(&h->source, source)) return 0;
+
+    uint64_t size = cache->size;
+    if (h->block_table_offset > size || h->block_count > (size - h->block_table_offset) / 16) return 0;
+    if (h->code_table_offset > size || h->code_count + 1 > (size - h->code_table_offset) / 4) return 0;
+    if (h->line_start_offset > size || h->line_start_count > (size - h->line_start_offset) / 8) return 0;
+
+    const uint64_t *blocks = (const uint64_t *)(cache->data + h->block_table_offset);
+    for (uint64_t i = 0; i < h->block_count; i++) {
+        uint64_t offset = blocks[2 * i], count = blocks[2 * i + 1];
+        if (offset > size || count > (size - offset) / 29) return 0;
+    }
+    const uint32_t *text_offsets = (const uint32_t *)(cache->data + h->code_table_offset);
+    uint64_t text_start = h->code_table_offset + (h->code_count + 1) * 4;
+    return text_offsets[h->code_count] <= size - text_start;
+}
+
+// Switches the reader to the survey's .lssc cache when it is up to date, or
+// starts writing one alongside this read. Call before the first batch. The
+// cache holds no coordinate text, so tools that echo the text leave it off.
+static inline void lss_enable_cache(LssFile *lss, const char *path) {
+    LssSourceStamp source;
+    if (lss_source_stamp(path, &source) != 0) return;
+
+    size_t path_len = strlen(path);
+    char *cache_path = malloc(path_len + 6);
+    char *tmp_path = malloc(path_len + 10);
+    if (!cache_path || !tmp_path) {
+        free(cache_path);
+        free(tmp_path);
+        return;
+    }
+    snprintf(cache_path, path_len + 6, "%s.lssc", path);
+    snprintf(tmp_path, path_len + 10, "%s.lssc.tmp", path);
+
+    if (map_file(cache_path, &lss->cache) == 0) {
+        if (lss_cache_valid(&lss->cache, &source)) {
+            lss->cached = 1;
+            lss->next_block = 0;
+            free(cache_path);
+            free(tmp_path);
+            return;
+        }
+        unmap_file(&lss->cache);
+    }
+
+    LssCacheWriter *w = calloc(1, sizeof(LssCacheWriter));
+    if (!w) {
+        free(cache_path);
+        free(tmp_path);
+        return;
+    }
+    lss->writer = w;
+    w->path = cache_path;
+    w->tmp_path = tmp_path;
+    memcpy(w->header.magic, LSS_CACHE_MAGIC, 4);
+    w->header.version = LSS_CACHE_VERSION;
+    w->header.source = source;
+    w->header.code_count = 1;
+    if (grow_array((void **)&w->codes, &w->code_capacity, 1, sizeof(LssField)) != 0) {
+        lss_cache_discard(lss);
+        return;
+    }
+    w->codes[0].text = "";
+    w->codes[0].len = 0;
+
+    w->file = fopen(tmp_path, "wb");
+    if (!w->file) {
+        free(w->tmp_path);
+        w->tmp_path = NULL;
+        lss_cache_discard(lss);
+        return;
+    }
+    LssCacheHeader placeholder = {0};
+    lss_cache_put(w, &placeholder, sizeof(placeholder));
+}
+
+static inline int lss_read_cache_batch(LssFile *lss, LssBatch *batch) {
+    const char *base = lss->cache.data;
+    const LssCacheHeader *h = (const LssCacheHeader *)base;
+    if (lss->next_block >= h->block_count) return 0;
+
+    const uint64_t *blocks = (const uint64_t *)(base + h->block_table_offset);
+    uint64_t offset = blocks[2 * lss->next_block];
+    size_t n = (size_t)blocks[2 * lss->next_block + 1];
+    lss->next_block++;
+    if (lss_batch_reserve(batch, n) != 0) return -1;
+
+    const char *p = base + offset;
+    memcpy(batch->x, p, n * sizeof(double));
+    memcpy(batch->y, p + n * 8, n * sizeof(double));
+    memcpy(batch->z, p + n * 16, n * sizeof(double));
+    const uint32_t *code_index = (const uint32_t *)(p + n * 24);
+    memcpy(batch->flags, p + n * 28, n);
+
+    const uint32_t *text_offsets = (const uint32_t *)(base + h->code_table_offset);
+    const char *text = (const char *)(text_offsets + h->code_count + 1);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t index = code_index[i] < h->code_count ? code_index[i] : 0;
+        LssField code = { text + text_offsets[index], text_offsets[index + 1] - text_offsets[index] };
+        LssField empty = { text, 0 };
+        int malformed = (batch->flags[i] & LSS_FLAG_MALFORMED) != 0;
+        batch->code[i] = malformed ? empty : code;
+        batch->line[i] = malformed ? code : empty;
+    }
+    batch->count = n;
+    return 1;
+}
+
+// Reads the next batch of records into batch, replacing its previous
+// contents, from the cache when one is mapped and from the survey text
+// otherwise. Returns 1 when records were read, 0 at the end of the file and
+// -1 if memory ran out. The views in batch stay valid until lss_close.
+static inline int lss_read_batch(LssFile *lss, LssBatch *batch, ThreadPool *pool) {
+    if (lss->cached) return lss_read_cache_batch(lss, batch);
+
+    int status = lss_read_text_batch(lss, batch, pool);
+    if (lss->writer) {
+        if (status > 0) lss_cache_write_batch(lss, batch);
+        else if (status == 0) lss_cache_finish(lss);
+        else lss_cache_discard(lss);
+        if (lss->writer && lss->writer->failed) lss_cache_discard(lss);
+    }
+    return status;
+}
+
+static inline int lss_open(const char *path, LssFile *lss) {
+    memset(lss, 0, sizeof(*lss));
+    if (map_file(path, &lss->file) != 0) return -1;
+    lss->cursor = lss->file.data;
+    lss->end = lss->file.data + lss->file.size;
+    return 0;
+}
+
+// Restarts reading from the first record. A cache that is still being
+// written is dropped, since it would otherwise see the records twice.
+static inline void lss_rewind(LssFile *lss) {
+    lss->cursor = lss->file.data;
+    lss->next_block = 0;
+    lss_cache_discard(lss);
+}
+
+// Finds the x/y bounds of the survey's well-formed records before any are
+// read, for writers that fix their offsets up front. A current cache holds
+// them already; otherwise the survey is read through once, writing the cache
+// that the real read then maps. Call after lss_enable_cache. Returns the
+// number of well-formed records (the bounds are 0 when there are none), or
+// -1 if memory ran out.
+static inline int64_t lss_survey_bounds(LssFile *lss, const char *path, ThreadPool *pool,
+                                        double *min_x, double *min_y, double *max_x, double *max_y) {
+    uint64_t count = 0;
+    *min_x = *min_y = *max_x = *max_y = 0.0;
+    if (!lss->cached) {
+        LssBatch batch = {0};
+        int status;
+        while ((status = lss_read_batch(lss, &batch, pool)) > 0) {
+            for (size_t i = 0; i < batch.count; i++) {
+                if (batch.flags[i] & LSS_FLAG_MALFORMED) continue;
+                double x = batch.x[i], y = batch.y[i];
+                if (count++ == 0) {
+                    *min_x = *max_x = x;
+                    *min_y = *max_y = y;
+                }
+                if (x < *min_x) *min_x = x;
+                if (x > *max_x) *max_x = x;
+                if (y < *min_y) *min_y = y;
+                if (y > *max_y) *max_y = y;
+            }
+        }
+        lss_batch_free(&batch);
+        lss_rewind(lss);
+        if (status < 0) return -1;
+        lss_enable_cache(lss, path);
+        return (int64_t)count;
+    }
+
+    const LssCacheHeader *h = (const LssCacheHeader *)lss->cache.data;
+    if (h->point_count > 0) {
+        *min_x = h->min_x;
+        *min_y = h->min_y;
+        *max_x = h->max_x;
+        *max_y = h->max_y;
+    }
+    return (int64_t)h->point_count;
+}
+
+static inline void lss_close(LssFile *lss) {
+    lss_cache_discard(lss);
+    if (lss->cached) unmap_file(&lss->cache);
+    unmap_file(&lss->file);
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef LZW_H
+#define LZW_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// TIFF flavour of LZW (Compression = 5): MSB-first codes from 9 to 12 bits,
+// ClearCode 256, EndOfInformation 257 and the "early change" code width
+// switch that libtiff and every other reader expect.
+
+#define LZW_CLEAR 256
+#define LZW_EOI 257
+#define LZW_FIRST_FREE 258
+#define LZW_MAX_CODE 4095
+#define LZW_HASH_SIZE 8192
+
+typedef struct {
+    uint8_t *out;
+    size_t capacity;
+    size_t pos;
+    uint32_t bits;
+    int bit_count;
+    int overflow;
+} LzwBits;
+
+static inline void lzw_put_code(LzwBits *bw, uint32_t code, int nbits) {
+    bw->bits = (bw->bits << nbits) | code;
+    bw->bit_count += nbits;
+    while (bw->bit_count >= 8) {
+        bw->bit_count -= 8;
+        if (bw->pos < bw->capacity) bw->out[bw->pos++] = (uint8_t)(bw->bits >> bw->bit_count);
+        else bw->overflow = 1;
+    }
+    bw->bits &= (1u << bw->bit_count) - 1;
+}
+
+// Worst case is one 12-bit code per input byte plus the clear/EOI codes
+static inline size_t lzw_bound(size_t length) {
+    return length + length / 2 + 16;
+}
+
+// Compresses src into dst. Returns the encoded size, or 0 if dst is too small.
+static inline size_t lzw_compress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity) {
+    int32_t keys[LZW_HASH_SIZE];
+    uint16_t values[LZW_HASH_SIZE];
+    memset(keys, 0xff, sizeof(keys));
+
+    LzwBits bw = { dst, capacity, 0, 0, 0, 0 };
+    int nbits = 9;
+    int free_code = LZW_FIRST_FREE;
+    lzw_put_code(&bw, LZW_CLEAR, nbits);
+
+    if (length == 0) {
+        lzw_put_code(&bw, LZW_EOI, nbits);
+        if (bw.bit_count > 0) lzw_put_code(&bw, 0, 8 - bw.bit_count);
+        return bw.overflow ? 0 : bw.pos;
+    }
+
+    int32_t prefix = src[0];
+    for (size_t i = 1; i < length; i++) {
+        uint8_t c = src[i];
+        int32_t key = (prefix << 8) | c;
+        uint32_t slot = ((uint32_t)key * 2654435761u) >> (32 - 13);
+
+        while (keys[slot] >= 0 && keys[slot] != key) slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+        if (keys[slot] == key) {
+            prefix = values[slot];
+            continue;
+        }
+
+        lzw_put_code(&bw, (uint32_t)prefix, nbits);
+        keys[slot] = key;
+        values[slot] = (uint16_t)free_code++;
+
+        if (free_code == LZW_MAX_CODE - 1) {
+            lzw_put_code(&bw, LZW_CLEAR, nbits);
+            memset(keys, 0xff, sizeof(keys));
+            nbits = 9;
+            free_code = LZW_FIRST_FREE;
+        } else if (free_code > (1 << nbits) - 1) {
+            nbits++;
+        }
+        prefix = c;
+    }
+
+    // The decoder still adds a table entry for the final code, so the width
+    // of the EOI code has to follow the same rule
+    lzw_put_code(&bw, (uint32_t)prefix, nbits);
+    free_code++;
+    if (free_code == LZW_MAX_CODE - 1) {
+        lzw_put_code(&bw, LZW_CLEAR, nbits);
+        nbits = 9;
+    } else if (free_code > (1 << nbits) - 1) {
+        nbits++;
+    }
+    lzw_put_code(&bw, LZW_EOI, nbits);
+    if (bw.bit_count > 0) lzw_put_code(&bw, 0, 8 - bw.bit_count);
+
+    return bw.overflow ? 0 : bw.pos;
+}
+
+#endif
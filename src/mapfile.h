@@ -0,0 +1,103 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stddef.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Read-only view of a whole input file. The tools only ever scan their input
+// front to back, so mapping it lets the parsers walk the bytes directly
+// instead of copying every line through fgets.
+typedef struct {
+    const char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file_handle;
+    HANDLE mapping_handle;
+#else
+    int fd;
+#endif
+} MappedFile;
+
+static inline int map_file(const char *path, MappedFile *mf) {
+    mf->data = NULL;
+    mf->size = 0;
+
+#ifdef _WIN32
+    mf->file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    mf->mapping_handle = NULL;
+    if (mf->file_handle == INVALID_HANDLE_VALUE) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->file_handle, &size)) {
+        CloseHandle(mf->file_handle);
+        errno = EIO;
+        return -1;
+    }
+    mf->size = (size_t)size.QuadPart;
+    if (mf->size == 0) return 0;
+
+    mf->mapping_handle = CreateFileMappingA(mf->file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mf->mapping_handle == NULL) {
+        CloseHandle(mf->file_handle);
+        errno = EIO;
+        return -1;
+    }
+    mf->data = (const char *)MapViewOfFile(mf->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (mf->data == NULL) {
+        CloseHandle(mf->mapping_handle);
+        CloseHandle(mf->file_handle);
+        errno = ENOMEM;
+        return -1;
+    }
+#else
+    mf->fd = open(path, O_RDONLY);
+    if (mf->fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(mf->fd, &st) != 0) {
+        close(mf->fd);
+        return -1;
+    }
+    mf->size = (size_t)st.st_size;
+    if (mf->size == 0) return 0;
+
+    void *addr = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+    if (addr == MAP_FAILED) {
+        close(mf->fd);
+        return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(addr, mf->size, MADV_SEQUENTIAL);
+#endif
+    mf->data = (const char *)addr;
+#endif
+    return 0;
+}
+
+static inline void unmap_file(MappedFile *mf) {
+#ifdef _WIN32
+    if (mf->data) UnmapViewOfFile((LPCVOID)mf->data);
+    if (mf->mapping_handle) CloseHandle(mf->mapping_handle);
+    CloseHandle(mf->file_handle);
+#else
+    if (mf->data) munmap((void *)mf->data, mf->size);
+    close(mf->fd);
+#endif
+    mf->data = NULL;
+    mf->size = 0;
+}
+
+#endif
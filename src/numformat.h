@@ -0,0 +1,58 @@
+#ifndef NUMFORMAT_H
+#define NUMFORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+// Fixed-point number formatting for the text writers. The value is scaled by
+// a power of ten, rounded to an integer and written out digit by digit, which
+// gives the same text as printf's "%.*f" without its per-call cost. Values
+// too close to a rounding tie for the scaled double to decide, very large
+// values, nan/inf and more than NUMFORMAT_MAX_DECIMALS places fall back to
+// snprintf.
+
+#define NUMFORMAT_MAX_DECIMALS 9
+// Room for "%.9f" of the largest double
+#define NUMFORMAT_SIZE 352
+
+static const double numformat_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static inline int format_fixed_slow(char *out, double value, int decimals) {
+    int length = snprintf(out, NUMFORMAT_SIZE, "%.*f", decimals, value);
+    return length < NUMFORMAT_SIZE ? length : NUMFORMAT_SIZE - 1;
+}
+
+// Formats value like "%.*f" into out (NUMFORMAT_SIZE bytes) and returns the
+// length. The text is not nul-terminated on the fast path.
+static inline int format_fixed(char *out, double value, int decimals) {
+    if (decimals < 0 || decimals > NUMFORMAT_MAX_DECIMALS) {
+        return format_fixed_slow(out, value, decimals);
+    }
+
+    double scaled = fabs(value) * numformat_pow10[decimals];
+    double rounded = nearbyint(scaled);
+    if (!(scaled < 1e15) || fabs(fabs(scaled - rounded) - 0.5) <= scaled * 1e-15 + 1e-12) {
+        return format_fixed_slow(out, value, decimals);
+    }
+
+    char digits[24];
+    int count = 0;
+    uint64_t n = (uint64_t)rounded;
+    do {
+        digits[count++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (count <= decimals) digits[count++] = '0';
+
+    int length = 0;
+    if (signbit(value)) out[length++] = '-';
+    while (count > decimals) out[length++] = digits[--count];
+    if (decimals) out[length++] = '.';
+    while (count > 0) out[length++] = digits[--count];
+    return length;
+}
+
+#endif
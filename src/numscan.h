@@ -0,0 +1,116 @@
+#ifndef NUMSCAN_H
+#define NUMSCAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hand-rolled decimal scanner for the mapped text readers. Survey and raster
+// values are short fixed-point decimals, so almost every token fits in a
+// 64-bit mantissa with a small power-of-ten exponent and converts exactly with
+// one multiply or divide. Anything else (very long mantissas, huge exponents,
+// nan/inf) falls back to strtod on a copied token.
+
+static const double numscan_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int numscan_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+static inline int numscan_is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char *scan_double_slow(const char *p, const char *end, double *out) {
+    char buffer[64];
+    size_t len = 0;
+    while (p + len < end && len < sizeof(buffer) - 1 && !numscan_is_space(p[len]) && p[len] != ',') {
+        len++;
+    }
+    memcpy(buffer, p, len);
+    buffer[len] = '\0';
+
+    char *stop;
+    *out = strtod(buffer, &stop);
+    if (stop == buffer) return NULL;
+    return p + (stop - buffer);
+}
+
+// Parses one number starting exactly at p. Returns the first byte after it, or
+// NULL if p does not start a number.
+static inline const char *scan_double(const char *p, const char *end, double *out) {
+    const char *start = p;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    int seen_digit = 0;
+    int truncated = 0;
+
+    while (p < end && numscan_is_digit(*p)) {
+        seen_digit = 1;
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa) significant++;
+        } else {
+            exponent++;
+            truncated = 1;
+        }
+        p++;
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && numscan_is_digit(*p)) {
+            seen_digit = 1;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) significant++;
+                exponent--;
+            } else {
+                truncated = 1;
+            }
+            p++;
+        }
+    }
+
+    if (!seen_digit) return scan_double_slow(start, end, out);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int exp_negative = 0;
+        if (q < end && (*q == '-' || *q == '+')) {
+            exp_negative = (*q == '-');
+            q++;
+        }
+        if (q < end && numscan_is_digit(*q)) {
+            int exp_value = 0;
+            while (q < end && numscan_is_digit(*q)) {
+                if (exp_value < 10000) exp_value = exp_value * 10 + (*q - '0');
+                q++;
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = q;
+        }
+    }
+
+    if (truncated || mantissa > ((uint64_t)1 << 53) || exponent > 22 || exponent < -22) {
+        return scan_double_slow(start, end, out);
+    }
+
+    double value = (double)mantissa;
+    if (exponent < 0) value /= numscan_pow10[-exponent];
+    else if (exponent > 0) value *= numscan_pow10[exponent];
+    *out = negative ? -value : value;
+    return p;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Small fixed-size worker pool shared by the tools that offer -threads.
+// pool_run hands out task indices 0..count-1 to the workers and to the calling
+// thread, and returns once every index has been processed. Threads are created
+// once and reused, so tools can call pool_run for every window or block.
+
+typedef void (*PoolTask)(void *ctx, int index);
+
+typedef struct {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    PoolTask task;
+    void *ctx;
+    int count;
+    int next;
+    int remaining;
+    unsigned generation;
+    int shutdown;
+} ThreadPool;
+
+static inline void pool_drain(ThreadPool *pool) {
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next >= pool->count) {
+            pthread_mutex_unlock(&pool->lock);
+            return;
+        }
+        int index = pool->next++;
+        PoolTask task = pool->task;
+        void *ctx = pool->ctx;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(ctx, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->remaining == 0) pthread_cond_broadcast(&pool->work_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static inline void *pool_worker(void *arg) {
+    ThreadPool *pool = (ThreadPool *)arg;
+    unsigned seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_drain(pool);
+    }
+}
+
+// Creates a pool that runs tasks on nthreads threads in total (the caller
+// counts as one). Returns NULL on failure.
+static inline ThreadPool *pool_create(int nthreads) {
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+    if (nthreads < 1) nthreads = 1;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    pool->threads = malloc((size_t)nthreads * sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->nthreads = 1;
+    for (int i = 0; i < nthreads - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+            fprintf(stderr, "Warning: could only start %d of %d threads\n", pool->nthreads, nthreads);
+            break;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+static inline void pool_run(ThreadPool *pool, int count, PoolTask task, void *ctx) {
+    if (count <= 0) return;
+    if (pool == NULL || pool->nthreads == 1 || count == 1) {
+        for (int i = 0; i < count; i++) task(ctx, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->count = count;
+    pool->next = 0;
+    pool->remaining = count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_drain(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->remaining > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline int pool_size(const ThreadPool *pool) {
+    return pool ? pool->nthreads : 1;
+}
+
+static inline void pool_destroy(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads - 1; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool);
+}
+
+#endif